@@ -65,6 +65,47 @@
 #include "DataFlash.h"
 #include "DataFlashCommands.h"
 
+/**
+ * Time the CS pin must stay high after a resume from Deep Power-down
+ * before the device can receive any commands (t_RDPD).
+ * On the at45db161D t_RDPD = 35 microseconds. Wait 40us (just to be sure).
+ **/
+#define AT45_RESUME_DELAY 40
+
+/**
+ * Both SRAM buffers. Used when the operation in progress doesn't allow
+ * buffer accesses, or when it's unknown.
+ **/
+#define AT45_ALL_BUFFERS 0x03
+
+/**
+ * Highest SPI clock (Hz) supported by the low frequency read opcodes.
+ **/
+#define AT45_LOW_SPEED_MAX_CLOCK 33000000UL
+
+/**
+ * Flag of DataFlash::startOperation() keeping the measured duration out
+ * of the typical one.
+ **/
+#define AT45_TIMING_UNCALIBRATED 0x80
+
+/**
+ * Initial typical durations (us), indexed by DataFlash::timing. Typical
+ * values of the AT45DB161D datasheet, or the maximum when no typical
+ * value is given (transfer and compare).
+ **/
+static const uint32_t defaultTypicalTime[DataFlash::TIMING_COUNT] =
+{
+    200,        // t_XFR
+    200,        // t_COMP
+    2000,       // t_P
+    14000,      // t_EP
+    13000,      // t_PE
+    30000,      // t_BE
+    1600000     // t_SE
+};
+
+
 /**
  * @mainpage Atmel Dataflash library for Arduino.
  *
@@ -132,9 +173,33 @@ void DataFlash::setup(int8_t csPin, int8_t resetPin, int8_t wpPin)
     }
 
     m_erase = ERASE_AUTO;
-#ifdef AT45_USE_SPI_SPEED_CONTROL
-    m_speed = SPEED_LOW;
+
+    m_streamOwner       = 0;
+    m_busyBuffers       = AT45_ALL_BUFFERS;
+    m_blankBuffer       = -1;
+    m_operation         = TIMING_NONE;
+    m_operationStart    = 0;
+    for(uint8_t i=0; i<TIMING_COUNT; i++)
+    {
+        m_typical[i] = defaultTypicalTime[i];
+    }
+    m_modifyHook        = 0;
+    m_modifyHookContext = 0;
+    m_yieldHook         = 0;
+    m_yieldHookContext  = 0;
+
+    m_power       = POWER_ACTIVE;
+    m_idleTimeout = 0;
+    m_lastAccess  = 0;
+    resetPowerStats();
+#ifdef AT45_USE_STATS
+    resetStats();
 #endif
+#ifdef AT45_USE_TRACE
+    resetTrace();
+#endif
+    m_speed = SPEED_LOW;
+    m_clock = 0;
         
     /* Setup SPI */
     SPI.setDataMode(SPI_MODE3);
@@ -152,6 +217,10 @@ void DataFlash::setup(int8_t csPin, int8_t resetPin, int8_t wpPin)
     m_bufferSize = m_infos[m_deviceIndex].bufferSize - (stat & 1);
     m_pageSize   = m_infos[m_deviceIndex].pageSize;  
     m_sectorSize = m_infos[m_deviceIndex].sectorSize;
+
+    /* The protection register is only read if needed. */
+    m_protectionEnabled = (stat & AT45_PROTECT) ? true : false;
+    m_protectionCached  = false;
 }
 
 /** 
@@ -161,8 +230,12 @@ void DataFlash::setup(int8_t csPin, int8_t resetPin, int8_t wpPin)
  * **/
 void DataFlash::begin()
 {
-    // Clear pending SPI interrupts?
-// [todo] SPISEttings    
+    /* Apply the clock set by setClock(). Without it, the configuration
+     * made by setup() is kept. */
+    if(m_clock)
+    {
+        SPI.beginTransaction(m_settings);
+    }
 }
 
 /**
@@ -173,6 +246,11 @@ void DataFlash::end()
     /* Disable device */
     disable();
 
+    if(m_clock)
+    {
+        SPI.endTransaction();
+    }
+
     /* Don't call SPI.end() here to allow use of SPI interface with
     another chip. */
 }
@@ -182,6 +260,15 @@ void DataFlash::end()
  **/
 void DataFlash::reEnable()
 {
+    if(m_power != POWER_ACTIVE)
+    {
+        wakeUp();
+    }
+    if(m_idleTimeout)
+    {
+        m_lastAccess = millis();
+    }
+
     disable();
     enable();
 }
@@ -208,7 +295,6 @@ void DataFlash::manualErase()
  * Note: Arduino supports 20MHz max, so using "high" is actually slower
  * because additional bytes have to be transferred for no benefit.
  **/
-#ifdef AT45_USE_SPI_SPEED_CONTROL
 void DataFlash::setTransferSpeed(DataFlash::IOspeed rate)
 {
     m_speed = rate;
@@ -221,7 +307,21 @@ DataFlash::IOspeed DataFlash::getTransferSpeed() const
 {
     return m_speed;
 }
-#endif // AT45_USE_SPI_SPEED_CONTROL
+
+/**
+ * Set the SPI clock used by this device and select the transfer speed.
+ * @param hz SPI clock frequency in Hz, 0 to keep the SPI configuration
+ *        set by setup().
+ **/
+void DataFlash::setClock(uint32_t hz)
+{
+    m_clock = hz;
+    m_speed = (hz > AT45_LOW_SPEED_MAX_CLOCK) ? SPEED_HIGH : SPEED_LOW;
+    if(hz)
+    {
+        m_settings = SPISettings(hz, MSBFIRST, SPI_MODE3);
+    }
+}
 
 /**
  * Return whether the chip has completed the current operation and is
@@ -236,11 +336,156 @@ uint8_t DataFlash::isReady()
 
 /**
  * Wait until the chip is ready.
+ * For a timed operation, the bus is left alone until 3/4 of the typical
+ * duration, then the status register is polled with an interval doubling
+ * from 1/32 of the typical duration (bounded by AT45_POLL_MIN_INTERVAL
+ * and AT45_POLL_MAX_INTERVAL). The measured duration then updates the
+ * typical one.
+ * The yield hook is called while waiting. As it may run longer than the
+ * poll interval, the end of the operation is taken halfway between the
+ * last busy status and the ready one.
  **/
 void DataFlash::waitUntilReady()
 {
-    /* Wait for the end of the transfer taking place. */
-    while(!isReady()) {};
+    uint32_t start = micros();
+
+    if(m_operation == TIMING_NONE)
+    {
+        /* Wait for the end of the transfer taking place. */
+        while(!isReady())
+        {
+            yieldWait(start);
+        }
+    }
+    else
+    {
+        uint8_t  operation = m_operation;
+        uint32_t typical   = m_typical[operation & ~AT45_TIMING_UNCALIBRATED];
+        uint32_t quiet     = typical - (typical >> 2);
+
+        /* Without a busy status, the duration is only bounded if the wait
+         * starts before the end of the quiet period. */
+        bool bounded = (micros() - m_operationStart) < quiet;
+        while((micros() - m_operationStart) < quiet)
+        {
+            yieldWait(start);
+        }
+
+        uint32_t interval = typical >> 5;
+        if(interval < AT45_POLL_MIN_INTERVAL)
+        {
+            interval = AT45_POLL_MIN_INTERVAL;
+        }
+        else if(interval > AT45_POLL_MAX_INTERVAL)
+        {
+            interval = AT45_POLL_MAX_INTERVAL;
+        }
+        bool     busy = false;
+        uint32_t busyAt = 0;
+        while(!isReady())
+        {
+            busy   = true;
+            busyAt = micros() - m_operationStart;
+
+            uint32_t poll = micros();
+            while((micros() - poll) < interval)
+            {
+                yieldWait(start);
+            }
+
+            interval <<= 1;
+            if(interval > AT45_POLL_MAX_INTERVAL)
+            {
+                interval = AT45_POLL_MAX_INTERVAL;
+            }
+        }
+
+        uint32_t elapsed = micros() - m_operationStart;
+        if(!(operation & AT45_TIMING_UNCALIBRATED))
+        {
+            if(busy)
+            {
+                calibrate(operation, busyAt + ((elapsed - busyAt) >> 1));
+            }
+            else if(bounded && (elapsed <= typical))
+            {
+                calibrate(operation, elapsed);
+            }
+        }
+    }
+#ifdef AT45_USE_STATS
+    m_stats.busyWait += micros() - start;
+#endif
+}
+
+/**
+ * Set the function called repeatedly while waiting for the %Dataflash.
+ * @param hook Hook function (0 to remove it).
+ * @param context User data passed to the hook.
+ **/
+void DataFlash::setYieldHook(YieldHook hook, void *context)
+{
+    m_yieldHook        = hook;
+    m_yieldHookContext = context;
+}
+
+/**
+ * Wait for a given time, calling the yield hook meanwhile.
+ * @param us Time to wait (us).
+ **/
+void DataFlash::delayWithYield(uint32_t us)
+{
+    uint32_t start = micros();
+    while((micros() - start) < us)
+    {
+        yieldWait(start);
+    }
+}
+
+/**
+ * Set the typical duration of an internal operation.
+ * @param operation Operation (see DataFlash::timing).
+ * @param us Duration in microseconds.
+ **/
+void DataFlash::setTypicalTime(uint8_t operation, uint32_t us)
+{
+    if(operation < TIMING_COUNT)
+    {
+        m_typical[operation] = us;
+    }
+}
+
+/**
+ * Update the typical duration of an operation with a measure.
+ * The typical duration moves by 1/8 of the difference (exponentially
+ * weighted moving average).
+ * @param operation Operation (see DataFlash::timing).
+ * @param elapsed Measured duration (us).
+ **/
+void DataFlash::calibrate(uint8_t operation, uint32_t elapsed)
+{
+    uint32_t &typical = m_typical[operation];
+    if(elapsed > typical)
+    {
+        typical += (elapsed - typical) >> 3;
+    }
+    else
+    {
+        typical -= (typical - elapsed) >> 3;
+    }
+}
+
+/**
+ * Wait until the operation in progress no longer uses a SRAM buffer.
+ * The chip may still be busy working with the other buffer.
+ * @param bufferNum Buffer (0 or 1).
+ **/
+void DataFlash::waitUntilBufferReady(uint8_t bufferNum)
+{
+    if(m_busyBuffers & bufferMask(bufferNum))
+    {
+        waitUntilReady();
+    }
 }
 
 /** 
@@ -254,11 +499,25 @@ uint8_t DataFlash::status()
     reEnable();     // Reset command decoder.
   
     /* Send status read command */
-    SPI.transfer(DATAFLASH_STATUS_REGISTER_READ);
+    transfer(DATAFLASH_STATUS_REGISTER_READ);
     /* Get result with a dummy write */
-    status = SPI.transfer(0);
+    status = transfer(0);
 
     disable();
+
+    if(status & AT45_READY)
+    {
+        m_busyBuffers = 0;
+        m_operation   = TIMING_NONE;
+    }
+
+#ifdef AT45_USE_STATS
+    ++m_stats.statusPolls;
+    if(status & AT45_READY)
+    {
+        statsCompleted();
+    }
+#endif
     
     return status;
 }
@@ -266,7 +525,7 @@ uint8_t DataFlash::status()
 /** 
  * Read Manufacturer and Device ID.
  * @note If id.extendedInfoLength is not equal to zero,
- *       successive calls to SPI.transfer() return
+ *       successive calls to transfer() return
  *       the extended device information bytes.
  * @param id ID structure.
  **/
@@ -275,16 +534,16 @@ void DataFlash::readID(struct DataFlash::ID &id)
     reEnable();     // Reset command decoder.
   
     /* Send status read command */
-    SPI.transfer(DATAFLASH_READ_MANUFACTURER_AND_DEVICE_ID);
+    transfer(DATAFLASH_READ_MANUFACTURER_AND_DEVICE_ID);
 
     /* Manufacturer ID */
-    id.manufacturer = SPI.transfer(0);
+    id.manufacturer = transfer(0);
     /* Device ID (part 1) */
-    id.device[0] = SPI.transfer(0);
+    id.device[0] = transfer(0);
     /* Device ID (part 2) */
-    id.device[1] = SPI.transfer(0);
+    id.device[1] = transfer(0);
     /* Extended Device Information String Length */
-    id.extendedInfoLength = SPI.transfer(0);
+    id.extendedInfoLength = transfer(0);
     
     disable();
 }
@@ -305,18 +564,18 @@ void DataFlash::pageRead(uint16_t page, uint16_t offset)
     reEnable();     // Reset command decoder.
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_PAGE_READ);
+    transfer(DATAFLASH_PAGE_READ);
     
     /* Address (page | offset)  */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
-    SPI.transfer((uint8_t)(offset & 0xff));
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
+    transfer((uint8_t)(offset & 0xff));
     
     /* 4 "don't care" bytes */
-    SPI.transfer(0);
-    SPI.transfer(0);
-    SPI.transfer(0);
-    SPI.transfer(0);
+    transfer(0);
+    transfer(0);
+    transfer(0);
+    transfer(0);
     
     // Can't disable the chip here!
 }
@@ -337,25 +596,19 @@ void DataFlash::arrayRead(uint16_t page, uint16_t offset)
     reEnable();     // Reset command decoder.
 
     /* Send opcode */
-#ifdef AT45_USE_SPI_SPEED_CONTROL
-    SPI.transfer(m_speed == SPEED_LOW ? DATAFLASH_CONTINUOUS_READ_LOW_FREQ :
+    transfer(m_speed == SPEED_LOW ? DATAFLASH_CONTINUOUS_READ_LOW_FREQ :
                         DATAFLASH_CONTINUOUS_READ_HIGH_FREQ);
-#else
-    SPI.transfer(DATAFLASH_CONTINUOUS_READ_LOW_FREQ);
-#endif
 
     /* Address (page | offset)  */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
-    SPI.transfer((uint8_t)(offset & 0xff));
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
+    transfer((uint8_t)(offset & 0xff));
 
-#ifdef AT45_USE_SPI_SPEED_CONTROL
     /* High frequency continuous read has an additional don't care byte. */
     if(m_speed != SPEED_LOW)
     {
-        SPI.transfer(0x00);
+        transfer(0x00);
     }
-#endif
     
     // Can't disable the chip here!
 }
@@ -366,48 +619,43 @@ void DataFlash::arrayRead(uint16_t page, uint16_t offset)
  * beginning.
  * The chip must remain enabled by this function; it is the user's
  * responsibility to disable the chip when finished reading.
+ * Only waits if the operation in progress uses this buffer, so the
+ * other buffer can be read while a page is transferred.
  * @param bufferNum Buffer to read (0 or 1).
  * @param offset Starting byte within the buffer (default value: 0).
  **/
 void DataFlash::bufferRead(uint8_t bufferNum, uint16_t offset)
 {
-    /* Wait for the end of the previous operation. */
-    waitUntilReady();
+    /* Wait for the end of the previous operation on this buffer. */
+    waitUntilBufferReady(bufferNum);
     
     reEnable();     // Reset command decoder.
 
     /* Send opcode */
-#ifdef AT45_USE_SPI_SPEED_CONTROL
     if (bufferNum)
     {
-        SPI.transfer((m_speed == SPEED_LOW) ? DATAFLASH_BUFFER_2_READ_LOW_FREQ :
+        transfer((m_speed == SPEED_LOW) ? DATAFLASH_BUFFER_2_READ_LOW_FREQ :
                                               DATAFLASH_BUFFER_2_READ);
     }
     else
     {
-        SPI.transfer((m_speed == SPEED_LOW) ? DATAFLASH_BUFFER_1_READ_LOW_FREQ :
+        transfer((m_speed == SPEED_LOW) ? DATAFLASH_BUFFER_1_READ_LOW_FREQ :
                                               DATAFLASH_BUFFER_1_READ);
 
     }
-#else
-    SPI.transfer(bufferNum ? DATAFLASH_BUFFER_2_READ_LOW_FREQ :
-                             DATAFLASH_BUFFER_1_READ_LOW_FREQ);
-#endif
     
     /* 14 "Don't care" bits */
-    SPI.transfer(0x00);
+    transfer(0x00);
     /* Rest of the "don't care" bits + bits 8,9 of the offset */
-    SPI.transfer((uint8_t)(offset >> 8));
+    transfer((uint8_t)(offset >> 8));
     /* bits 7-0 of the offset */
-    SPI.transfer((uint8_t)(offset & 0xff));
+    transfer((uint8_t)(offset & 0xff));
     
-#ifdef AT45_USE_SPI_SPEED_CONTROL
     /* High frequency buffer read has an additional don't care byte. */
     if(m_speed != SPEED_LOW)
     {
-        SPI.transfer(0x00);
+        transfer(0x00);
     }
-#endif
     
     // Can't disable the chip here!
 }
@@ -418,25 +666,32 @@ void DataFlash::bufferRead(uint8_t bufferNum, uint16_t offset)
  * beginning.
  * The chip must remain enabled by this function; it is the user's
  * responsibility to disable the chip when finished reading.
+ * Only waits if the operation in progress uses this buffer, so the
+ * other buffer can be filled while a page is programmed.
  * @param bufferNum Buffer to read (0 or 1).
  * @param offset Starting byte within the buffer (default value: 0).
  **/
 void DataFlash::bufferWrite(uint8_t bufferNum, uint16_t offset)
 {
-    /* Wait for the end of the previous operation. */
-    waitUntilReady();
+    /* Wait for the end of the previous operation on this buffer. */
+    waitUntilBufferReady(bufferNum);
     
     reEnable();     // Reset command decoder.
 
-    SPI.transfer(bufferNum ? DATAFLASH_BUFFER_2_WRITE :
+    if(m_blankBuffer == bufferNum)
+    {
+        m_blankBuffer = -1;
+    }
+
+    transfer(bufferNum ? DATAFLASH_BUFFER_2_WRITE :
                              DATAFLASH_BUFFER_1_WRITE);
     
     /* 14 "Don't care" bits */
-    SPI.transfer(0x00);
+    transfer(0x00);
     /* Rest of the "don't care" bits + bits 8,9 of the offset */
-    SPI.transfer((uint8_t)(offset >> 8));
+    transfer((uint8_t)(offset >> 8));
     /* bits 7-0 of the offset */
-    SPI.transfer((uint8_t)(offset & 0xff));
+    transfer((uint8_t)(offset & 0xff));
     
     // Can't disable the chip here!
 }
@@ -447,9 +702,16 @@ void DataFlash::bufferWrite(uint8_t bufferNum, uint16_t offset)
  * have been erased previously using one of the erase commands.
  * @param bufferNum Buffer to use (0 or 1).
  * @param page Page to which the content of the buffer is written.
+ * @return false if the page is in a protected sector.
  **/
-void DataFlash::bufferToPage(uint8_t bufferNum, uint16_t page)
+bool DataFlash::bufferToPage(uint8_t bufferNum, uint16_t page)
 {
+    /* Don't waste a busy cycle on an operation that can't succeed. */
+    if(isSectorProtected(pageToSector(page)))
+    {
+        return false;
+    }
+
     /* Wait for the end of the previous operation. */
     waitUntilReady();
 
@@ -458,23 +720,29 @@ void DataFlash::bufferToPage(uint8_t bufferNum, uint16_t page)
     /* Opcode */
     if (m_erase == ERASE_AUTO)
     {
-        SPI.transfer(bufferNum ? DATAFLASH_BUFFER_2_TO_PAGE_WITH_ERASE :
+        transfer(bufferNum ? DATAFLASH_BUFFER_2_TO_PAGE_WITH_ERASE :
                                  DATAFLASH_BUFFER_1_TO_PAGE_WITH_ERASE);
     }
     else
     {
-        SPI.transfer(bufferNum ? DATAFLASH_BUFFER_2_TO_PAGE_WITHOUT_ERASE :
+        transfer(bufferNum ? DATAFLASH_BUFFER_2_TO_PAGE_WITHOUT_ERASE :
                                  DATAFLASH_BUFFER_1_TO_PAGE_WITHOUT_ERASE);
     }
     
     /* see pageToBuffer */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page));
-    SPI.transfer(0x00);
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page));
+    transfer(0x00);
     
     /* Start transfer. If erase was set to automatic, the page will first be
     erased. The chip remains busy until this operation finishes. */
     disable();
+    m_busyBuffers = bufferMask(bufferNum);
+    startOperation((m_erase == ERASE_AUTO) ? TIMING_ERASE_PROGRAM : TIMING_PROGRAM);
+
+    modified((m_erase == ERASE_AUTO) ? (OPERATION_PROGRAM | OPERATION_ERASE) :
+                                       OPERATION_PROGRAM, page, 1);
+    return true;
 }
 
 /**
@@ -490,105 +758,147 @@ void DataFlash::pageToBuffer(uint16_t page, uint8_t bufferNum)
     reEnable();
 
     /* Send opcode */
-    SPI.transfer(bufferNum ? DATAFLASH_TRANSFER_PAGE_TO_BUFFER_2 :
+    transfer(bufferNum ? DATAFLASH_TRANSFER_PAGE_TO_BUFFER_2 :
                              DATAFLASH_TRANSFER_PAGE_TO_BUFFER_1);
 
     /* Output the 3 bytes adress.
      * For all DataFlashes 011D to 642D the number of trailing don't care bits
      * is equal to the number of page bits plus 3 (a block consists of 8 (1<<3)
      * pages), and always larger than 8 so the third byte is always 0. */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page));
-    SPI.transfer(0);
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page));
+    transfer(0);
         
     /* Start transfer. The chip remains busy until this operation finishes. */
     disable();
+    m_busyBuffers = bufferMask(bufferNum);
+    startOperation(TIMING_TRANSFER);
+    if(m_blankBuffer == bufferNum)
+    {
+        m_blankBuffer = -1;
+    }
 }
 
 /** 
  * Erase a page in the main memory array.
  * @param page Page to erase.
+ * @return false if the page is in a protected sector.
  **/
-void DataFlash::pageErase(uint16_t page)
+bool DataFlash::pageErase(uint16_t page)
 {
+    /* Don't waste a busy cycle on an operation that can't succeed. */
+    if(isSectorProtected(pageToSector(page)))
+    {
+        return false;
+    }
+
     /* Wait for the end of the previous operation. */
     waitUntilReady();
 
     reEnable();
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_PAGE_ERASE);
+    transfer(DATAFLASH_PAGE_ERASE);
     
     /* see pageToBuffer */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page));
-    SPI.transfer(0x00);
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page));
+    transfer(0x00);
         
     /* Start page erase. The chip remains busy until this operation finishes. */
     disable();
+    m_busyBuffers = AT45_ALL_BUFFERS;
+    startOperation(TIMING_PAGE_ERASE);
+
+    modified(OPERATION_ERASE, page, 1);
+    return true;
 }
 
 /**
  * Erase a block of pages in a single operation.
  * @param block Block to erase.
+ * @return false if the block is in a protected sector.
  * @warning UNTESTED
  **/
-void DataFlash::blockErase(uint16_t block)
+bool DataFlash::blockErase(uint16_t block)
 {
+    /* Don't waste a busy cycle on an operation that can't succeed. */
+    if(isSectorProtected(pageToSector(block << 3)))
+    {
+        return false;
+    }
+
     /* Wait for the end of the previous operation. */
     waitUntilReady();
 
     reEnable();
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_BLOCK_ERASE);
+    transfer(DATAFLASH_BLOCK_ERASE);
     
     /* Output the 3 bytes adress.
      * For all DataFlashes 011D to 642D the number of trailing don't care bits
      * is equal to the number of page bits plus 3 (a block consists of 8 (1<<3)
      * pages), and always larger than 8 so the third byte is always 0. */
     uint8_t rightShift = m_bufferSize + 3 - 8;
-    block >>= rightShift;
-    SPI.transfer(highByte(block)); 
-    SPI.transfer(lowByte(block));
-    SPI.transfer(0x00);
+    uint16_t address = block >> rightShift;
+    transfer(highByte(address)); 
+    transfer(lowByte(address));
+    transfer(0x00);
         
     /* Start block erase.
     The chip remains busy until this operation finishes. */
     disable();
+    m_busyBuffers = AT45_ALL_BUFFERS;
+    startOperation(TIMING_BLOCK_ERASE);
+
+    modified(OPERATION_ERASE, block << 3, 8);
+    return true;
 }
 
 /** 
  * Erase a sector of blocks in a single operation.
  * @param sector Sector to erase.
+ * @return false if the sector is protected.
  **/
-void DataFlash::sectorErase(int8_t sector)
+bool DataFlash::sectorErase(int8_t sector)
 {
+    /* Don't waste a busy cycle on an operation that can't succeed. */
+    if(isSectorProtected(sector))
+    {
+        return false;
+    }
+
     /* Wait for the end of the previous operation. */
     waitUntilReady();
 
     reEnable();
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_SECTOR_ERASE);
+    transfer(DATAFLASH_SECTOR_ERASE);
 	
     if((sector == AT45_SECTOR_0A) || (sector == AT45_SECTOR_0B))
     {
-        SPI.transfer(0x00);
-        SPI.transfer((static_cast<uint8_t>(-sector) & 0x01) << (m_bufferSize - 5));
+        transfer(0x00);
+        transfer((static_cast<uint8_t>(-sector) & 0x01) << (m_bufferSize - 5));
     }
     else
     {
         uint8_t shift = m_bufferSize + m_pageSize - m_sectorSize - 16;        
-        SPI.transfer(sector << shift);
-        SPI.transfer(0x00);
+        transfer(sector << shift);
+        transfer(0x00);
     }
 	
-	SPI.transfer(0x00);
+	transfer(0x00);
 	
     /* Start sector erase.
     The chip remains busy until this operation finishes. */
     disable();
+    m_busyBuffers = AT45_ALL_BUFFERS;
+    startOperation(TIMING_SECTOR_ERASE);
+
+    modified(OPERATION_ERASE, sectorFirstPage(sector), sectorPageCount(sector));
+    return true;
 }
 
 #ifdef AT45_CHIP_ERASE_ENABLED
@@ -619,10 +929,10 @@ void DataFlash::chipErase()
     enable();
     
     /* Send chip erase sequence */
-    SPI.transfer(DATAFLASH_CHIP_ERASE_0);
-    SPI.transfer(DATAFLASH_CHIP_ERASE_1);
-    SPI.transfer(DATAFLASH_CHIP_ERASE_2);
-    SPI.transfer(DATAFLASH_CHIP_ERASE_3);
+    transfer(DATAFLASH_CHIP_ERASE_0);
+    transfer(DATAFLASH_CHIP_ERASE_1);
+    transfer(DATAFLASH_CHIP_ERASE_2);
+    transfer(DATAFLASH_CHIP_ERASE_3);
                 
     /* Start chip erase.
     The chip remains busy until this operation finishes. */
@@ -644,20 +954,38 @@ void DataFlash::chipErase()
  * @param page Page to which the content of the buffer is written.
  * @param offset Starting byte address within the buffer.
  * @param bufferNum Buffer to use (0 or 1).
+ * @return false if the page is in a protected sector.
  **/
-void DataFlash::beginPageWriteThroughBuffer(
+bool DataFlash::beginPageWriteThroughBuffer(
         uint16_t page, uint16_t offset, uint8_t bufferNum)
 {
+    /* Don't waste a busy cycle on an operation that can't succeed. */
+    if(isSectorProtected(pageToSector(page)))
+    {
+        return false;
+    }
+
     reEnable();     // Reset command decoder.
 
     /* Send opcode */
-    SPI.transfer(bufferNum ? DATAFLASH_PAGE_THROUGH_BUFFER_2 :
+    transfer(bufferNum ? DATAFLASH_PAGE_THROUGH_BUFFER_2 :
                              DATAFLASH_PAGE_THROUGH_BUFFER_1);
 
     /* Address */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
-    SPI.transfer((uint8_t)(offset & 0xff));
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page) | (uint8_t)(offset >> 8));
+    transfer((uint8_t)(offset & 0xff));
+
+    /* The page will be programmed as soon as the chip is deselected.
+     * Data is still to be sent, the program time can't be measured. */
+    m_busyBuffers = bufferMask(bufferNum);
+    startOperation(TIMING_ERASE_PROGRAM | AT45_TIMING_UNCALIBRATED);
+    if(m_blankBuffer == bufferNum)
+    {
+        m_blankBuffer = -1;
+    }
+    modified(OPERATION_PROGRAM | OPERATION_ERASE, page, 1);
+    return true;
 }
 
 /**
@@ -669,26 +997,189 @@ void DataFlash::beginPageWriteThroughBuffer(
  *      - false Otherwise.
  **/
 int8_t DataFlash::isPageEqualBuffer(uint16_t page, uint8_t bufferNum)
+{
+    beginCompare(page, bufferNum);
+
+    /* Wait for the end of the comparison. */
+    return compareResult();
+}
+
+/**
+ * Verify a range of pages against data in RAM using the on-chip
+ * compare. Data is only sent once, instead of being read back.
+ * @param firstPage First page to verify.
+ * @param data Expected data, count pages of pageSize() bytes.
+ * @param count Number of pages.
+ * @return The first page that doesn't match, or -1 if all match.
+ **/
+int16_t DataFlash::verifyRange(uint16_t firstPage, const uint8_t *data, uint16_t count)
+{
+    uint16_t size = pageSize();
+    uint8_t  bufferNum = 0;
+
+    /* Wait for the end of the previous operation. */
+    waitUntilReady();
+
+    for(uint16_t i=0; i<count; i++, data+=size, bufferNum^=1)
+    {
+        /* The comparison of the previous page uses the other buffer, so
+         * this doesn't wait. */
+        bufferWrite(bufferNum, 0);
+        for(uint16_t j=0; j<size; j++)
+        {
+            transfer(data[j]);
+        }
+        disable();
+
+        if(i && !compareResult())
+        {
+            return firstPage + i - 1;
+        }
+        beginCompare(firstPage + i, bufferNum);
+    }
+
+    if(count && !compareResult())
+    {
+        return firstPage + count - 1;
+    }
+    return -1;
+}
+
+/**
+ * Check if a page is erased using the on-chip compare.
+ * @param page Page to check.
+ * @param bufferNum Buffer to use (0 or 1).
+ * @return true if all the bytes of the page are 0xff.
+ **/
+int8_t DataFlash::isBlank(uint16_t page, uint8_t bufferNum)
+{
+    fillBlankBuffer(bufferNum);
+    waitUntilReady();
+    return isPageEqualBuffer(page, bufferNum);
+}
+
+/**
+ * Check if a range of pages is erased using the on-chip compare.
+ * Only the opcode and address of each page are sent.
+ * @param firstPage First page to check.
+ * @param count Number of pages.
+ * @param bufferNum Buffer to use (0 or 1).
+ * @return The first page that isn't erased, or -1.
+ **/
+int16_t DataFlash::isBlankRange(uint16_t firstPage, uint16_t count, uint8_t bufferNum)
+{
+    fillBlankBuffer(bufferNum);
+    waitUntilReady();
+
+    for(uint16_t i=0; i<count; i++)
+    {
+        if(!isPageEqualBuffer(firstPage + i, bufferNum))
+        {
+            return firstPage + i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Copy pages inside the chip.
+ * The chip runs one internal operation at a time, so each page costs a
+ * page to buffer transfer and a program time, whatever the SPI clock.
+ * The two SRAM buffers are used in turn, the buffer of the page being
+ * programmed is never touched. When the destination overlaps the end of
+ * the source, pages are copied from the last one so sources are read
+ * before being overwritten.
+ * @param src First source page.
+ * @param dst First destination page.
+ * @param count Number of pages.
+ * @param patch Optional callback modifying each page before it's
+ *        programmed.
+ * @param context User data passed to the callback.
+ * @return false if a destination page is protected.
+ **/
+bool DataFlash::copyPages(uint16_t src, uint16_t dst, uint16_t count, CopyPatch patch, void *context)
+{
+    bool backward = (dst > src) && ((dst - src) < count);
+    uint8_t bufferNum = 0;
+
+    for(uint16_t i=0; i<count; i++)
+    {
+        uint16_t index = backward ? (count - 1 - i) : i;
+
+        pageToBuffer(src + index, bufferNum);
+        if(patch)
+        {
+            patch(context, src + index, dst + index, bufferNum);
+        }
+        if(!bufferToPage(bufferNum, dst + index))
+        {
+            return false;
+        }
+        bufferNum ^= 1;
+    }
+    return true;
+}
+
+/**
+ * Fill a buffer with 0xff, unless it's already done.
+ * @param bufferNum Buffer (0 or 1).
+ **/
+void DataFlash::fillBlankBuffer(uint8_t bufferNum)
+{
+    if(m_blankBuffer == bufferNum)
+    {
+        return;
+    }
+
+    uint16_t size = pageSize();
+    bufferWrite(bufferNum, 0);
+    for(uint16_t i=0; i<size; i++)
+    {
+        transfer(0xff);
+    }
+    disable();
+
+    m_blankBuffer = bufferNum;
+}
+
+/**
+ * Start the comparison of a page with a buffer.
+ * The chip is busy until the end of the comparison.
+ * @param page Page to compare.
+ * @param bufferNum Buffer number (0 or 1).
+ **/
+void DataFlash::beginCompare(uint16_t page, uint8_t bufferNum)
 {
     reEnable();     // Reset command decoder.
 
     /* Send opcode */
-    SPI.transfer(bufferNum ? DATAFLASH_COMPARE_PAGE_TO_BUFFER_2 :
+    transfer(bufferNum ? DATAFLASH_COMPARE_PAGE_TO_BUFFER_2 :
                              DATAFLASH_COMPARE_PAGE_TO_BUFFER_1);
     
     /* Page address */
-    SPI.transfer(pageToHiU8(page));
-    SPI.transfer(pageToLoU8(page)); 
-    SPI.transfer(0x00);
+    transfer(pageToHiU8(page));
+    transfer(pageToLoU8(page)); 
+    transfer(0x00);
     
     disable();  /* Start comparison */
+    m_busyBuffers = bufferMask(bufferNum);
+    startOperation(TIMING_COMPARE);
+}
 
-    /* Wait for the end of the comparison. */
+/**
+ * Wait for the end of a comparison started by beginCompare().
+ * The wait follows the typical compare time, like any timed operation,
+ * and the compare bit is read once the chip is ready.
+ * @return true if the page and the buffer contain the same data.
+ **/
+bool DataFlash::compareResult()
+{
     waitUntilReady();
-        
+
     /* If bit 6 of the status register is 0 then the data in the
      * main memory page matches the data in the buffer. 
      * If it's 1 then the data in the main memory page doesn't match.
+     * It's kept until the next comparison.
      */
     return ((status() & AT45_COMPARE) == 0);
 }
@@ -705,30 +1196,138 @@ void DataFlash::deepPowerDown()
     reEnable();     // Reset command decoder.
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_DEEP_POWER_DOWN);
+    transfer(DATAFLASH_DEEP_POWER_DOWN);
     
     /* Enter Deep Power-Down mode */
     disable();
+
+    m_power     = POWER_DOWN;
+    m_powerTime = millis();
+    /* Don't rely on the buffers content after a power down. */
+    m_blankBuffer = -1;
+    ++m_powerStats.powerDowns;
 }
 
 /**
  * Takes the device out of Deep Power-down mode.
+ * The t_RDPD delay is charged to the next command, and only if it hasn't
+ * elapsed yet.
  **/
 void DataFlash::resumeFromDeepPowerDown()
 {
-    reEnable();     // Reset command decoder.
+    if(m_power == POWER_DOWN)
+    {
+        m_powerStats.residency += millis() - m_powerTime;
+        ++m_powerStats.resumes;
+    }
+
+    /* Don't use reEnable() here, it would resume the device itself. */
+    disable();
+    enable();       // Reset command decoder.
     
     /* Send opcode */
-    SPI.transfer(DATAFLASH_RESUME_FROM_DEEP_POWER_DOWN);
+    transfer(DATAFLASH_RESUME_FROM_DEEP_POWER_DOWN);
     
     /* Resume device */
     disable();
     
     /* The CS pin must stay high during t_RDPD microseconds before the device
-     * can receive any commands.
-     * On the at45db161D t_RDPD = 35 microseconds.
-     * Wait 40us (just to be sure). */
-    delayMicroseconds(40);
+     * can receive any commands. Instead of waiting here, the time is
+     * recorded and the next command will only wait for what's left. */
+    m_power     = POWER_RESUMING;
+    m_powerTime = micros();
+}
+
+/**
+ * Resume the device from Deep Power-down if needed, and wait for the
+ * end of t_RDPD.
+ **/
+void DataFlash::wakeUp()
+{
+    uint32_t start = micros();
+
+    if(m_power == POWER_DOWN)
+    {
+        resumeFromDeepPowerDown();
+    }
+
+    uint32_t elapsed = micros() - m_powerTime;
+    if(elapsed < AT45_RESUME_DELAY)
+    {
+        delayWithYield(AT45_RESUME_DELAY - elapsed);
+    }
+    m_power = POWER_ACTIVE;
+
+    uint32_t latency = micros() - start;
+    m_powerStats.resumeLatency += latency;
+    if(latency > m_powerStats.maxResumeLatency)
+    {
+        m_powerStats.maxResumeLatency = latency;
+    }
+}
+
+/**
+ * Set the idle timeout of the automatic Deep Power-down.
+ * Once set, the device is put into Deep Power-down by idle() when no
+ * command was sent during the given delay. It is transparently resumed
+ * by the next command.
+ * @param ms Idle timeout in milliseconds (0 disables it).
+ **/
+void DataFlash::setIdleTimeout(uint32_t ms)
+{
+    m_idleTimeout = ms;
+    m_lastAccess  = millis();
+}
+
+/**
+ * Put the device into Deep Power-down if it has been idle for longer
+ * than the idle timeout.
+ * @return true if the device is in Deep Power-down.
+ **/
+bool DataFlash::idle()
+{
+    if((m_power == POWER_ACTIVE) && m_idleTimeout &&
+       ((millis() - m_lastAccess) >= m_idleTimeout))
+    {
+        /* Don't interrupt a program or an erase. This status read counts
+         * as an access, so a busy device will be checked again after a
+         * full timeout. */
+        if(isReady())
+        {
+            deepPowerDown();
+        }
+    }
+    return (m_power == POWER_DOWN);
+}
+
+/**
+ * Get power management statistics.
+ * The residency includes the current Deep Power-down period.
+ * @param stats Statistics.
+ **/
+void DataFlash::powerStats(DataFlash::PowerStats &stats) const
+{
+    stats = m_powerStats;
+    if(m_power == POWER_DOWN)
+    {
+        stats.residency += millis() - m_powerTime;
+    }
+}
+
+/**
+ * Reset power management statistics.
+ **/
+void DataFlash::resetPowerStats()
+{
+    m_powerStats.powerDowns       = 0;
+    m_powerStats.resumes          = 0;
+    m_powerStats.residency        = 0;
+    m_powerStats.resumeLatency    = 0;
+    m_powerStats.maxResumeLatency = 0;
+    if(m_power == POWER_DOWN)
+    {
+        m_powerTime = millis();
+    }
 }
 
 /**
@@ -739,22 +1338,23 @@ void DataFlash::hardReset()
 {
     if (m_resetPin >= 0)
     {
-        digitalWrite(m_resetPin, LOW);
-
-        /* The reset pin should stay low for at least 10us (table 18.4). */
-        delayMicroseconds(10);
-        
         /* According to the Dataflash spec (21.6 Reset Timing),
          * the CS pin should be in high state before RESET
          * is deasserted (ie HIGH). */
         disable();
-        /* Just to be sure that the high state is reached */
-        delayMicroseconds(1);
+
+        digitalWrite(m_resetPin, LOW);
+
+        /* The reset pin should stay low for at least 10us (table 18.4).
+         * The pulses are too short for the yield hook. */
+        delayMicroseconds(10);
             
         digitalWrite(m_resetPin, HIGH);
         
         /* Reset recovery time = 1us */
         delayMicroseconds(1);
+
+        m_blankBuffer = -1;
     }
 }
 
@@ -765,12 +1365,13 @@ void DataFlash::enableSectorProtection()
         digitalWrite(m_writeProtectPin, HIGH);
     reEnable();
 
-    SPI.transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_0);
-    SPI.transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_1);
-    SPI.transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_2);
-    SPI.transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_3);
+    transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_0);
+    transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_1);
+    transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_2);
+    transfer(DATAFLASH_ENABLE_SECTOR_PROTECTION_3);
 
     disable();
+    m_protectionEnabled = true;
     if(m_writeProtectPin >= 0)
         digitalWrite(m_writeProtectPin, LOW);
 }
@@ -782,12 +1383,13 @@ void DataFlash::disableSectorProtection()
         digitalWrite(m_writeProtectPin, HIGH);
     reEnable();
 
-    SPI.transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_0);
-    SPI.transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_1);
-    SPI.transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_2);
-    SPI.transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_3);
+    transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_0);
+    transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_1);
+    transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_2);
+    transfer(DATAFLASH_DISABLE_SECTOR_PROTECTION_3);
 
     disable();
+    m_protectionEnabled = false;
 }
 
 void DataFlash::eraseSectorProtectionRegister()
@@ -797,13 +1399,17 @@ void DataFlash::eraseSectorProtectionRegister()
         digitalWrite(m_writeProtectPin, HIGH);
     reEnable();
 
-    SPI.transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_0);
-    SPI.transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_1);
-    SPI.transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_2);
-    SPI.transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_3);
+    transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_0);
+    transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_1);
+    transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_2);
+    transfer(DATAFLASH_ERASE_SECTOR_PROTECTION_REGISTER_3);
 
     disable();
 
+    /* An erased register protects all the sectors. */
+    memset(m_protection.data, 0xff, sizeof(m_protection.data));
+    m_protectionCached = true;
+
     waitUntilReady();
     if(m_writeProtectPin >= 0)
         digitalWrite(m_writeProtectPin, LOW);
@@ -818,17 +1424,29 @@ uint8_t DataFlash::programSectorProtectionRegister(const DataFlash::SectorProtec
         digitalWrite(m_writeProtectPin, HIGH);
     reEnable();
 
-    SPI.transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_0);
-    SPI.transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_1);
-    SPI.transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_2);
-    SPI.transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_3);
+    transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_0);
+    transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_1);
+    transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_2);
+    transfer(DATAFLASH_PROGRAM_SECTOR_PROTECTION_REGISTER_3);
 
     for(uint8_t i=0; i<sectorCount; i++)
     {
-        SPI.transfer(status.data[i]);
+        uint8_t value;
+        if(i == 0)
+        {
+            value = (status.get(AT45_SECTOR_0A) ? 0xc0 : 0x00) |
+                    (status.get(AT45_SECTOR_0B) ? 0x30 : 0x00);
+        }
+        else
+        {
+            value = status.get(i) ? 0xff : 0x00;
+        }
+        transfer(value);
     }
 
     disable();
+    m_protection       = status;
+    m_protectionCached = true;
     waitUntilReady();
     if(m_writeProtectPin >= 0)
         digitalWrite(m_writeProtectPin, LOW);
@@ -840,38 +1458,264 @@ uint8_t DataFlash::readSectorProtectionRegister(DataFlash::SectorProtectionStatu
 {
     uint8_t sectorCount = 1 << m_sectorSize;
 
+    if(m_protectionCached)
+    {
+        status = m_protection;
+        return sectorCount;
+    }
+
     waitUntilReady();
     reEnable();
 
-    SPI.transfer(DATAFLASH_READ_SECTOR_PROTECTION_REGISTER);
-    SPI.transfer(0xff);
-    SPI.transfer(0xff);
-    SPI.transfer(0xff);
+    transfer(DATAFLASH_READ_SECTOR_PROTECTION_REGISTER);
+    transfer(0xff);
+    transfer(0xff);
+    transfer(0xff);
 
+    status.clear();
     for(uint8_t i=0; i<sectorCount; i++)
     {
-        status.data[i] = SPI.transfer(0);
+        uint8_t value = transfer(0);
+        if(i == 0)
+        {
+            status.set(AT45_SECTOR_0A, (value & 0xc0) ? true : false);
+            status.set(AT45_SECTOR_0B, (value & 0x30) ? true : false);
+        }
+        else
+        {
+            status.set(i, value ? true : false);
+        }
     }
 
     disable();
 
+    m_protection       = status;
+    m_protectionCached = true;
+
     return sectorCount;
 }
 
+/**
+ * Return whether program and erase operations on a sector are rejected.
+ * The protection register is read the first time protection is found
+ * enabled.
+ * @param sector Sector id.
+ **/
+bool DataFlash::isSectorProtected(int8_t sector)
+{
+    if(!m_protectionEnabled)
+    {
+        return false;
+    }
+    if(!m_protectionCached)
+    {
+        SectorProtectionStatus status;
+        readSectorProtectionRegister(status);
+    }
+    return m_protection.get(sector);
+}
+
+/**
+ * Set the function called whenever the content of the main memory is
+ * about to change.
+ * @param hook Hook function (0 to remove it).
+ * @param context User data passed to the hook.
+ **/
+void DataFlash::setModifyHook(DataFlash::ModifyHook hook, void *context)
+{
+    m_modifyHook        = hook;
+    m_modifyHookContext = context;
+}
+
+/**
+ * Notify a program or erase operation on a range of pages.
+ * @param operation Combination of OPERATION_PROGRAM and OPERATION_ERASE.
+ * @param page First page affected.
+ * @param count Number of pages affected.
+ **/
+void DataFlash::modified(uint8_t operation, uint16_t page, uint16_t count)
+{
+#ifdef AT45_USE_STATS
+    statsOperation(operation, page, count);
+#endif
+    if(m_modifyHook)
+    {
+        m_modifyHook(m_modifyHookContext, operation, page, count);
+    }
+}
+
+#ifdef AT45_USE_STATS
+/**
+ * Get a snapshot of the instrumentation counters.
+ * @param stats Statistics.
+ **/
+void DataFlash::stats(DataFlash::Stats &stats) const
+{
+    stats = m_stats;
+}
+
+/**
+ * Reset the instrumentation counters.
+ **/
+void DataFlash::resetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_statsCommand   = false;
+    m_statsOperation = 0;
+}
+
+/**
+ * Count a transferred byte, and its opcode if it's the first one since
+ * the chip was selected.
+ * @param data Byte sent.
+ **/
+void DataFlash::statsTransfer(uint8_t data)
+{
+    ++m_stats.bytes;
+    if(!m_statsCommand)
+    {
+        return;
+    }
+    m_statsCommand = false;
+
+    /* Opcodes are stored in order of appearance. Once the table is full,
+     * new opcodes are not counted anymore. */
+    for(uint8_t i=0; i<AT45_STATS_OPCODES; i++)
+    {
+        Stats::CommandCount &entry = m_stats.commands[i];
+        if(entry.count == 0)
+        {
+            entry.opcode = data;
+        }
+        if(entry.opcode == data)
+        {
+            ++entry.count;
+            return;
+        }
+    }
+}
+
+/**
+ * Account a program or erase operation on a range of pages and start
+ * measuring its latency.
+ * @param operation Combination of OPERATION_PROGRAM and OPERATION_ERASE.
+ * @param page First page affected.
+ * @param count Number of pages affected.
+ **/
+void DataFlash::statsOperation(uint8_t operation, uint16_t page, uint16_t count)
+{
+#ifdef AT45_USE_BLOCK_STATS
+    uint16_t last = (page + count - 1) >> AT45_STATS_BUCKET_SHIFT;
+    for(uint16_t bucket=page >> AT45_STATS_BUCKET_SHIFT; (bucket <= last) && (bucket < AT45_STATS_BUCKETS); bucket++)
+    {
+        if(operation & OPERATION_ERASE)
+        {
+            ++m_stats.erases[bucket];
+        }
+        if(operation & OPERATION_PROGRAM)
+        {
+            ++m_stats.programs[bucket];
+        }
+    }
+#endif
+
+    m_statsOperation = operation;
+    m_statsStart     = micros();
+}
+
+/**
+ * Record the latency of the running operation once the chip is ready.
+ **/
+void DataFlash::statsCompleted()
+{
+    if(!m_statsOperation)
+    {
+        return;
+    }
+
+    uint32_t latency = micros() - m_statsStart;
+    uint8_t bucket = 0;
+    while((latency >>= 1) && (bucket < (AT45_STATS_HISTOGRAM-1)))
+    {
+        ++bucket;
+    }
+
+    if(m_statsOperation & OPERATION_PROGRAM)
+    {
+        ++m_stats.programLatency[bucket];
+    }
+    else
+    {
+        ++m_stats.eraseLatency[bucket];
+    }
+    m_statsOperation = 0;
+}
+#endif // AT45_USE_STATS
+
+#ifdef AT45_USE_TRACE
+/**
+ * Print the recorded events, oldest first.
+ * @param out Output.
+ **/
+void DataFlash::dumpTrace(Print &out) const
+{
+    uint16_t count = m_traceWrapped ? AT45_TRACE_SIZE : m_traceNext;
+    uint16_t index = m_traceWrapped ? m_traceNext : 0;
+
+    out.print("AT45 trace\n");
+    for(uint16_t i=0; i<count; i++)
+    {
+        uint16_t event = m_trace[index];
+        if(++index >= AT45_TRACE_SIZE)
+        {
+            index = 0;
+        }
+
+        if(event == TRACE_SELECT)
+        {
+            out.print('S');
+        }
+        else if(event == TRACE_DESELECT)
+        {
+            out.print(" D\n");
+        }
+        else
+        {
+            out.print(' ');
+            if(event < 0x10)
+            {
+                out.print('0');
+            }
+            out.print((unsigned int)event, HEX);
+        }
+    }
+    out.print("\nAT45 trace end\n");
+}
+
+/**
+ * Drop the recorded events.
+ **/
+void DataFlash::resetTrace()
+{
+    m_traceNext    = 0;
+    m_traceWrapped = false;
+}
+#endif // AT45_USE_TRACE
+
 DataFlash::SectorProtectionStatus::SectorProtectionStatus()
 {
     clear();
 }
 DataFlash::SectorProtectionStatus::SectorProtectionStatus(const DataFlash::SectorProtectionStatus &status)
 {
-  for(uint8_t i=0; i<64; i++)
+  for(uint8_t i=0; i<sizeof(data); i++)
   {
     data[i] = status.data[i];
   }
 }
 DataFlash::SectorProtectionStatus& DataFlash::SectorProtectionStatus::operator=(const DataFlash::SectorProtectionStatus& status)
 {
-  for(uint8_t i=0; i<64; i++)
+  for(uint8_t i=0; i<sizeof(data); i++)
   {
     data[i] = status.data[i];
   }
@@ -879,38 +1723,32 @@ DataFlash::SectorProtectionStatus& DataFlash::SectorProtectionStatus::operator=(
 }
 void DataFlash::SectorProtectionStatus::set(int8_t sectorId, bool status)
 {
-    if(sectorId == AT45_SECTOR_0A)
-    {
-        data[0] = (data[0] & 0x3f) | (status ? 0xc0 : 0x00);
-    }
-    else if(sectorId == AT45_SECTOR_0B)
-    {
-        data[0] = (data[0] & 0xcf) | (status ? 0x30 : 0x00);
-    }
-    else if((sectorId > 0) && (sectorId < 64))
+    /* Sector 0a is bit 0, sector 0b bit 1, and so on. */
+    if((sectorId >= AT45_SECTOR_0A) && (sectorId < 64))
     {
-        data[sectorId] = status ? 0xff : 0x00;
+        uint8_t bit = sectorId + 1;
+        if(status)
+        {
+            data[bit >> 3] |= 1 << (bit & 7);
+        }
+        else
+        {
+            data[bit >> 3] &= ~(1 << (bit & 7));
+        }
     }
 }
 bool DataFlash::SectorProtectionStatus::get(int8_t sectorId) const
 {
-    if(sectorId == AT45_SECTOR_0A)
-    {
-        return (data[0] & 0xc0) ? true : false;
-    }
-    else if(sectorId == AT45_SECTOR_0B)
-    {
-        return (data[0] & 0x30) ? true : false;
-    }
-    else if((sectorId > 0) && (sectorId < 64))
+    if((sectorId >= AT45_SECTOR_0A) && (sectorId < 64))
     {
-        return data[sectorId] ? true : false;
+        uint8_t bit = sectorId + 1;
+        return (data[bit >> 3] & (1 << (bit & 7))) ? true : false;
     }
     return false;
 }
 void DataFlash::SectorProtectionStatus::clear()
 {
-    for(uint8_t i=0; i<64; i++)
+    for(uint8_t i=0; i<sizeof(data); i++)
     {
       data[i] = 0;
     }
@@ -43,6 +43,8 @@
 #include "DataFlashSizes.h"
 #include <SPI.h>
 
+class Print;
+
 /**
  * @addtogroup AT45DBxxxD
  * @{
@@ -64,19 +66,65 @@
  **/
 
 /**
- * @defgroup AT45_USE_SPI_SPEED_CONTROL SPI transfer speed control.
- * @warning This feature is experimental. Use it at your own risk!
- * %Dataflash supports low and high speed transfers. However the low
- * speed transfers are more than 3x the speed of what an Arduino
- * with ATmega 328P or 1280 can provide, so this makes no sense at
- * all with that hardware. 
- * Leaving in, in case it's useful for other hardware. Tested code.
- * Dropping this saves 86 bytes.
+ * @defgroup AT45_USE_STATS Hot path instrumentation.
+ * Uncomment the define below to count commands, SPI bytes, chip select
+ * cycles, status polls and busy wait time, and to build program and erase
+ * latency histograms (see DataFlash::Stats).
+ * This costs about 330 bytes of RAM on AVR and a few cycles per SPI
+ * transfer. When left undefined, nothing is compiled in.
  * @{
  **/
-#ifdef AT45_USE_SPI_SPEED_CONTROL
-#undef AT45_USE_SPI_SPEED_CONTROL
-#endif
+// #define AT45_USE_STATS
+/** Number of distinct opcodes counted. **/
+#define AT45_STATS_OPCODES      24
+/** Number of log2 latency histogram buckets (bucket i counts [2^i, 2^(i+1)) us). **/
+#define AT45_STATS_HISTOGRAM    24
+/**
+ * Uncomment the define below (along with AT45_USE_STATS) to also count
+ * erases and programs per group of 2^AT45_STATS_BUCKET_SHIFT pages.
+ * This costs 4*AT45_STATS_BUCKETS bytes of RAM. The default covers the
+ * AT45DB161D and AT45DB642D with one bucket per 256 pages sector (128
+ * bytes); per block counters (shift 3) on an AT45DB161D take 512
+ * buckets, that is 2 KB.
+ **/
+// #define AT45_USE_BLOCK_STATS
+/** Number of pages of a bucket of the per page group counters (log2). **/
+#define AT45_STATS_BUCKET_SHIFT 8
+/** Number of buckets of the per page group counters. **/
+#define AT45_STATS_BUCKETS      32
+/**
+ * @}
+ **/
+
+/**
+ * @defgroup AT45_USE_TRACE SPI transaction tracer.
+ * Uncomment the define below to record every chip select edge and every
+ * byte sent through DataFlash::transfer() in a ring buffer. The trace is
+ * printed by DataFlash::dumpTrace() and decoded on the host by
+ * extras/traceanalyzer, which reports the payload efficiency of each
+ * command type.
+ * Each event costs 2 bytes of RAM. When left undefined, nothing is
+ * compiled in.
+ * @{
+ **/
+// #define AT45_USE_TRACE
+/** Number of events kept in the ring buffer. **/
+#define AT45_TRACE_SIZE         256
+/**
+ * @}
+ **/
+
+/**
+ * @defgroup AT45_POLLING Busy wait settings.
+ * waitUntilReady() stays off the bus for most of the typical duration of
+ * the operation in progress, then polls the status register with an
+ * interval doubling from AT45_POLL_MIN_INTERVAL to AT45_POLL_MAX_INTERVAL.
+ * @{
+ **/
+/** First status poll interval (us). **/
+#define AT45_POLL_MIN_INTERVAL  10
+/** Longest status poll interval (us). **/
+#define AT45_POLL_MAX_INTERVAL  1000
 /**
  * @}
  **/
@@ -204,12 +252,67 @@ class DataFlash
             ERASE_MANUAL            /**< Pages are erased by the user first. **/
         };
 
+        /**
+         * @brief Main memory operations.
+         * Reported to the modify hook (see setModifyHook()).
+         **/
+        enum operation
+        {
+            OPERATION_PROGRAM = 0x01,   /**< Pages are programmed. **/
+            OPERATION_ERASE   = 0x02    /**< Pages are erased. **/
+        };
+
+        /**
+         * @brief Timed internal operations.
+         * See typicalTime().
+         **/
+        enum timing
+        {
+            TIMING_TRANSFER = 0,    /**< Main memory page to buffer transfer. **/
+            TIMING_COMPARE,         /**< Main memory page to buffer compare. **/
+            TIMING_PROGRAM,         /**< Buffer to page program without erase. **/
+            TIMING_ERASE_PROGRAM,   /**< Buffer to page program with built-in erase. **/
+            TIMING_PAGE_ERASE,      /**< Page erase. **/
+            TIMING_BLOCK_ERASE,     /**< Block erase. **/
+            TIMING_SECTOR_ERASE,    /**< Sector erase. **/
+            TIMING_COUNT,           /**< Number of timed operations. **/
+            TIMING_NONE = 0x7f      /**< No timed operation in progress. **/
+        };
+
+        /**
+         * Main memory modification hook.
+         * @param context User data given to setModifyHook().
+         * @param operation Combination of OPERATION_PROGRAM and OPERATION_ERASE.
+         * @param page First page affected.
+         * @param count Number of pages affected.
+         **/
+        typedef void (*ModifyHook)(void *context, uint8_t operation, uint16_t page, uint16_t count);
+
+        /**
+         * Hook called repeatedly while waiting for the %Dataflash.
+         * @param context User data given to setYieldHook().
+         * @param elapsed Time spent in the current wait (us).
+         **/
+        typedef void (*YieldHook)(void *context, uint32_t elapsed);
+
+        /**
+         * Page copy patch callback (see copyPages()).
+         * Called once the source page is in the SRAM buffer, before it's
+         * programmed. Use bufferWrite() to modify it.
+         * @param context User data given to copyPages().
+         * @param src Source page.
+         * @param dst Destination page.
+         * @param bufferNum SRAM buffer holding the page.
+         **/
+        typedef void (*CopyPatch)(void *context, uint16_t src, uint16_t dst, uint8_t bufferNum);
+
         /** 
          * @brief IO speed.
          * The max SPI SCK frequency an ATmega 328P or 1280 can generate is
          * 10MHz. The limit for low-speed SCK for AT45DBxxxD %Dataflash is 33MHz
-         * (66MHz for high-speed). Supporting high-speed for Arduino is a waste of
-         * time...
+         * (66MHz for high-speed). High-speed read opcodes need an additional
+         * don't care byte, so they're only worth it on faster MCUs.
+         * @see setClock
          **/
         enum IOspeed
         {
@@ -217,6 +320,51 @@ class DataFlash
             SPEED_HIGH              /**< High speed transfers up to 66MHz **/
         };
 
+        /**
+         * @brief Power management statistics.
+         * Used to balance battery life against first access latency when
+         * tuning the idle timeout.
+         **/
+        struct PowerStats
+        {
+            uint32_t powerDowns;    /**< Number of Deep Power-down entries. **/
+            uint32_t resumes;       /**< Number of resumes from Deep Power-down. **/
+            uint32_t residency;     /**< Total time spent in Deep Power-down (ms). **/
+            uint32_t resumeLatency; /**< Total time commands waited for a resume (us). **/
+            uint32_t maxResumeLatency; /**< Longest wait for a resume (us). **/
+        };
+
+#ifdef AT45_USE_STATS
+        /**
+         * @brief Instrumentation counters.
+         * Only bytes going through DataFlash::transfer() are counted.
+         * Latencies are measured from the start of the operation to the
+         * first status read reporting the chip as ready.
+         **/
+        struct Stats
+        {
+            /**
+             * Command count for a given opcode.
+             **/
+            struct CommandCount
+            {
+                uint8_t  opcode;    /**< Command opcode. **/
+                uint32_t count;     /**< Number of commands sent. **/
+            };
+            CommandCount commands[AT45_STATS_OPCODES]; /**< Commands per opcode (unused entries have a 0 count). **/
+            uint32_t bytes;         /**< SPI bytes exchanged (each one is sent and received). **/
+            uint32_t selects;       /**< Chip select cycles. **/
+            uint32_t statusPolls;   /**< Status register reads. **/
+            uint32_t busyWait;      /**< Total time spent in waitUntilReady() (us). **/
+#ifdef AT45_USE_BLOCK_STATS
+            uint16_t erases[AT45_STATS_BUCKETS];    /**< Erase operations per page group (see AT45_STATS_BUCKET_SHIFT). **/
+            uint16_t programs[AT45_STATS_BUCKETS];  /**< Page programs per page group (see AT45_STATS_BUCKET_SHIFT). **/
+#endif // AT45_USE_BLOCK_STATS
+            uint32_t programLatency[AT45_STATS_HISTOGRAM]; /**< Log2 histogram of page program latencies. **/
+            uint32_t eraseLatency[AT45_STATS_HISTOGRAM];   /**< Log2 histogram of erase latencies. **/
+        };
+#endif // AT45_USE_STATS
+
     public:
         /** Constructor **/
         DataFlash();
@@ -263,6 +411,37 @@ class DataFlash
          **/
         void reEnable();
 
+        /**
+         * Same as SPI.transfer(), but accounted in the statistics when
+         * AT45_USE_STATS is defined.
+         * @param data Byte to send.
+         * @return Received byte.
+         **/
+        inline uint8_t transfer(uint8_t data);
+
+        /**
+         * Same as SPI.transfer(buffer, count): each byte of the buffer is
+         * sent and replaced by the received one.
+         * @param buffer Data to send, overwritten by the received data.
+         * @param count Number of bytes.
+         **/
+        inline void transfer(void *buffer, size_t count);
+
+        /**
+         * Mark the stream opened by the last command (chip still selected)
+         * as owned by the caller. The mark is cleared as soon as the chip
+         * is deselected, which lets the owner know whether the stream is
+         * still open.
+         * @param owner Stream owner.
+         **/
+        inline void claimStream(const void *owner);
+
+        /**
+         * Owner of the open stream, 0 if the chip was deselected since the
+         * last claimStream().
+         **/
+        inline const void *streamOwner() const;
+
         /**
          * Set erase mode to automatic (default).
          **/
@@ -273,8 +452,12 @@ class DataFlash
          * User must erase pages first, using one of the erase commands.
          **/
         void manualErase();
+
+        /**
+         * Current erase mode (ERASE_AUTO or ERASE_MANUAL).
+         **/
+        inline erasemode eraseMode() const;
         
-#ifdef AT45_USE_SPI_SPEED_CONTROL
         /**
          * Set transfer speed (33MHz = low, 66MHz = high).
          * Note: Arduino supports 20MHz max, so using "high" is actually slower
@@ -286,7 +469,20 @@ class DataFlash
          * Get transfer speed.
          **/
         IOspeed getTransferSpeed() const;
-#endif // AT45_USE_SPI_SPEED_CONTROL
+
+        /**
+         * Set the SPI clock used by this device. The transfer speed is
+         * selected accordingly: high speed read opcodes are only used
+         * above 33MHz. The clock is applied by begin().
+         * @param hz SPI clock frequency in Hz, 0 to keep the SPI
+         *        configuration set by setup().
+         **/
+        void setClock(uint32_t hz);
+
+        /**
+         * Get the SPI clock set by setClock() (0 if none).
+         **/
+        inline uint32_t clock() const;
 
         /**
          * Return whether the chip has completed the current operation and is
@@ -301,8 +497,45 @@ class DataFlash
          * Perform a low-to-high transition on the CS pin and then poll
          * the status register until the %Dataflash is ready for the next
          * operation.
+         * If the operation in progress is timed, the status register is
+         * only polled near the end of its typical duration (see
+         * typicalTime()).
          */
         void waitUntilReady();
+
+        /**
+         * Typical duration of an internal operation. It starts from the
+         * datasheet value of the AT45DB161D and follows the durations
+         * measured by waitUntilReady().
+         * @param operation Operation (see DataFlash::timing).
+         * @return Duration in microseconds.
+         **/
+        inline uint32_t typicalTime(uint8_t operation) const;
+
+        /**
+         * Set the typical duration of an internal operation.
+         * @param operation Operation (see DataFlash::timing).
+         * @param us Duration in microseconds.
+         **/
+        void setTypicalTime(uint8_t operation, uint32_t us);
+
+        /**
+         * @brief Wait until a SRAM buffer can be accessed.
+         * Only wait if the operation in progress (started by this object)
+         * uses the buffer. The chip may still be busy working with the
+         * other one.
+         * @param bufferNum Buffer (0 or 1).
+         **/
+        void waitUntilBufferReady(uint8_t bufferNum);
+
+        /**
+         * Tell if the operation in progress (started by this object) may
+         * still use a SRAM buffer. Nothing is sent to the chip, the
+         * operation is only known to be over once a status read reported
+         * it (isReady(), waitUntilReady()).
+         * @param bufferNum Buffer (0 or 1).
+         **/
+        inline bool isBufferBusy(uint8_t bufferNum) const;
         
         /**
          * Same as waitUntilReady
@@ -350,12 +583,34 @@ class DataFlash
          **/
         void arrayRead(uint16_t page, uint16_t offset=0);
 
+        /**
+         * Stream data from the main memory to a sink, a chunk at a time.
+         * The data goes straight from the SPI receive loop to the sink
+         * through a CHUNK bytes array on the stack. RAM usage doesn't
+         * depend on the length.
+         * The sink is a function or functor called as
+         * bool sink(const uint8_t *data, uint16_t length). Returning false
+         * stops the transfer after this chunk. It's taken by value, so
+         * temporaries and lambdas can be passed. A functor accumulating a
+         * result must keep it outside (through a pointer for example).
+         * @warning The chip stays selected while the sink runs. The sink
+         *          must not use the SPI bus.
+         * @param page Page of the main memory where the read starts.
+         * @param offset Starting byte address within the page.
+         * @param length Number of bytes to read.
+         * @param sink Data sink.
+         * @return Number of bytes passed to the sink.
+         **/
+        template <uint16_t CHUNK, typename Sink>
+        uint32_t readTo(uint16_t page, uint16_t offset, uint32_t length, Sink sink);
+
         /**
          * Read the content of one of the SRAM data buffer at the currently
          * set speed. Reading past the end of the buffer wraps around to the
          * beginning.
          * The chip must remain enabled by this function; it is the user's
          * responsibility to disable the chip when finished reading.
+         * Only waits if the operation in progress uses this buffer.
          * @param bufferNum Buffer to read (0 or 1).
          * @param offset Starting byte within the buffer (default value: 0).
          **/
@@ -367,6 +622,7 @@ class DataFlash
          * beginning.
          * The chip must remain enabled by this function; it is the user's
          * responsibility to disable the chip when finished reading.
+         * Only waits if the operation in progress uses this buffer.
          * @param bufferNum Buffer to read (0 or 1).
          * @param offset Starting byte within the buffer (default value: 0).
          **/
@@ -378,8 +634,10 @@ class DataFlash
          * have been erased previously using one of the erase commands.
          * @param bufferNum Buffer to use (0 or 1).
          * @param page Page to which the content of the buffer is written.
+         * @return false if the page is in a protected sector, nothing is
+         *         sent to the chip.
          **/
-        void bufferToPage(uint8_t bufferNum, uint16_t page);
+        bool bufferToPage(uint8_t bufferNum, uint16_t page);
 
         /**
          * Transfer a page of data from main memory to buffer 0 or 1.
@@ -391,21 +649,27 @@ class DataFlash
         /**
          * Erase a page in the main memory array.
          * @param page Page to erase.
+         * @return false if the page is in a protected sector, nothing is
+         *         sent to the chip.
          **/
-        void pageErase(uint16_t page);
+        bool pageErase(uint16_t page);
 
         /**
          * Erase a block of pages in a single operation.
          * @param block Block to erase.
+         * @return false if the block is in a protected sector, nothing is
+         *         sent to the chip.
          * @warning UNTESTED
          **/
-        void blockErase(uint16_t block);
+        bool blockErase(uint16_t block);
 
         /**
          * Erase a sector of blocks in a single operation.
          * @param sector Sector to erase.
+         * @return false if the sector is protected, nothing is sent to the
+         *         chip.
          **/
-        void sectorErase(int8_t sector);
+        bool sectorErase(int8_t sector);
 
 #ifdef AT45_CHIP_ERASE_ENABLED
         /**
@@ -429,8 +693,10 @@ class DataFlash
          * @param page Page to which the content of the buffer is written.
          * @param offset Starting byte address within the buffer.
          * @param bufferNum Buffer to use (0 or 1).
+         * @return false if the page is in a protected sector, nothing is
+         *         sent to the chip.
          **/
-        void beginPageWriteThroughBuffer(uint16_t page, uint16_t offset, uint8_t bufferNum);
+        bool beginPageWriteThroughBuffer(uint16_t page, uint16_t offset, uint8_t bufferNum);
 
         /**
          * Compare a page of data in main memory to the data in buffer 0 or 1.
@@ -442,6 +708,60 @@ class DataFlash
          **/
         int8_t isPageEqualBuffer(uint16_t page, uint8_t bufferNum);
 
+        /**
+         * Verify a range of pages against data in RAM using the on-chip
+         * compare. Each page of data is sent once, to a SRAM buffer, and
+         * compared with the main memory while the next page is sent to
+         * the other buffer.
+         * @note Both SRAM buffers are used, their content is lost.
+         * @param firstPage First page to verify.
+         * @param data Expected data, count pages of pageSize() bytes.
+         * @param count Number of pages.
+         * @return The first page that doesn't match, or -1 if all the
+         *         pages match.
+         **/
+        int16_t verifyRange(uint16_t firstPage, const uint8_t *data, uint16_t count);
+
+        /**
+         * Check if a page is erased using the on-chip compare with a
+         * buffer filled with 0xff. The buffer is only filled on the first
+         * call, it's kept as long as it isn't used for something else.
+         * @param page Page to check.
+         * @param bufferNum Buffer to use (0 or 1).
+         * @return
+         *      - true  If all the bytes of the page are 0xff.
+         *      - false Otherwise.
+         **/
+        int8_t isBlank(uint16_t page, uint8_t bufferNum=1);
+
+        /**
+         * Check if a range of pages is erased. Use sectorFirstPage() and
+         * sectorPageCount() to check a whole sector.
+         * @see isBlank
+         * @param firstPage First page to check.
+         * @param count Number of pages.
+         * @param bufferNum Buffer to use (0 or 1).
+         * @return The first page that isn't erased, or -1 if all the
+         *         pages are erased.
+         **/
+        int16_t isBlankRange(uint16_t firstPage, uint16_t count, uint8_t bufferNum=1);
+
+        /**
+         * Copy pages inside the chip. Each page is transferred to a SRAM
+         * buffer and programmed back, the data never goes through SPI.
+         * Overlapping ranges are handled.
+         * @note Both SRAM buffers are used, their content is lost.
+         * @param src First source page.
+         * @param dst First destination page.
+         * @param count Number of pages.
+         * @param patch Optional callback modifying each page before it's
+         *        programmed.
+         * @param context User data passed to the callback.
+         * @return false if a destination page is protected. The pages
+         *         before it are copied.
+         **/
+        bool copyPages(uint16_t src, uint16_t dst, uint16_t count, CopyPatch patch=0, void *context=0);
+
         /**
          * Put the device into the lowest power consumption mode.
          * Once the device has entered the Deep Power-down mode, all
@@ -453,10 +773,46 @@ class DataFlash
 
         /**
          * Takes the device out of Deep Power-down mode.
+         * The device needs t_RDPD microseconds before accepting the next
+         * command. This delay is not spent here but by the next command,
+         * and only if it hasn't elapsed yet.
          * @warning UNTESTED
          **/
         void resumeFromDeepPowerDown();
 
+        /**
+         * Set the idle timeout of the automatic Deep Power-down.
+         * Once set, the device is put into Deep Power-down by idle() when
+         * no command was sent during the given delay. It is transparently
+         * resumed by the next command.
+         * @param ms Idle timeout in milliseconds (0 disables it).
+         **/
+        void setIdleTimeout(uint32_t ms);
+
+        /**
+         * Put the device into Deep Power-down if it has been idle for
+         * longer than the idle timeout.
+         * This should be called regularly (from loop() for example).
+         * @return true if the device is in Deep Power-down.
+         **/
+        bool idle();
+
+        /**
+         * Return whether the device is in Deep Power-down.
+         **/
+        inline bool isPoweredDown() const;
+
+        /**
+         * Get power management statistics.
+         * @param stats Statistics.
+         **/
+        void powerStats(PowerStats &stats) const;
+
+        /**
+         * Reset power management statistics.
+         **/
+        void resetPowerStats();
+
         /**
          * Reset device via the reset pin.
          **/
@@ -466,6 +822,10 @@ class DataFlash
         void disableSectorProtection();
         void eraseSectorProtectionRegister();
 
+        /**
+         * Sector protection map, one bit per sector (sectors 0a and 0b
+         * have their own bit).
+         **/
         class SectorProtectionStatus
         {
           friend class DataFlash;
@@ -477,12 +837,110 @@ class DataFlash
             bool get(int8_t sectorId) const;
             void clear();
           private:
-            uint8_t data[64];
+            /** Bit 0: sector 0a, bit 1: sector 0b, bit n+1: sector n. **/
+            uint8_t data[9];
         };
         
         uint8_t programSectorProtectionRegister(const SectorProtectionStatus& status);
+
+        /**
+         * Get the sector protection map. The register is only read from
+         * the chip the first time, the map is then kept in RAM and updated
+         * when the register is programmed or erased.
+         * @param status Sector protection map.
+         * @return Number of sectors.
+         **/
         uint8_t readSectorProtectionRegister(SectorProtectionStatus& status);
 
+        /**
+         * Return whether program and erase operations on a sector are
+         * rejected, i.e. sector protection is enabled and the sector is
+         * protected.
+         * @param sector Sector id (AT45_SECTOR_0A, AT45_SECTOR_0B, 1, 2, ...).
+         **/
+        bool isSectorProtected(int8_t sector);
+
+#ifdef AT45_USE_STATS
+        /**
+         * Get a snapshot of the instrumentation counters.
+         * @param stats Statistics.
+         **/
+        void stats(Stats &stats) const;
+
+        /**
+         * Reset the instrumentation counters.
+         **/
+        void resetStats();
+#endif // AT45_USE_STATS
+
+#ifdef AT45_USE_TRACE
+        /**
+         * Print the recorded events, oldest first, one command per line:
+         * S for a select, the bytes sent in hexadecimal, D for a deselect.
+         * The first command may be truncated once the ring buffer wrapped.
+         * @param out Output (Serial for example).
+         **/
+        void dumpTrace(Print &out) const;
+
+        /**
+         * Drop the recorded events.
+         **/
+        void resetTrace();
+#endif // AT45_USE_TRACE
+
+        /**
+         * Set the function called whenever the content of the main memory
+         * is about to change (page program, page/block/sector erase).
+         * Only one hook can be set. A module installing its hook should
+         * keep the previous one (see modifyHook()) and call it as well.
+         * The hook must not access the SPI bus: it may be called while
+         * the chip is still selected (beginPageWriteThroughBuffer()).
+         * @param hook Hook function (0 to remove it).
+         * @param context User data passed to the hook.
+         **/
+        void setModifyHook(ModifyHook hook, void *context);
+
+        /**
+         * Set the function called repeatedly while waiting for the
+         * %Dataflash: end of an internal operation, resume from Deep
+         * Power-down. A cooperative scheduler (or yield()) can run other
+         * tasks from there.
+         * The chip is not selected when the hook is called. The hook may
+         * use the SPI bus for other devices, but must not use this
+         * %Dataflash. Waits last at least as long as the hook runs.
+         * @param hook Hook function (0 to remove it).
+         * @param context User data passed to the hook.
+         **/
+        void setYieldHook(YieldHook hook, void *context);
+
+        /** Get the current modify hook. **/
+        inline ModifyHook modifyHook() const;
+        /** Get the user data of the current modify hook. **/
+        inline void *modifyHookContext() const;
+
+        /** Page size in bytes (264, 528, 1056, or 256, 512, 1024 in "power of 2" mode). **/
+        inline uint16_t pageSize() const;
+        /** Number of pages of the main memory. **/
+        inline uint16_t pageCount() const;
+        /** Number of sectors (sectors 0a and 0b count as one). **/
+        inline uint8_t sectorCount() const;
+        /**
+         * First page of a sector.
+         * @param sector Sector id (AT45_SECTOR_0A, AT45_SECTOR_0B, 1, 2, ...).
+         **/
+        inline uint16_t sectorFirstPage(int8_t sector) const;
+        /**
+         * Number of pages of a sector.
+         * @param sector Sector id (AT45_SECTOR_0A, AT45_SECTOR_0B, 1, 2, ...).
+         **/
+        inline uint16_t sectorPageCount(int8_t sector) const;
+        /**
+         * Sector holding a page.
+         * @param page Page number.
+         * @return Sector id (AT45_SECTOR_0A, AT45_SECTOR_0B, 1, 2, ...).
+         **/
+        inline int8_t pageToSector(uint16_t page) const;
+
         /** Get chip Select (CS) pin **/
         inline int8_t chipSelectPin  () const;
         /** Get reset (RESET) pin **/
@@ -501,6 +959,96 @@ class DataFlash
          */
         inline uint8_t pageToLoU8(uint16_t page) const;
 
+        /**
+         * Fill a buffer with 0xff, unless it's already done.
+         **/
+        void fillBlankBuffer(uint8_t bufferNum);
+
+        /**
+         * Start the comparison of a page with a buffer.
+         **/
+        void beginCompare(uint16_t page, uint8_t bufferNum);
+
+        /**
+         * Wait for the end of a comparison and get its result.
+         **/
+        bool compareResult();
+
+        /**
+         * Bit mask of a SRAM buffer in m_busyBuffers.
+         **/
+        inline uint8_t bufferMask(uint8_t bufferNum) const;
+
+        /**
+         * Resume the device from Deep Power-down if needed, and wait
+         * for the end of t_RDPD.
+         **/
+        void wakeUp();
+
+        /**
+         * Notify a program or erase operation on a range of pages.
+         **/
+        void modified(uint8_t operation, uint16_t page, uint16_t count);
+
+        /**
+         * Remember the internal operation just started, for
+         * waitUntilReady().
+         * @param operation Operation (see DataFlash::timing), with
+         *        TIMING_UNCALIBRATED set if the measured duration must not
+         *        update the typical one.
+         **/
+        inline void startOperation(uint8_t operation);
+
+        /**
+         * Call the yield hook, if any.
+         * @param start Start of the wait (us).
+         **/
+        inline void yieldWait(uint32_t start);
+
+        /**
+         * Wait for a given time, calling the yield hook meanwhile.
+         **/
+        void delayWithYield(uint32_t us);
+
+        /**
+         * Update the typical duration of an operation.
+         **/
+        void calibrate(uint8_t operation, uint32_t elapsed);
+
+#ifdef AT45_USE_STATS
+        /**
+         * Count a transferred byte, and its opcode if it's the first one
+         * since the chip was selected.
+         **/
+        void statsTransfer(uint8_t data);
+
+        /**
+         * Account a program or erase operation on a range of pages and
+         * start measuring its latency.
+         **/
+        void statsOperation(uint8_t operation, uint16_t page, uint16_t count);
+
+        /**
+         * Record the latency of the running operation once the chip is
+         * ready.
+         **/
+        void statsCompleted();
+#endif // AT45_USE_STATS
+
+#ifdef AT45_USE_TRACE
+        /** Trace events besides the bytes sent (0x00-0xff). **/
+        enum traceEvent
+        {
+            TRACE_SELECT   = 0x100,     /**< Chip select asserted. **/
+            TRACE_DESELECT = 0x200      /**< Chip select released. **/
+        };
+
+        /**
+         * Record an event in the trace ring buffer.
+         **/
+        inline void trace(uint16_t event);
+#endif // AT45_USE_TRACE
+
     private:
         /**
          * %Dataflash read/write addressing infos.
@@ -524,8 +1072,52 @@ class DataFlash
 
         enum erasemode m_erase;     /**< Erase mode - auto or manual. **/
 
-#ifdef AT45_USE_SPI_SPEED_CONTROL
+        const void *m_streamOwner;  /**< Owner of the open stream. **/
+        uint8_t m_busyBuffers;      /**< Buffers used by the operation in progress. **/
+        int8_t m_blankBuffer;       /**< Buffer filled with 0xff, -1 if none. **/
+
+        uint32_t m_typical[TIMING_COUNT];   /**< Typical operation durations (us). **/
+        uint8_t  m_operation;       /**< Timed operation in progress. **/
+        uint32_t m_operationStart;  /**< Start of the timed operation (us). **/
+
+        bool m_protectionEnabled;   /**< Sector protection is enabled. **/
+        bool m_protectionCached;    /**< m_protection holds the register. **/
+        SectorProtectionStatus m_protection;    /**< Sector protection map. **/
+
+        ModifyHook m_modifyHook;    /**< Main memory modification hook. **/
+        void *m_modifyHookContext;  /**< Modification hook user data. **/
+        YieldHook m_yieldHook;      /**< Hook called while waiting. **/
+        void *m_yieldHookContext;   /**< Yield hook user data. **/
+
+        /**
+         * @brief Power state.
+         **/
+        enum powerstate
+        {
+            POWER_ACTIVE,           /**< Device is ready for commands. **/
+            POWER_DOWN,             /**< Device is in Deep Power-down. **/
+            POWER_RESUMING          /**< Resume sent, t_RDPD not elapsed yet. **/
+        };
+        enum powerstate m_power;    /**< Power state. **/
+        uint32_t m_idleTimeout;     /**< Automatic Deep Power-down timeout (ms). **/
+        uint32_t m_lastAccess;      /**< Time of the last command (ms). **/
+        uint32_t m_powerTime;       /**< Deep Power-down entry (ms) or resume (us) time. **/
+        PowerStats m_powerStats;    /**< Power management statistics. **/
+
         enum IOspeed m_speed;       /**< SPI transfer speed. **/
+        uint32_t m_clock;           /**< SPI clock (Hz), 0 if not set. **/
+
+#ifdef AT45_USE_STATS
+        Stats    m_stats;           /**< Instrumentation counters. **/
+        bool     m_statsCommand;    /**< Next transferred byte is an opcode. **/
+        uint8_t  m_statsOperation;  /**< Operation whose latency is being measured. **/
+        uint32_t m_statsStart;      /**< Start time of the measured operation (us). **/
+#endif
+
+#ifdef AT45_USE_TRACE
+        uint16_t m_trace[AT45_TRACE_SIZE];  /**< Trace ring buffer. **/
+        uint16_t m_traceNext;       /**< Next trace entry. **/
+        bool     m_traceWrapped;    /**< The ring buffer is full. **/
 #endif
 
         SPISettings m_settings;     /**< SPI port configuration **/
@@ -0,0 +1,227 @@
+/**************************************************************************//**
+ * @file DataFlashAppender.cpp
+ * @brief Record appender coalescing small writes in a SRAM buffer for the
+ * AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Writing each small record with its own page program wastes time (up to
+ * 40ms per program with built-in erase) and endurance. The appender writes
+ * records to a SRAM buffer with buffer writes, which don't touch the main
+ * memory, and programs the page once it's full. A page holds 16 to 64
+ * records of 8 to 32 bytes.
+ * A partially filled page can be programmed early by flush(). Its unused
+ * end is padded with 0xff so that it reads as erased. When more records are
+ * added, the whole page is programmed again from the buffer. Without the
+ * built-in erase, this only clears bits of the padding, which is allowed.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashAppender.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashAppender::DataFlashAppender(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_page(0)
+    , m_end(0)
+    , m_offset(0)
+    , m_buffer(0)
+    , m_pending(false)
+    , m_pendingSince(0)
+    , m_interval(0)
+    , m_records(0)
+    , m_programs(0)
+{}
+
+/**
+ * Start appending records.
+ * @param page First page of the log area.
+ * @param count Number of pages of the log area.
+ **/
+void DataFlashAppender::begin(uint16_t page, uint16_t count)
+{
+    m_page     = page;
+    m_end      = page + count;
+    m_offset   = 0;
+    m_buffer   = 0;
+    m_pending  = false;
+    m_records  = 0;
+    m_programs = 0;
+}
+
+/**
+ * Flush pending records and stop appending.
+ * @return false if the pending records couldn't be programmed.
+ **/
+bool DataFlashAppender::end()
+{
+    bool flushed = flush();
+    m_end = m_page;
+    return flushed;
+}
+
+/**
+ * Append a record.
+ * If the record doesn't fit in the current page, the page is programmed
+ * and the record goes to the next one.
+ * @param record Record data.
+ * @param length Record length in bytes (at most one page).
+ * @return false if the log area is full, the record is too long or the
+ *         full page couldn't be programmed.
+ **/
+bool DataFlashAppender::append(const void *record, uint16_t length)
+{
+    uint16_t pageSize = m_dataflash.pageSize();
+
+    if((length == 0) || (length > pageSize) || (m_page >= m_end))
+    {
+        return false;
+    }
+
+    if((m_offset + length) > pageSize)
+    {
+        if(!nextPage())
+        {
+            return false;
+        }
+    }
+
+    /* Only waits if the buffer is still being programmed. */
+    m_dataflash.bufferWrite(m_buffer, m_offset);
+    const uint8_t *data = static_cast<const uint8_t*>(record);
+    for(uint16_t i=0; i<length; i++)
+    {
+        m_dataflash.transfer(data[i]);
+    }
+    m_dataflash.disable();
+
+    if(!m_pending)
+    {
+        m_pending      = true;
+        m_pendingSince = millis();
+    }
+    m_offset += length;
+    ++m_records;
+
+    if(m_offset == pageSize)
+    {
+        /* A failure is reported by the next call. */
+        nextPage();
+    }
+    return true;
+}
+
+/**
+ * Program the current page if it holds records not written yet.
+ * @return false if the page is protected.
+ **/
+bool DataFlashAppender::flush()
+{
+    return !m_pending || program();
+}
+
+/**
+ * Flush pending records if the oldest one is older than the flush
+ * interval.
+ * @return true if the page was programmed.
+ **/
+bool DataFlashAppender::update()
+{
+    if(m_pending && m_interval && ((millis() - m_pendingSince) >= m_interval))
+    {
+        return program();
+    }
+    return false;
+}
+
+/**
+ * Program the current page, padding the unused end with 0xff.
+ * The padding is only written up to the end of the page, the records
+ * already in the buffer are kept for the next program.
+ * @return false if the page is protected, the records are then kept
+ *         pending.
+ **/
+bool DataFlashAppender::program()
+{
+    uint16_t pageSize = m_dataflash.pageSize();
+
+    if(m_offset < pageSize)
+    {
+        m_dataflash.bufferWrite(m_buffer, m_offset);
+        for(uint16_t i=m_offset; i<pageSize; i++)
+        {
+            m_dataflash.transfer(0xff);
+        }
+        m_dataflash.disable();
+    }
+
+    /* The program runs in the background, the other buffer can be
+     * filled meanwhile. */
+    if(!m_dataflash.bufferToPage(m_buffer, m_page))
+    {
+        return false;
+    }
+
+    ++m_programs;
+    m_pending = false;
+    return true;
+}
+
+/**
+ * Program the current page if needed and move to the next one.
+ * @return false if the log area is full or the page is protected.
+ **/
+bool DataFlashAppender::nextPage()
+{
+    if(m_pending && !program())
+    {
+        return false;
+    }
+
+    ++m_page;
+    m_offset  = 0;
+    m_buffer ^= 1;
+
+    return (m_page < m_end);
+}
+
+/**
+ * @}
+ **/
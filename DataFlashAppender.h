@@ -0,0 +1,197 @@
+/**************************************************************************//**
+ * @file DataFlashAppender.h
+ * @brief Record appender coalescing small writes in a SRAM buffer for the
+ * AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashAppender.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_APPENDER_H_
+#define DATAFLASH_APPENDER_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Append only record writer.
+ * Records are accumulated in a SRAM buffer and the page is only
+ * programmed when it's full, or when flush() is called (explicitly or
+ * by update() once the flush interval elapsed). Records never straddle
+ * two pages. The unused end of a page is filled with 0xff.
+ * The two SRAM buffers are used alternately, so the next page is filled
+ * while the previous one is programmed.
+ * @note Both SRAM buffers are used, their content is lost.
+ **/
+class DataFlashAppender
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashAppender(DataFlash &dataflash);
+
+        /**
+         * Start appending records.
+         * @param page First page of the log area.
+         * @param count Number of pages of the log area.
+         **/
+        void begin(uint16_t page, uint16_t count);
+
+        /**
+         * Flush pending records and stop appending.
+         * @return false if the pending records couldn't be programmed.
+         **/
+        bool end();
+
+        /**
+         * Append a record.
+         * @param record Record data.
+         * @param length Record length in bytes (at most one page).
+         * @return false if the log area is full, the record is too long
+         *         or the full page couldn't be programmed because it's
+         *         in a protected sector.
+         **/
+        bool append(const void *record, uint16_t length);
+
+        /**
+         * Program the current page if it holds records not written yet.
+         * The next records are appended to the same page, which will be
+         * programmed again.
+         * @return false if the page is in a protected sector. The
+         *         records are kept pending.
+         **/
+        bool flush();
+
+        /**
+         * Flush pending records if the oldest one is older than the
+         * flush interval. This should be called regularly (from loop()
+         * for example).
+         * @return true if the page was programmed.
+         **/
+        bool update();
+
+        /**
+         * Set the maximum time records stay in the SRAM buffer.
+         * @param interval Flush interval in milliseconds, 0 to only flush
+         *        full pages and on explicit flush() calls (default).
+         **/
+        inline void setFlushInterval(uint32_t interval);
+
+        /** Page the next record will be appended to. **/
+        inline uint16_t page() const;
+
+        /** Byte offset of the next record within the page. **/
+        inline uint16_t offset() const;
+
+        /** Number of records appended. **/
+        inline uint32_t records() const;
+
+        /** Number of page programs. **/
+        inline uint32_t programs() const;
+
+        /** Average number of records per page program. **/
+        inline uint16_t recordsPerProgram() const;
+
+    private:
+        /**
+         * Program the current page, padding the unused end with 0xff.
+         * @return false if the page is in a protected sector.
+         **/
+        bool program();
+
+        /**
+         * Program the current page if needed and move to the next one.
+         * @return false if the log area is full or the page couldn't
+         *         be programmed.
+         **/
+        bool nextPage();
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint16_t   m_page;          /**< Current page. **/
+        uint16_t   m_end;           /**< Page following the log area. **/
+        uint16_t   m_offset;        /**< Next record offset within the page. **/
+        uint8_t    m_buffer;        /**< SRAM buffer holding the current page. **/
+        bool       m_pending;       /**< Records not programmed yet. **/
+        uint32_t   m_pendingSince;  /**< Time of the oldest pending record (ms). **/
+        uint32_t   m_interval;      /**< Flush interval (ms). **/
+        uint32_t   m_records;       /**< Number of records appended. **/
+        uint32_t   m_programs;      /**< Number of page programs. **/
+};
+
+/**
+ * Set the maximum time records stay in the SRAM buffer.
+ * @param interval Flush interval in milliseconds (0: disabled).
+ **/
+inline void DataFlashAppender::setFlushInterval(uint32_t interval)
+{
+    m_interval = interval;
+}
+
+/** Page the next record will be appended to. **/
+inline uint16_t DataFlashAppender::page() const
+{
+    return m_page;
+}
+
+/** Byte offset of the next record within the page. **/
+inline uint16_t DataFlashAppender::offset() const
+{
+    return m_offset;
+}
+
+/** Number of records appended. **/
+inline uint32_t DataFlashAppender::records() const
+{
+    return m_records;
+}
+
+/** Number of page programs. **/
+inline uint32_t DataFlashAppender::programs() const
+{
+    return m_programs;
+}
+
+/** Average number of records per page program. **/
+inline uint16_t DataFlashAppender::recordsPerProgram() const
+{
+    return m_programs ? (m_records / m_programs) : 0;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_APPENDER_H_ */
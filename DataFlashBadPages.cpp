@@ -0,0 +1,332 @@
+/**************************************************************************//**
+ * @file DataFlashBadPages.cpp
+ * @brief Verified page programs and bad page remapping for the AT45DBxxxD
+ * Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Table page layout (little endian): magic (2 bytes), sequence number (4
+ * bytes), number of entries (2 bytes), next spare page index (2 bytes),
+ * entries (bad page and spare page, 2 bytes each), CRC-16 of all the
+ * previous bytes.
+ * A spare page that fails its own verification is skipped. When a remapped
+ * page fails again, its entry is updated to point to a new spare page.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashBadPages.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Table page magic number. **/
+#define AT45_BAD_PAGES_MAGIC    0x4250
+
+/** Send a 16 bits little endian value and update the CRC. **/
+static void put16(DataFlash &dataflash, uint16_t value, uint16_t &crc)
+{
+    dataflash.transfer(value & 0xff);
+    dataflash.transfer(value >> 8);
+    crc = dataflashCrc16(crc, value & 0xff);
+    crc = dataflashCrc16(crc, value >> 8);
+}
+
+/** Read a 16 bits little endian value and update the CRC. **/
+static uint16_t get16(DataFlash &dataflash, uint16_t &crc)
+{
+    uint8_t lo = dataflash.transfer(0xff);
+    uint8_t hi = dataflash.transfer(0xff);
+    crc = dataflashCrc16(crc, lo);
+    crc = dataflashCrc16(crc, hi);
+    return lo | ((uint16_t)hi << 8);
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param retries Number of program retries before a page is declared bad.
+ **/
+DataFlashBadPages::DataFlashBadPages(DataFlash &dataflash, uint8_t retries)
+    : m_dataflash(dataflash)
+    , m_retries(retries)
+    , m_tablePage(0)
+    , m_spareFirst(0)
+    , m_spareCount(0)
+    , m_spareNext(0)
+    , m_slot(1)
+    , m_sequence(0)
+    , m_failures(0)
+    , m_count(0)
+{
+    memset(m_filter, 0, sizeof(m_filter));
+}
+
+/**
+ * Load the bad page table.
+ * @param tablePage First of the two pages holding the table.
+ * @param spareFirst First page of the spare area.
+ * @param spareCount Number of pages of the spare area.
+ * @return true if a valid table was found.
+ **/
+bool DataFlashBadPages::begin(uint16_t tablePage, uint16_t spareFirst, uint16_t spareCount)
+{
+    m_tablePage  = tablePage;
+    m_spareFirst = spareFirst;
+    m_spareCount = spareCount;
+    m_spareNext  = 0;
+    m_count      = 0;
+    m_failures   = 0;
+
+    uint32_t sequence[2];
+    bool valid[2];
+    valid[0] = readTable(0, sequence[0], false);
+    valid[1] = readTable(1, sequence[1], false);
+
+    bool found = valid[0] || valid[1];
+    if(found)
+    {
+        if(valid[0] && valid[1])
+        {
+            m_slot = ((int32_t)(sequence[1] - sequence[0]) > 0) ? 1 : 0;
+        }
+        else
+        {
+            m_slot = valid[0] ? 0 : 1;
+        }
+        readTable(m_slot, m_sequence, true);
+    }
+    else
+    {
+        m_slot     = 1;
+        m_sequence = 0;
+    }
+
+    rebuildFilter();
+    return found;
+}
+
+/**
+ * Program a buffer to a page and verify it, remapping the page if it's
+ * bad.
+ * @param bufferNum Buffer to program (0 or 1).
+ * @param page Page (as seen by the application).
+ * A page refused because its sector is protected isn't bad: it's
+ * neither retried nor remapped.
+ * @return false if no spare page is left, or if the page, the spare
+ *         area or the table is protected.
+ **/
+bool DataFlashBadPages::program(uint8_t bufferNum, uint16_t page)
+{
+    uint16_t target = remap(page);
+    if(isProtected(target))
+    {
+        return false;
+    }
+    if(programVerify(bufferNum, target, false))
+    {
+        return true;
+    }
+
+    /* Don't burn spare pages if the table can't record the remap. */
+    uint8_t i;
+    for(i=0; (i<m_count) && (m_entries[i].page != page); i++)
+    {}
+    if((i >= AT45_BAD_PAGES_MAX) || isProtected(m_tablePage + (m_slot ^ 1)))
+    {
+        return false;
+    }
+
+    /* Find a spare page that accepts the data. */
+    uint16_t spare;
+    do
+    {
+        if((m_spareNext >= m_spareCount) || isProtected(m_spareFirst + m_spareNext))
+        {
+            return false;
+        }
+        spare = m_spareFirst + m_spareNext++;
+    } while(!programVerify(bufferNum, spare, true));
+
+    if(i == m_count)
+    {
+        m_entries[m_count++].page = page;
+        m_filter[filterBit(page) >> 3] |= 1 << (filterBit(page) & 7);
+    }
+    m_entries[i].spare = spare;
+
+    return writeTable(bufferNum ^ 1);
+}
+
+/**
+ * Program and verify a page, retrying if needed.
+ * A failed verification only costs a compare, the data isn't read back.
+ * Retries overwrite a partially programmed page, so they always use the
+ * built-in erase, whatever the %Dataflash erase mode.
+ * @param bufferNum Buffer to program (0 or 1).
+ * @param page Physical page.
+ * @param erase Use the built-in erase for the first attempt too.
+ * @return true if the page matches the buffer, false if it doesn't or if
+ *         the page is protected.
+ **/
+bool DataFlashBadPages::programVerify(uint8_t bufferNum, uint16_t page, bool erase)
+{
+    DataFlash::erasemode mode = m_dataflash.eraseMode();
+    bool match = false;
+
+    for(uint8_t attempt=0; !match && (attempt<=m_retries); attempt++)
+    {
+        if(erase || attempt)
+        {
+            m_dataflash.autoErase();
+        }
+        if(!m_dataflash.bufferToPage(bufferNum, page))
+        {
+            /* Protected, retrying won't help. */
+            break;
+        }
+        m_dataflash.waitUntilReady();
+        match = m_dataflash.isPageEqualBuffer(page, bufferNum);
+        if(!match)
+        {
+            ++m_failures;
+        }
+    }
+
+    if(mode == DataFlash::ERASE_MANUAL)
+    {
+        m_dataflash.manualErase();
+    }
+    return match;
+}
+
+/**
+ * Read and check a table page.
+ * @param slot Table page (0 or 1).
+ * @param sequence Sequence number of the table page.
+ * @param load Fill the table if it's valid.
+ * @return true if the table page is valid.
+ **/
+bool DataFlashBadPages::readTable(uint8_t slot, uint32_t &sequence, bool load)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+    uint16_t dummy = AT45_CRC16_INIT;
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(m_tablePage + slot, 0);
+
+    uint16_t magic = get16(m_dataflash, crc);
+    sequence  = get16(m_dataflash, crc);
+    sequence |= (uint32_t)get16(m_dataflash, crc) << 16;
+    uint16_t count = get16(m_dataflash, crc);
+    uint16_t next  = get16(m_dataflash, crc);
+
+    bool valid = (magic == AT45_BAD_PAGES_MAGIC) && (count <= AT45_BAD_PAGES_MAX);
+    if(valid)
+    {
+        for(uint16_t i=0; i<count; i++)
+        {
+            uint16_t page  = get16(m_dataflash, crc);
+            uint16_t spare = get16(m_dataflash, crc);
+            if(load)
+            {
+                m_entries[i].page  = page;
+                m_entries[i].spare = spare;
+            }
+        }
+        valid = (get16(m_dataflash, dummy) == crc);
+    }
+    m_dataflash.disable();
+
+    if(valid && load)
+    {
+        m_count     = count;
+        m_spareNext = next;
+    }
+    return valid;
+}
+
+/**
+ * Save the table to the slot not holding the current one.
+ * @param bufferNum Buffer used for the write.
+ * @return false if the table page couldn't be programmed. The current
+ *         table is kept.
+ **/
+bool DataFlashBadPages::writeTable(uint8_t bufferNum)
+{
+    uint8_t  slot     = m_slot ^ 1;
+    uint32_t sequence = m_sequence + 1;
+    uint16_t crc      = AT45_CRC16_INIT;
+    uint16_t dummy    = AT45_CRC16_INIT;
+
+    m_dataflash.bufferWrite(bufferNum, 0);
+    put16(m_dataflash, AT45_BAD_PAGES_MAGIC, crc);
+    put16(m_dataflash, sequence & 0xffff, crc);
+    put16(m_dataflash, sequence >> 16, crc);
+    put16(m_dataflash, m_count, crc);
+    put16(m_dataflash, m_spareNext, crc);
+    for(uint8_t i=0; i<m_count; i++)
+    {
+        put16(m_dataflash, m_entries[i].page, crc);
+        put16(m_dataflash, m_entries[i].spare, crc);
+    }
+    put16(m_dataflash, crc, dummy);
+    m_dataflash.disable();
+
+    /* The table pages are verified too, but never remapped. */
+    if(!programVerify(bufferNum, m_tablePage + slot, true))
+    {
+        return false;
+    }
+
+    m_slot     = slot;
+    m_sequence = sequence;
+    return true;
+}
+
+/**
+ * Update the lookup filter from the table.
+ **/
+void DataFlashBadPages::rebuildFilter()
+{
+    memset(m_filter, 0, sizeof(m_filter));
+    for(uint8_t i=0; i<m_count; i++)
+    {
+        m_filter[filterBit(m_entries[i].page) >> 3] |= 1 << (filterBit(m_entries[i].page) & 7);
+    }
+}
+
+/**
+ * @}
+ **/
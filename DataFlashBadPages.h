@@ -0,0 +1,230 @@
+/**************************************************************************//**
+ * @file DataFlashBadPages.h
+ * @brief Verified page programs and bad page remapping for the AT45DBxxxD
+ * Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashBadPages.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_BAD_PAGES_H_
+#define DATAFLASH_BAD_PAGES_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_BAD_PAGES Bad page table settings.
+ * @{
+ **/
+/**
+ * Maximum number of remapped pages. Each one costs 4 bytes of RAM.
+ **/
+#define AT45_BAD_PAGES_MAX      16
+/**
+ * Default number of program retries before a page is declared bad.
+ **/
+#define AT45_BAD_PAGES_RETRIES  2
+/**
+ * @}
+ **/
+
+/**
+ * Verified page programs with bad page remapping.
+ * Each program is checked with the on-chip page to buffer compare.
+ * When a page still doesn't match after the retries, it's remapped to
+ * the next page of a spare area and the table is saved. The table is
+ * kept in two pages written alternately, with a sequence number and a
+ * CRC.
+ * The application must use remap() to get the actual location of a page
+ * before reading it.
+ **/
+class DataFlashBadPages
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param retries Number of program retries before a page is
+         *        declared bad.
+         **/
+        DataFlashBadPages(DataFlash &dataflash, uint8_t retries=AT45_BAD_PAGES_RETRIES);
+
+        /**
+         * Load the bad page table.
+         * @param tablePage First of the two pages holding the table.
+         * @param spareFirst First page of the spare area.
+         * @param spareCount Number of pages of the spare area.
+         * @return true if a valid table was found, false if it's empty.
+         **/
+        bool begin(uint16_t tablePage, uint16_t spareFirst, uint16_t spareCount);
+
+        /**
+         * Program a buffer to a page and verify it.
+         * If the page is bad, the data goes to a spare page.
+         * In manual erase mode, the page must have been erased first.
+         * Retries, spare pages and table pages are always programmed
+         * with the built-in erase.
+         * @note The table is written through the other buffer, its
+         * content is lost when a page is remapped.
+         * @param bufferNum Buffer to program (0 or 1).
+         * @param page Page (as seen by the application).
+         * @return false if the program failed and no spare page is left,
+         *         or if the page, the spare area or the table is in a
+         *         protected sector. Protected pages are never remapped.
+         **/
+        bool program(uint8_t bufferNum, uint16_t page);
+
+        /**
+         * Actual location of a page.
+         * @param page Page (as seen by the application).
+         * @return The spare page it's remapped to, or the page itself.
+         **/
+        inline uint16_t remap(uint16_t page) const;
+
+        /** Number of remapped pages. **/
+        inline uint8_t badPageCount() const;
+
+        /** Number of failed verifications. **/
+        inline uint32_t verifyFailures() const;
+
+    private:
+        /**
+         * Remapped page.
+         **/
+        struct Entry
+        {
+            uint16_t page;      /**< Bad page. **/
+            uint16_t spare;     /**< Replacement page. **/
+        };
+
+        /**
+         * Program and verify a page.
+         * @param erase Use the built-in erase for the first attempt too.
+         * @return true if the page matches the buffer.
+         **/
+        bool programVerify(uint8_t bufferNum, uint16_t page, bool erase);
+
+        /**
+         * Read and check a table page.
+         * @param load Fill the table if it's valid.
+         * @return true if the table page is valid.
+         **/
+        bool readTable(uint8_t slot, uint32_t &sequence, bool load);
+
+        /**
+         * Save the table to the slot not holding the current one.
+         * @param bufferNum Buffer used for the write.
+         * @return false if the table page couldn't be programmed.
+         **/
+        bool writeTable(uint8_t bufferNum);
+
+        /** Tell if a page is in a protected sector. **/
+        inline bool isProtected(uint16_t page);
+
+        /** Filter bit of a page. **/
+        inline uint8_t filterBit(uint16_t page) const;
+
+        /** Update the lookup filter. **/
+        void rebuildFilter();
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint8_t    m_retries;       /**< Program retries. **/
+        uint16_t   m_tablePage;     /**< First table page. **/
+        uint16_t   m_spareFirst;    /**< First page of the spare area. **/
+        uint16_t   m_spareCount;    /**< Number of pages of the spare area. **/
+        uint16_t   m_spareNext;     /**< Next spare page to use (index). **/
+        uint8_t    m_slot;          /**< Table page holding the current table. **/
+        uint32_t   m_sequence;      /**< Sequence number of the current table. **/
+        uint32_t   m_failures;      /**< Number of failed verifications. **/
+
+        Entry   m_entries[AT45_BAD_PAGES_MAX];  /**< Remapped pages. **/
+        uint8_t m_count;            /**< Number of remapped pages. **/
+        /**
+         * One bit per group of pages sharing the same low bits. If a
+         * page's bit is clear, the page isn't remapped and the table
+         * doesn't need to be searched.
+         **/
+        uint8_t m_filter[32];
+};
+
+/**
+ * Actual location of a page. When the filter bit is clear (nearly
+ * always), no table entry is searched.
+ * @param page Page (as seen by the application).
+ **/
+inline uint16_t DataFlashBadPages::remap(uint16_t page) const
+{
+    if(m_filter[filterBit(page) >> 3] & (1 << (filterBit(page) & 7)))
+    {
+        for(uint8_t i=0; i<m_count; i++)
+        {
+            if(m_entries[i].page == page)
+            {
+                return m_entries[i].spare;
+            }
+        }
+    }
+    return page;
+}
+
+/** Number of remapped pages. **/
+inline uint8_t DataFlashBadPages::badPageCount() const
+{
+    return m_count;
+}
+
+/** Number of failed verifications. **/
+inline uint32_t DataFlashBadPages::verifyFailures() const
+{
+    return m_failures;
+}
+
+/** Tell if a page is in a protected sector. **/
+inline bool DataFlashBadPages::isProtected(uint16_t page)
+{
+    return m_dataflash.isSectorProtected(m_dataflash.pageToSector(page));
+}
+
+/** Filter bit of a page. **/
+inline uint8_t DataFlashBadPages::filterBit(uint16_t page) const
+{
+    return page & 0xff;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_BAD_PAGES_H_ */
@@ -0,0 +1,453 @@
+/**************************************************************************//**
+ * @file DataFlashCompressor.cpp
+ * @brief LZSS compression of page aligned frames for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * LZSS compression in the spirit of heatshrink: a small fixed window, no
+ * dynamic allocation and a bit oriented output. Tokens are either a literal
+ * (1 bit flag set, 8 bits of data) or a back reference (1 bit flag cleared,
+ * AT45_LZ_WINDOW_BITS bits of distance minus one, AT45_LZ_LENGTH_BITS bits
+ * of length minus AT45_LZ_MIN_MATCH). Bits are packed MSB first.
+ * Each page holds a frame: uncompressed length (2 bytes, little endian),
+ * compressed length (2 bytes), then the tokens. The window is reset at the
+ * start of each frame. An erased page reads as an invalid frame.
+ * The match search is a brute force scan of the window, which keeps the RAM
+ * usage to the window itself.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashCompressor.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Ring buffer position mask. **/
+#define AT45_LZ_RING_MASK   (2*AT45_LZ_WINDOW - 1)
+/** Size of a literal token in bits. **/
+#define AT45_LZ_LITERAL_BITS    9
+/** Size of a back reference token in bits. **/
+#define AT45_LZ_REFERENCE_BITS  (1 + AT45_LZ_WINDOW_BITS + AT45_LZ_LENGTH_BITS)
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashCompressor::DataFlashCompressor(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_page(0)
+    , m_end(0)
+    , m_buffer(0)
+    , m_frameStart(0)
+    , m_pos(0)
+    , m_last(0)
+    , m_outCount(0)
+    , m_outOffset(AT45_LZ_HEADER_SIZE)
+    , m_bits(0)
+    , m_bitCount(0)
+    , m_frameBits(0)
+    , m_frameRaw(0)
+    , m_rawBytes(0)
+    , m_compressedBytes(0)
+{}
+
+/**
+ * Start compressing to an area of the main memory.
+ * @param page First page of the area.
+ * @param count Number of pages of the area.
+ **/
+void DataFlashCompressor::begin(uint16_t page, uint16_t count)
+{
+    m_page            = page;
+    m_end             = page + count;
+    m_buffer          = 0;
+    m_frameStart      = 0;
+    m_pos             = 0;
+    m_last            = 0;
+    m_outCount        = 0;
+    m_outOffset       = AT45_LZ_HEADER_SIZE;
+    m_bits            = 0;
+    m_bitCount        = 0;
+    m_frameBits       = 0;
+    m_frameRaw        = 0;
+    m_rawBytes        = 0;
+    m_compressedBytes = 0;
+}
+
+/**
+ * Compress data. Tokens are only encoded once enough data is pending
+ * to look for the longest match.
+ * @param data Data.
+ * @param length Data length in bytes.
+ * @return false if the area is full or a page is protected.
+ **/
+bool DataFlashCompressor::write(const void *data, uint16_t length)
+{
+    const uint8_t *src = static_cast<const uint8_t*>(data);
+
+    for(uint16_t i=0; i<length; i++)
+    {
+        if(m_page >= m_end)
+        {
+            return false;
+        }
+        m_ring[m_last++ & AT45_LZ_RING_MASK] = src[i];
+        if((uint16_t)(m_last - m_pos) >= AT45_LZ_MAX_MATCH)
+        {
+            encode();
+        }
+    }
+    return (m_page < m_end);
+}
+
+/**
+ * Compress the pending data and program the current frame.
+ * @return false if the frame couldn't be programmed.
+ **/
+bool DataFlashCompressor::flush()
+{
+    while((m_pos != m_last) && (m_page < m_end))
+    {
+        encode();
+    }
+    return closeFrame();
+}
+
+/**
+ * Compress one token from the pending data.
+ **/
+void DataFlashCompressor::encode()
+{
+    uint16_t capacity = (m_dataflash.pageSize() - AT45_LZ_HEADER_SIZE) * 8;
+    uint16_t pending  = m_last - m_pos;
+    if(pending > AT45_LZ_MAX_MATCH)
+    {
+        pending = AT45_LZ_MAX_MATCH;
+    }
+
+    /* Only look back in the current frame. */
+    uint16_t history = m_pos - m_frameStart;
+    if(history > AT45_LZ_WINDOW)
+    {
+        history = AT45_LZ_WINDOW;
+    }
+
+    uint16_t bestLength   = 0;
+    uint16_t bestDistance = 0;
+    for(uint16_t distance=1; distance<=history; distance++)
+    {
+        uint16_t length = 0;
+        /* The match may overlap the data being compressed. */
+        while((length < pending) &&
+              (m_ring[(m_pos - distance + length) & AT45_LZ_RING_MASK] ==
+               m_ring[(m_pos + length) & AT45_LZ_RING_MASK]))
+        {
+            ++length;
+        }
+        if(length > bestLength)
+        {
+            bestLength   = length;
+            bestDistance = distance;
+            if(length == pending)
+            {
+                break;
+            }
+        }
+    }
+
+    uint8_t bits = (bestLength >= AT45_LZ_MIN_MATCH) ? AT45_LZ_REFERENCE_BITS :
+                                                        AT45_LZ_LITERAL_BITS;
+    if((m_frameBits + bits) > capacity)
+    {
+        /* The new frame starts with an empty window. */
+        closeFrame();
+        if(m_page >= m_end)
+        {
+            return;
+        }
+        bestLength = 0;
+        bits       = AT45_LZ_LITERAL_BITS;
+    }
+
+    if(bits == AT45_LZ_REFERENCE_BITS)
+    {
+        putBits(0, 1);
+        putBits(bestDistance - 1, AT45_LZ_WINDOW_BITS);
+        putBits(bestLength - AT45_LZ_MIN_MATCH, AT45_LZ_LENGTH_BITS);
+    }
+    else
+    {
+        bestLength = 1;
+        putBits(1, 1);
+        putBits(m_ring[m_pos & AT45_LZ_RING_MASK], 8);
+    }
+
+    m_pos      += bestLength;
+    m_frameRaw += bestLength;
+    m_rawBytes += bestLength;
+}
+
+/**
+ * Append bits to the frame, most significant bit first.
+ * @param value Bits.
+ * @param count Number of bits.
+ **/
+void DataFlashCompressor::putBits(uint16_t value, uint8_t count)
+{
+    m_frameBits += count;
+    while(count--)
+    {
+        m_bits = (m_bits << 1) | ((value >> count) & 1);
+        if(++m_bitCount == 8)
+        {
+            m_out[m_outCount++] = m_bits;
+            m_bits     = 0;
+            m_bitCount = 0;
+            if(m_outCount == AT45_LZ_CHUNK_SIZE)
+            {
+                sendChunk();
+            }
+        }
+    }
+}
+
+/**
+ * Send the staged bytes to the SRAM buffer.
+ * Only waits if the buffer is still being programmed.
+ **/
+void DataFlashCompressor::sendChunk()
+{
+    if(m_outCount == 0)
+    {
+        return;
+    }
+
+    m_dataflash.bufferWrite(m_buffer, m_outOffset);
+    for(uint8_t i=0; i<m_outCount; i++)
+    {
+        m_dataflash.transfer(m_out[i]);
+    }
+    m_dataflash.disable();
+
+    m_outOffset += m_outCount;
+    m_outCount   = 0;
+}
+
+/**
+ * Program the current frame and start a new one.
+ * The next frame is built in the other SRAM buffer while this one is
+ * programmed.
+ * A frame that can't be programmed ends the area, so that no more data
+ * is accepted.
+ * @return false if the area is full or the page is protected.
+ **/
+bool DataFlashCompressor::closeFrame()
+{
+    if(m_frameRaw == 0)
+    {
+        return true;
+    }
+    if(m_page >= m_end)
+    {
+        return false;
+    }
+
+    if(m_bitCount)
+    {
+        m_out[m_outCount++] = m_bits << (8 - m_bitCount);
+        m_bits     = 0;
+        m_bitCount = 0;
+    }
+    sendChunk();
+
+    uint16_t compressed = m_outOffset - AT45_LZ_HEADER_SIZE;
+    m_dataflash.bufferWrite(m_buffer, 0);
+    m_dataflash.transfer(m_frameRaw & 0xff);
+    m_dataflash.transfer(m_frameRaw >> 8);
+    m_dataflash.transfer(compressed & 0xff);
+    m_dataflash.transfer(compressed >> 8);
+    m_dataflash.disable();
+
+    if(!m_dataflash.bufferToPage(m_buffer, m_page))
+    {
+        m_end = m_page;
+        return false;
+    }
+    m_compressedBytes += m_outOffset;
+
+    ++m_page;
+    m_buffer    ^= 1;
+    m_outOffset  = AT45_LZ_HEADER_SIZE;
+    m_frameBits  = 0;
+    m_frameRaw   = 0;
+    m_frameStart = m_pos;
+    return true;
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashDecompressor::DataFlashDecompressor(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_bits(0)
+    , m_bitCount(0)
+{}
+
+/**
+ * Uncompressed length of a frame.
+ * @param page Frame page.
+ * @return Length in bytes, or -1 if the page doesn't hold a frame.
+ **/
+int16_t DataFlashDecompressor::frameLength(uint16_t page)
+{
+    int16_t length = open(page);
+    m_dataflash.disable();
+    return length;
+}
+
+/**
+ * Decompress a part of a frame. The frame is decoded from its start,
+ * only the requested part is copied.
+ * @param page Frame page.
+ * @param offset Offset in the uncompressed data.
+ * @param data Destination buffer.
+ * @param length Number of bytes to decompress.
+ * @return Number of bytes decompressed, or -1 if the page doesn't hold
+ *         a frame.
+ **/
+int16_t DataFlashDecompressor::read(uint16_t page, uint16_t offset, void *data, uint16_t length)
+{
+    uint8_t *dst = static_cast<uint8_t*>(data);
+
+    int16_t raw = open(page);
+    if(raw < 0)
+    {
+        m_dataflash.disable();
+        return -1;
+    }
+
+    uint16_t end = offset + length;
+    if(end > (uint16_t)raw)
+    {
+        end = raw;
+    }
+
+    uint16_t pos = 0;
+    uint16_t copied = 0;
+    while(pos < end)
+    {
+        uint16_t distance = 0;
+        uint16_t count    = 1;
+        uint8_t  literal  = 0;
+
+        if(getBits(1))
+        {
+            literal = getBits(8);
+        }
+        else
+        {
+            distance = getBits(AT45_LZ_WINDOW_BITS) + 1;
+            count    = getBits(AT45_LZ_LENGTH_BITS) + AT45_LZ_MIN_MATCH;
+        }
+
+        for(uint16_t i=0; (i<count) && (pos<end); i++, pos++)
+        {
+            uint8_t value = distance ?
+                m_window[(pos - distance) & (AT45_LZ_WINDOW - 1)] : literal;
+            m_window[pos & (AT45_LZ_WINDOW - 1)] = value;
+            if(pos >= offset)
+            {
+                dst[copied++] = value;
+            }
+        }
+    }
+
+    m_dataflash.disable();
+    return copied;
+}
+
+/**
+ * Read the frame header. The page read is left open.
+ * @param page Frame page.
+ * @return Uncompressed length, or -1 if the page doesn't hold a frame.
+ **/
+int16_t DataFlashDecompressor::open(uint16_t page)
+{
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(page, 0);
+
+    uint16_t raw = m_dataflash.transfer(0xff);
+    raw |= (uint16_t)m_dataflash.transfer(0xff) << 8;
+    uint16_t compressed = m_dataflash.transfer(0xff);
+    compressed |= (uint16_t)m_dataflash.transfer(0xff) << 8;
+
+    m_bits     = 0;
+    m_bitCount = 0;
+
+    /* An erased page has both lengths set to 0xffff. */
+    if((raw == 0) || (raw > 0x7fff) ||
+       (compressed > (m_dataflash.pageSize() - AT45_LZ_HEADER_SIZE)))
+    {
+        return -1;
+    }
+    return raw;
+}
+
+/**
+ * Read bits from the frame, most significant bit first.
+ * @param count Number of bits.
+ * @return Bits read.
+ **/
+uint16_t DataFlashDecompressor::getBits(uint8_t count)
+{
+    uint16_t value = 0;
+    while(count--)
+    {
+        if(m_bitCount == 0)
+        {
+            m_bits     = m_dataflash.transfer(0xff);
+            m_bitCount = 8;
+        }
+        value = (value << 1) | ((m_bits >> 7) & 1);
+        m_bits <<= 1;
+        --m_bitCount;
+    }
+    return value;
+}
+
+/**
+ * @}
+ **/
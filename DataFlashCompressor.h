@@ -0,0 +1,238 @@
+/**************************************************************************//**
+ * @file DataFlashCompressor.h
+ * @brief LZSS compression of page aligned frames for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashCompressor.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_COMPRESSOR_H_
+#define DATAFLASH_COMPRESSOR_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_LZ Compression settings.
+ * @{
+ **/
+/**
+ * Number of bits of a back reference distance. The window (and the RAM
+ * used by the decompressor) is 1 << AT45_LZ_WINDOW_BITS bytes.
+ **/
+#define AT45_LZ_WINDOW_BITS 8
+/**
+ * Number of bits of a back reference length. The longest match is
+ * (1 << AT45_LZ_LENGTH_BITS) + 1 bytes.
+ **/
+#define AT45_LZ_LENGTH_BITS 4
+/**
+ * Size of the compressor output staging buffer. Compressed data is sent
+ * to the SRAM buffer by chunks of this size.
+ **/
+#define AT45_LZ_CHUNK_SIZE  32
+/**
+ * @}
+ **/
+
+/** Window size. **/
+#define AT45_LZ_WINDOW      (1 << AT45_LZ_WINDOW_BITS)
+/** Shortest back reference. **/
+#define AT45_LZ_MIN_MATCH   2
+/** Longest back reference. **/
+#define AT45_LZ_MAX_MATCH   ((1 << AT45_LZ_LENGTH_BITS) + AT45_LZ_MIN_MATCH - 1)
+/** Size of the frame header (raw length and compressed length). **/
+#define AT45_LZ_HEADER_SIZE 4
+
+/**
+ * Streaming LZSS compressor.
+ * Data is compressed into frames of one page. Each frame starts with an
+ * empty window, so any page can be decompressed on its own.
+ * A frame is programmed when the next token doesn't fit in the page,
+ * or on flush().
+ * @note Both SRAM buffers are used, their content is lost.
+ **/
+class DataFlashCompressor
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashCompressor(DataFlash &dataflash);
+
+        /**
+         * Start compressing to an area of the main memory.
+         * @param page First page of the area.
+         * @param count Number of pages of the area.
+         **/
+        void begin(uint16_t page, uint16_t count);
+
+        /**
+         * Compress data.
+         * @param data Data.
+         * @param length Data length in bytes.
+         * @return false if the area is full, or if a frame couldn't be
+         *         programmed because its page is in a protected sector.
+         *         The data is dropped.
+         **/
+        bool write(const void *data, uint16_t length);
+
+        /**
+         * Compress the pending data and program the current frame.
+         * The next data goes to a new frame.
+         * @return false if the frame couldn't be programmed because the
+         *         area is full or its page is in a protected sector.
+         **/
+        bool flush();
+
+        /** Page the current frame will be programmed to. **/
+        inline uint16_t page() const;
+
+        /** Number of bytes compressed. **/
+        inline uint32_t rawBytes() const;
+
+        /** Number of bytes programmed, frame headers included. **/
+        inline uint32_t compressedBytes() const;
+
+    private:
+        /** Compress one token from the pending data. **/
+        void encode();
+
+        /** Append bits to the frame. **/
+        void putBits(uint16_t value, uint8_t count);
+
+        /** Send the staged bytes to the SRAM buffer. **/
+        void sendChunk();
+
+        /**
+         * Program the current frame and start a new one.
+         * @return false if the frame couldn't be programmed.
+         **/
+        bool closeFrame();
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint16_t   m_page;          /**< Page of the current frame. **/
+        uint16_t   m_end;           /**< Page following the area. **/
+        uint8_t    m_buffer;        /**< SRAM buffer of the current frame. **/
+
+        uint8_t  m_ring[2*AT45_LZ_WINDOW];   /**< History and pending data. **/
+        uint16_t m_frameStart;      /**< Position of the frame first byte. **/
+        uint16_t m_pos;             /**< Position of the next byte to compress. **/
+        uint16_t m_last;            /**< Position following the pending data. **/
+
+        uint8_t  m_out[AT45_LZ_CHUNK_SIZE];  /**< Output staging buffer. **/
+        uint8_t  m_outCount;        /**< Number of staged bytes. **/
+        uint16_t m_outOffset;       /**< SRAM buffer offset of the staged bytes. **/
+        uint8_t  m_bits;            /**< Pending output bits. **/
+        uint8_t  m_bitCount;        /**< Number of pending output bits. **/
+        uint16_t m_frameBits;       /**< Number of bits of the frame. **/
+        uint16_t m_frameRaw;        /**< Number of bytes compressed in the frame. **/
+
+        uint32_t m_rawBytes;        /**< Number of bytes compressed. **/
+        uint32_t m_compressedBytes; /**< Number of bytes programmed. **/
+};
+
+/**
+ * LZSS frame decompressor.
+ **/
+class DataFlashDecompressor
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashDecompressor(DataFlash &dataflash);
+
+        /**
+         * Uncompressed length of a frame.
+         * @param page Frame page.
+         * @return Length in bytes, or -1 if the page doesn't hold a frame.
+         **/
+        int16_t frameLength(uint16_t page);
+
+        /**
+         * Decompress a part of a frame.
+         * @param page Frame page.
+         * @param offset Offset in the uncompressed data.
+         * @param data Destination buffer.
+         * @param length Number of bytes to decompress.
+         * @return Number of bytes decompressed, or -1 if the page doesn't
+         *         hold a frame.
+         **/
+        int16_t read(uint16_t page, uint16_t offset, void *data, uint16_t length);
+
+    private:
+        /**
+         * Read the frame header. The page read is left open.
+         * @return Uncompressed length, or -1 if the page doesn't hold a
+         *         frame.
+         **/
+        int16_t open(uint16_t page);
+
+        /** Read bits from the frame. **/
+        uint16_t getBits(uint8_t count);
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint8_t    m_window[AT45_LZ_WINDOW];    /**< Decompressed data history. **/
+        uint8_t    m_bits;          /**< Pending input bits. **/
+        uint8_t    m_bitCount;      /**< Number of pending input bits. **/
+};
+
+/** Page the current frame will be programmed to. **/
+inline uint16_t DataFlashCompressor::page() const
+{
+    return m_page;
+}
+
+/** Number of bytes compressed. **/
+inline uint32_t DataFlashCompressor::rawBytes() const
+{
+    return m_rawBytes;
+}
+
+/** Number of bytes programmed, frame headers included. **/
+inline uint32_t DataFlashCompressor::compressedBytes() const
+{
+    return m_compressedBytes;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_COMPRESSOR_H_ */
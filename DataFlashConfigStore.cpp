@@ -0,0 +1,275 @@
+/**************************************************************************//**
+ * @file DataFlashConfigStore.cpp
+ * @brief Double slot configuration store for the AT45DBxxxD Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Slot layout (little endian): magic (2 bytes), version (4 bytes), length
+ * (2 bytes), CRC-16 of the version, length and configuration (2 bytes),
+ * configuration, 0xff up to the end of the page.
+ * Loading reads the header of each slot, then the configuration of the
+ * newest one. If its CRC doesn't match, the other slot is used.
+ * Saving writes the whole page to the SRAM buffer with the header of the
+ * newest slot, and compares it on chip with that slot. If they're equal,
+ * nothing is programmed. Otherwise the header is patched with the next
+ * version and the buffer is programmed to the other slot.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashConfigStore.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Slot magic number. **/
+#define AT45_CONFIG_MAGIC       0x4643
+/** Size of the slot header. **/
+#define AT45_CONFIG_HEADER_SIZE 10
+
+/** CRC of the version, length and configuration. **/
+static uint16_t configCrc(uint32_t version, uint16_t length, const uint8_t *data)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+    for(uint8_t i=0; i<4; i++)
+    {
+        crc = dataflashCrc16(crc, (uint8_t)(version >> (8*i)));
+    }
+    crc = dataflashCrc16(crc, length & 0xff);
+    crc = dataflashCrc16(crc, length >> 8);
+    return dataflashCrc16(crc, data, length);
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param bufferNum SRAM buffer used for saves (0 or 1).
+ **/
+DataFlashConfigStore::DataFlashConfigStore(DataFlash &dataflash, uint8_t bufferNum)
+    : m_dataflash(dataflash)
+    , m_bufferNum(bufferNum)
+    , m_slot(1)
+    , m_version(0)
+{
+    m_block[0] = 0;
+    m_block[1] = 1;
+}
+
+/**
+ * Set the slots location.
+ * @param blockA Block of the first slot.
+ * @param blockB Block of the second slot.
+ **/
+void DataFlashConfigStore::begin(uint16_t blockA, uint16_t blockB)
+{
+    m_block[0] = blockA;
+    m_block[1] = blockB;
+
+    /* Find the newest valid slot now, so that a save() without a prior
+     * load() doesn't overwrite it. Only the CRC is checked. */
+    load(0, 0);
+}
+
+/**
+ * Load the newest valid configuration.
+ * @param data Destination buffer.
+ * @param length Size of the destination buffer.
+ * @return Length of the stored configuration, or -1 if none is valid.
+ **/
+int16_t DataFlashConfigStore::load(void *data, uint16_t length)
+{
+    Header header[2];
+    bool valid[2];
+    valid[0] = readHeader(0, header[0]);
+    valid[1] = readHeader(1, header[1]);
+
+    /* Try the newest slot first. */
+    uint8_t first = 0;
+    if(valid[0] && valid[1])
+    {
+        first = ((int32_t)(header[1].version - header[0].version) > 0) ? 1 : 0;
+    }
+    else if(valid[1])
+    {
+        first = 1;
+    }
+
+    for(uint8_t i=0; i<2; i++)
+    {
+        uint8_t slot = first ^ i;
+        if(valid[slot] && readData(slot, header[slot], data, length))
+        {
+            m_slot    = slot;
+            m_version = header[slot].version;
+            return header[slot].length;
+        }
+    }
+
+    m_slot    = 1;
+    m_version = 0;
+    return -1;
+}
+
+/**
+ * Save a configuration to the slot not holding the newest one.
+ * @param data Configuration.
+ * @param length Configuration length in bytes.
+ * @return 1 if written, 0 if unchanged, -1 if too long, -2 if the slot
+ *         is in a protected sector.
+ **/
+int8_t DataFlashConfigStore::save(const void *data, uint16_t length)
+{
+    uint16_t pageSize = m_dataflash.pageSize();
+    if((length + AT45_CONFIG_HEADER_SIZE) > pageSize)
+    {
+        return -1;
+    }
+
+    const uint8_t *src = static_cast<const uint8_t*>(data);
+
+    /* Build the page as it would be stored in the newest slot. */
+    m_dataflash.bufferWrite(m_bufferNum, 0);
+    writeHeader(m_version, length, configCrc(m_version, length, src));
+    for(uint16_t i=0; i<length; i++)
+    {
+        m_dataflash.transfer(src[i]);
+    }
+    for(uint16_t i=length+AT45_CONFIG_HEADER_SIZE; i<pageSize; i++)
+    {
+        m_dataflash.transfer(0xff);
+    }
+    m_dataflash.disable();
+
+    if(m_version)
+    {
+        m_dataflash.waitUntilReady();
+        if(m_dataflash.isPageEqualBuffer(slotPage(m_slot), m_bufferNum))
+        {
+            return 0;
+        }
+    }
+
+    /* Patch the header and program the other slot. */
+    uint32_t version = m_version + 1;
+    uint8_t  slot    = m_slot ^ 1;
+    m_dataflash.waitUntilReady();
+    if(!m_dataflash.beginPageWriteThroughBuffer(slotPage(slot), 0, m_bufferNum))
+    {
+        return -2;
+    }
+    writeHeader(version, length, configCrc(version, length, src));
+    m_dataflash.disable();
+    m_dataflash.waitUntilReady();
+
+    m_slot    = slot;
+    m_version = version;
+    return 1;
+}
+
+/**
+ * Read a slot header.
+ * @return true if the magic number is valid.
+ **/
+bool DataFlashConfigStore::readHeader(uint8_t slot, Header &header)
+{
+    uint8_t raw[AT45_CONFIG_HEADER_SIZE];
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(slotPage(slot), 0);
+    memset(raw, 0xff, sizeof(raw));
+    m_dataflash.transfer(raw, sizeof(raw));
+    m_dataflash.disable();
+
+    header.version = (uint32_t)raw[2] | ((uint32_t)raw[3] << 8) |
+                     ((uint32_t)raw[4] << 16) | ((uint32_t)raw[5] << 24);
+    header.length  = raw[6] | ((uint16_t)raw[7] << 8);
+    header.crc     = raw[8] | ((uint16_t)raw[9] << 8);
+
+    return ((raw[0] | ((uint16_t)raw[1] << 8)) == AT45_CONFIG_MAGIC) &&
+           ((header.length + AT45_CONFIG_HEADER_SIZE) <= m_dataflash.pageSize());
+}
+
+/**
+ * Read and check the configuration of a slot.
+ * Data past the end of the destination buffer is only used for the CRC.
+ * @return true if the CRC matches.
+ **/
+bool DataFlashConfigStore::readData(uint8_t slot, const Header &header, void *data, uint16_t length)
+{
+    uint8_t *dst = static_cast<uint8_t*>(data);
+    uint16_t crc = AT45_CRC16_INIT;
+
+    for(uint8_t i=0; i<4; i++)
+    {
+        crc = dataflashCrc16(crc, (uint8_t)(header.version >> (8*i)));
+    }
+    crc = dataflashCrc16(crc, header.length & 0xff);
+    crc = dataflashCrc16(crc, header.length >> 8);
+
+    m_dataflash.pageRead(slotPage(slot), AT45_CONFIG_HEADER_SIZE);
+    for(uint16_t i=0; i<header.length; i++)
+    {
+        uint8_t value = m_dataflash.transfer(0xff);
+        crc = dataflashCrc16(crc, value);
+        if(i < length)
+        {
+            dst[i] = value;
+        }
+    }
+    m_dataflash.disable();
+
+    return (crc == header.crc);
+}
+
+/**
+ * Send a slot header.
+ **/
+void DataFlashConfigStore::writeHeader(uint32_t version, uint16_t length, uint16_t crc)
+{
+    m_dataflash.transfer(AT45_CONFIG_MAGIC & 0xff);
+    m_dataflash.transfer(AT45_CONFIG_MAGIC >> 8);
+    for(uint8_t i=0; i<4; i++)
+    {
+        m_dataflash.transfer((uint8_t)(version >> (8*i)));
+    }
+    m_dataflash.transfer(length & 0xff);
+    m_dataflash.transfer(length >> 8);
+    m_dataflash.transfer(crc & 0xff);
+    m_dataflash.transfer(crc >> 8);
+}
+
+/**
+ * @}
+ **/
@@ -0,0 +1,157 @@
+/**************************************************************************//**
+ * @file DataFlashConfigStore.h
+ * @brief Double slot configuration store for the AT45DBxxxD Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashConfigStore.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_CONFIG_STORE_H_
+#define DATAFLASH_CONFIG_STORE_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Configuration record kept in two slots (A/B).
+ * Each slot is the first page of a block, so the two copies never share
+ * an erase unit. Saves alternate between slots and carry an increasing
+ * version number and a CRC. If a save is interrupted, the other slot
+ * still holds the previous configuration.
+ * The configuration must fit in a page, minus a 10 bytes header.
+ * @note Saves go through the SRAM buffer given to the constructor, its
+ * content is lost.
+ **/
+class DataFlashConfigStore
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param bufferNum SRAM buffer used for saves (0 or 1).
+         **/
+        DataFlashConfigStore(DataFlash &dataflash, uint8_t bufferNum=0);
+
+        /**
+         * Set the slots location and find the newest valid configuration.
+         * The dataflash must be set up, as both slots are read.
+         * @param blockA Block of the first slot.
+         * @param blockB Block of the second slot.
+         **/
+        void begin(uint16_t blockA, uint16_t blockB);
+
+        /**
+         * Load the newest valid configuration.
+         * @param data Destination buffer (may be null if length is 0).
+         * @param length Size of the destination buffer. If the stored
+         *        configuration is longer, it's truncated.
+         * @return Length of the stored configuration, or -1 if no valid
+         *         configuration was found.
+         **/
+        int16_t load(void *data, uint16_t length);
+
+        /**
+         * Save a configuration to the slot not holding the newest one.
+         * Nothing is written if the configuration didn't change.
+         * @param data Configuration.
+         * @param length Configuration length in bytes.
+         * @return
+         *      - 1 if the configuration was written.
+         *      - 0 if it's unchanged.
+         *      - -1 if it's too long.
+         *      - -2 if the slot to write is in a protected sector.
+         *        Nothing is written, and the newest configuration is
+         *        still the previous one.
+         **/
+        int8_t save(const void *data, uint16_t length);
+
+        /** Version of the newest configuration (0 if none). **/
+        inline uint32_t version() const;
+
+    private:
+        /**
+         * Slot header.
+         **/
+        struct Header
+        {
+            uint32_t version;   /**< Configuration version. **/
+            uint16_t length;    /**< Configuration length. **/
+            uint16_t crc;       /**< CRC of the version, length and data. **/
+        };
+
+        /**
+         * Read a slot header.
+         * @return true if the magic number is valid.
+         **/
+        bool readHeader(uint8_t slot, Header &header);
+
+        /**
+         * Read and check the configuration of a slot.
+         * @return true if the CRC matches.
+         **/
+        bool readData(uint8_t slot, const Header &header, void *data, uint16_t length);
+
+        /**
+         * Send a slot header.
+         **/
+        void writeHeader(uint32_t version, uint16_t length, uint16_t crc);
+
+        /** First page of a slot. **/
+        inline uint16_t slotPage(uint8_t slot) const;
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint8_t    m_bufferNum;     /**< SRAM buffer used for saves. **/
+        uint16_t   m_block[2];      /**< Slot blocks. **/
+        uint8_t    m_slot;          /**< Slot holding the newest configuration. **/
+        uint32_t   m_version;       /**< Version of the newest configuration. **/
+};
+
+/** Version of the newest configuration (0 if none). **/
+inline uint32_t DataFlashConfigStore::version() const
+{
+    return m_version;
+}
+
+/** First page of a slot. **/
+inline uint16_t DataFlashConfigStore::slotPage(uint8_t slot) const
+{
+    return m_block[slot] << 3;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_CONFIG_STORE_H_ */
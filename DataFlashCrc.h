@@ -0,0 +1,85 @@
+/**************************************************************************//**
+ * @file DataFlashCrc.h
+ * @brief CRC helpers for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) used to check
+ * the integrity of the metadata stored in the main memory. It's computed
+ * bitwise in order to keep the code small and avoid a 512 bytes table.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_CRC_H_
+#define DATAFLASH_CRC_H_
+
+#include <inttypes.h>
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** CRC-16 initial value. **/
+#define AT45_CRC16_INIT 0xFFFF
+
+/**
+ * Update a CRC-16 with one byte.
+ * @param crc Current CRC value (AT45_CRC16_INIT for the first byte).
+ * @param data Data byte.
+ * @return Updated CRC value.
+ **/
+inline uint16_t dataflashCrc16(uint16_t crc, uint8_t data)
+{
+    crc ^= (uint16_t)data << 8;
+    for(uint8_t i=0; i<8; i++)
+    {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+/**
+ * Update a CRC-16 with a block of data.
+ * @param crc Current CRC value (AT45_CRC16_INIT for the first block).
+ * @param data Data.
+ * @param length Data length in bytes.
+ * @return Updated CRC value.
+ **/
+inline uint16_t dataflashCrc16(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    while(length--)
+    {
+        crc = dataflashCrc16(crc, *data++);
+    }
+    return crc;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_CRC_H_ */
@@ -0,0 +1,268 @@
+/**************************************************************************//**
+ * @file DataFlashDualLogger.cpp
+ * @brief Two chip logger hiding erase times for the AT45DBxxxD Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * A sector erase takes seconds on the largest parts (up to 5s on the
+ * AT45DB642D). With a single device, the logger would stop for that long
+ * each time it enters a new sector. With two devices, the erase of the next
+ * sector of one device runs while the other one is written, and finishes
+ * long before the current sector is full, unless the data rate exceeds a
+ * sector per erase time.
+ * The erase is only started once the previous page program of that device
+ * is over, so write() never waits for it.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashDualLogger.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Constructor.
+ * @param first First device.
+ * @param second Second device.
+ **/
+DataFlashDualLogger::DataFlashDualLogger(DataFlash &first, DataFlash &second)
+    : m_first(1)
+    , m_count(0)
+    , m_pendingErase(false)
+    , m_active(0)
+    , m_page(0)
+    , m_end(0)
+    , m_offset(0)
+    , m_buffer(0)
+    , m_maxStall(0)
+    , m_eraseStalls(0)
+{
+    m_device[0] = &first;
+    m_device[1] = &second;
+    m_sector[0] = m_sector[1] = 1;
+}
+
+/**
+ * Start logging.
+ * @param sector First sector of the log (on each device).
+ * @param count Number of sectors of the log (on each device).
+ * @return false if the first sector is protected on a device.
+ **/
+bool DataFlashDualLogger::begin(int8_t sector, int8_t count)
+{
+    m_first       = sector;
+    m_count       = count;
+    m_sector[0]   = sector;
+    m_sector[1]   = sector;
+    m_active      = 0;
+    m_offset      = 0;
+    m_buffer      = 0;
+    m_maxStall    = 0;
+    m_eraseStalls = 0;
+
+    m_device[0]->manualErase();
+    m_device[1]->manualErase();
+
+    /* The first device is needed right away, the second one will only be
+     * needed once the first sector is full. */
+    bool first  = m_device[0]->sectorErase(sector);
+    bool second = m_device[1]->sectorErase(sector);
+    m_pendingErase = false;
+    m_device[0]->waitUntilReady();
+
+    m_page = m_device[0]->sectorFirstPage(sector);
+    m_end  = m_page + m_device[0]->sectorPageCount(sector);
+
+    return first && second;
+}
+
+/**
+ * Log data.
+ * Only waits for the page program of the active device, or for the
+ * erase of the other one if it's not over when the current sector is
+ * full.
+ * @param data Data.
+ * @param length Data length in bytes.
+ * @return false if a page or a sector erase was refused because the
+ *         sector is protected. The full page is kept and programmed again
+ *         by the next call, the rest of the data is dropped.
+ **/
+bool DataFlashDualLogger::write(const void *data, uint16_t length)
+{
+    uint32_t start = micros();
+    const uint8_t *src = static_cast<const uint8_t*>(data);
+    bool done = true;
+
+    /* A refused erase is retried, and reported, by swap(). */
+    update();
+
+    while(length)
+    {
+        if(!nextPage())
+        {
+            done = false;
+            break;
+        }
+
+        DataFlash *device = m_device[m_active];
+        uint16_t count = device->pageSize() - m_offset;
+        if(count > length)
+        {
+            count = length;
+        }
+
+        device->bufferWrite(m_buffer, m_offset);
+        for(uint16_t i=0; i<count; i++)
+        {
+            device->transfer(src[i]);
+        }
+        device->disable();
+
+        src      += count;
+        length   -= count;
+        m_offset += count;
+    }
+    if(done)
+    {
+        done = nextPage();
+    }
+
+    uint32_t elapsed = micros() - start;
+    if(elapsed > m_maxStall)
+    {
+        m_maxStall = elapsed;
+    }
+    return done;
+}
+
+/**
+ * Start the pending erase if the inactive device is ready.
+ * @return false if the erase was refused because the sector is
+ *         protected. It stays pending.
+ **/
+bool DataFlashDualLogger::update()
+{
+    DataFlash *other = m_device[m_active ^ 1];
+    if(m_pendingErase && other->isReady())
+    {
+        if(!other->sectorErase(m_sector[m_active ^ 1]))
+        {
+            return false;
+        }
+        m_pendingErase = false;
+    }
+    return true;
+}
+
+/**
+ * Pad the current page with 0xff and program it.
+ * @return false if the page couldn't be programmed.
+ **/
+bool DataFlashDualLogger::flush()
+{
+    DataFlash *device = m_device[m_active];
+    if((m_offset != 0) && (m_offset < device->pageSize()))
+    {
+        device->bufferWrite(m_buffer, m_offset);
+        for(uint16_t i=m_offset; i<device->pageSize(); i++)
+        {
+            device->transfer(0xff);
+        }
+        device->disable();
+        m_offset = device->pageSize();
+    }
+    return nextPage();
+}
+
+/**
+ * Program the current page if it's full and move to the next one.
+ * Nothing moves when the program or the erase of the next sector is
+ * refused, so that it's tried again by the next call.
+ * @return false if the page couldn't be programmed or the next sector
+ *         couldn't be erased.
+ **/
+bool DataFlashDualLogger::nextPage()
+{
+    DataFlash *device = m_device[m_active];
+    if(m_offset == device->pageSize())
+    {
+        if(!device->bufferToPage(m_buffer, m_page))
+        {
+            return false;
+        }
+        m_offset  = 0;
+        m_buffer ^= 1;
+        ++m_page;
+    }
+    return (m_page < m_end) || swap();
+}
+
+/**
+ * Let the other device take the writes. The device that was active
+ * erases its next sector as soon as its last program is over.
+ * @return false if the erase of the other device was refused.
+ **/
+bool DataFlashDualLogger::swap()
+{
+    uint8_t other = m_active ^ 1;
+
+    /* Start the erase if it couldn't be done yet. */
+    if(m_pendingErase)
+    {
+        if(!m_device[other]->sectorErase(m_sector[other]))
+        {
+            return false;
+        }
+        m_pendingErase = false;
+    }
+    if(!m_device[other]->isReady())
+    {
+        ++m_eraseStalls;
+        m_device[other]->waitUntilReady();
+    }
+
+    m_sector[m_active] = nextSector(m_sector[m_active]);
+    m_pendingErase     = true;
+
+    m_active = other;
+    m_buffer = 0;
+    m_page   = m_device[other]->sectorFirstPage(m_sector[other]);
+    m_end    = m_page + m_device[other]->sectorPageCount(m_sector[other]);
+    return true;
+}
+
+/**
+ * @}
+ **/
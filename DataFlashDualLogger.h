@@ -0,0 +1,168 @@
+/**************************************************************************//**
+ * @file DataFlashDualLogger.h
+ * @brief Two chip logger hiding erase times for the AT45DBxxxD Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashDualLogger.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_DUAL_LOGGER_H_
+#define DATAFLASH_DUAL_LOGGER_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Circular logger spread over two %Dataflash devices.
+ * The log is written one sector at a time, alternating between the two
+ * devices: sector n of the first device, sector n of the second one,
+ * sector n+1 of the first one, and so on. While one device takes the
+ * writes, the other one erases the sector it will write next. Pages are
+ * then programmed without the built-in erase.
+ * @note Both devices are switched to manual erase. Their SRAM buffers
+ * are used by the logger.
+ **/
+class DataFlashDualLogger
+{
+    public:
+        /**
+         * Constructor.
+         * @param first First device.
+         * @param second Second device.
+         **/
+        DataFlashDualLogger(DataFlash &first, DataFlash &second);
+
+        /**
+         * Start logging. The first sector of the first device is erased
+         * before returning.
+         * @param sector First sector of the log (on each device).
+         * @param count Number of sectors of the log (on each device).
+         * @return false if the first sector is protected on a device.
+         **/
+        bool begin(int8_t sector, int8_t count);
+
+        /**
+         * Log data.
+         * @param data Data.
+         * @param length Data length in bytes.
+         * @return false if a page or a sector erase was refused because
+         *         the sector is protected. The rest of the data is dropped.
+         **/
+        bool write(const void *data, uint16_t length);
+
+        /**
+         * Start the pending erase if the device is ready. This should be
+         * called regularly (from loop() for example) when the log isn't
+         * written often.
+         * @return false if the erase was refused because the sector is
+         *         protected. It stays pending.
+         **/
+        bool update();
+
+        /**
+         * Pad the current page with 0xff and program it.
+         * @return false if the page couldn't be programmed.
+         **/
+        bool flush();
+
+        /** Device taking the writes (0 or 1). **/
+        inline uint8_t activeDevice() const;
+
+        /** Longest write() call (us). **/
+        inline uint32_t maxStall() const;
+
+        /** Number of times the erase of the next sector wasn't over when it was needed. **/
+        inline uint32_t eraseStalls() const;
+
+    private:
+        /**
+         * Program the current page if it's full and move to the next one.
+         * @return false if the page couldn't be programmed or the next
+         *         sector couldn't be erased.
+         **/
+        bool nextPage();
+
+        /**
+         * Let the other device take the writes.
+         * @return false if the erase of the other device was refused.
+         **/
+        bool swap();
+
+        /** Next sector of the log. **/
+        inline int8_t nextSector(int8_t sector) const;
+
+    private:
+        DataFlash *m_device[2];     /**< Devices. **/
+        int8_t     m_first;         /**< First sector of the log. **/
+        int8_t     m_count;         /**< Number of sectors of the log. **/
+        int8_t     m_sector[2];     /**< Sector being written or erased on each device. **/
+        bool       m_pendingErase;  /**< The inactive device has an erase to start. **/
+        uint8_t    m_active;        /**< Device taking the writes. **/
+        uint16_t   m_page;          /**< Current page. **/
+        uint16_t   m_end;           /**< Page following the current sector. **/
+        uint16_t   m_offset;        /**< Offset in the current page. **/
+        uint8_t    m_buffer;        /**< SRAM buffer of the current page. **/
+        uint32_t   m_maxStall;      /**< Longest write() call (us). **/
+        uint32_t   m_eraseStalls;   /**< Number of erase stalls. **/
+};
+
+/** Device taking the writes (0 or 1). **/
+inline uint8_t DataFlashDualLogger::activeDevice() const
+{
+    return m_active;
+}
+
+/** Longest write() call (us). **/
+inline uint32_t DataFlashDualLogger::maxStall() const
+{
+    return m_maxStall;
+}
+
+/** Number of erase stalls. **/
+inline uint32_t DataFlashDualLogger::eraseStalls() const
+{
+    return m_eraseStalls;
+}
+
+/** Next sector of the log. **/
+inline int8_t DataFlashDualLogger::nextSector(int8_t sector) const
+{
+    return (sector + 1 < m_first + m_count) ? (sector + 1) : m_first;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_DUAL_LOGGER_H_ */
@@ -0,0 +1,316 @@
+/**************************************************************************//**
+ * @file DataFlashImageReceiver.cpp
+ * @brief Production image receiver for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * * Factory programming of a whole image. The image format is shared with
+ *  * the extras/imagepack host tool:
+ *  * - header: magic (0x4d49), page size, first page, page count, CRC-16
+ *  *   of the 8 previous bytes, all 16 bits little endian values.
+ *  * - pages: page size bytes followed by their CRC-16.
+ *  *
+ *  * The host waits for AT45_IMAGE_ACK before sending each page, so the
+ *  * receiver never needs more than the SRAM buffers of the chip: bytes go
+ *  * straight from the stream to a buffer.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashImageReceiver.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Image header magic number. **/
+#define AT45_IMAGE_MAGIC        0x4d49
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param stream Stream the image is received from.
+ **/
+DataFlashImageReceiver::DataFlashImageReceiver(DataFlash &dataflash, Stream &stream)
+    : m_dataflash(dataflash)
+    , m_stream(stream)
+    , m_first(0)
+    , m_pages(0)
+    , m_erase(DataFlash::ERASE_AUTO)
+{}
+
+/**
+ * Receive and program an image.
+ * Page i is received while page i-1 is programmed. Page i-1 is then
+ * compared with its buffer before page i is programmed, and the host is
+ * asked for page i+1 right after.
+ * @return IMAGE_OK, or the reason of the failure.
+ **/
+int8_t DataFlashImageReceiver::receive()
+{
+    uint16_t count;
+
+    m_pages = 0;
+    m_erase = m_dataflash.eraseMode();
+    int8_t result = readHeader(count);
+    if(result != IMAGE_OK)
+    {
+        return finish(result);
+    }
+
+    if(!erase(m_first, count))
+    {
+        return finish(IMAGE_PROTECTED);
+    }
+    m_dataflash.manualErase();
+
+    uint8_t bufferNum = 0;
+    m_stream.write(AT45_IMAGE_ACK);
+    for(uint16_t i=0; i<count; i++)
+    {
+        result = readPage(bufferNum);
+        if(result != IMAGE_OK)
+        {
+            return finish(result);
+        }
+
+        if(i)
+        {
+            m_dataflash.waitUntilReady();
+            if(!m_dataflash.isPageEqualBuffer(m_first + i - 1, bufferNum ^ 1))
+            {
+                return finish(IMAGE_VERIFY_FAILED);
+            }
+        }
+
+        if(!m_dataflash.bufferToPage(bufferNum, m_first + i))
+        {
+            return finish(IMAGE_PROTECTED);
+        }
+        m_pages = i + 1;
+        if(m_pages < count)
+        {
+            m_stream.write(AT45_IMAGE_ACK);
+        }
+        bufferNum ^= 1;
+    }
+
+    if(count)
+    {
+        m_dataflash.waitUntilReady();
+        if(!m_dataflash.isPageEqualBuffer(m_first + count - 1, bufferNum ^ 1))
+        {
+            return finish(IMAGE_VERIFY_FAILED);
+        }
+    }
+    return finish(IMAGE_OK);
+}
+
+/**
+ * Read a byte from the stream.
+ * @param value Byte read.
+ * @return false on timeout.
+ **/
+bool DataFlashImageReceiver::readByte(uint8_t &value)
+{
+    uint32_t start = millis();
+    while(!m_stream.available())
+    {
+        if((millis() - start) >= AT45_IMAGE_TIMEOUT)
+        {
+            return false;
+        }
+    }
+    value = m_stream.read();
+    return true;
+}
+
+/**
+ * Read a 16 bits little endian value from the stream.
+ * @param value Value read.
+ * @return false on timeout.
+ **/
+bool DataFlashImageReceiver::read16(uint16_t &value)
+{
+    uint8_t lo, hi;
+    if(!readByte(lo) || !readByte(hi))
+    {
+        return false;
+    }
+    value = lo | ((uint16_t)hi << 8);
+    return true;
+}
+
+/**
+ * Read the image header.
+ * @param count Number of pages of the image.
+ * @return IMAGE_OK, or the reason of the failure.
+ **/
+int8_t DataFlashImageReceiver::readHeader(uint16_t &count)
+{
+    uint16_t field[5];
+    for(uint8_t i=0; i<5; i++)
+    {
+        if(!read16(field[i]))
+        {
+            return IMAGE_TIMEOUT;
+        }
+    }
+
+    uint16_t crc = AT45_CRC16_INIT;
+    for(uint8_t i=0; i<4; i++)
+    {
+        crc = dataflashCrc16(crc, field[i] & 0xff);
+        crc = dataflashCrc16(crc, field[i] >> 8);
+    }
+    if((field[0] != AT45_IMAGE_MAGIC) || (field[4] != crc))
+    {
+        return IMAGE_BAD_HEADER;
+    }
+
+    m_first = field[2];
+    count   = field[3];
+    if((field[1] != m_dataflash.pageSize()) ||
+       ((uint32_t)m_first + count > m_dataflash.pageCount()))
+    {
+        return IMAGE_BAD_GEOMETRY;
+    }
+    return IMAGE_OK;
+}
+
+/**
+ * Receive a page into a SRAM buffer.
+ * @param bufferNum Buffer (0 or 1).
+ * @return IMAGE_OK, IMAGE_TIMEOUT or IMAGE_BAD_CRC.
+ **/
+int8_t DataFlashImageReceiver::readPage(uint8_t bufferNum)
+{
+    uint16_t size = m_dataflash.pageSize();
+    uint16_t crc  = AT45_CRC16_INIT;
+    uint8_t  value;
+
+    /* The chip stays selected while waiting for the host. Nothing else
+     * uses it during the transfer. */
+    m_dataflash.bufferWrite(bufferNum, 0);
+    for(uint16_t i=0; i<size; i++)
+    {
+        if(!readByte(value))
+        {
+            m_dataflash.disable();
+            return IMAGE_TIMEOUT;
+        }
+        m_dataflash.transfer(value);
+        crc = dataflashCrc16(crc, value);
+    }
+    m_dataflash.disable();
+
+    uint16_t expected;
+    if(!read16(expected))
+    {
+        return IMAGE_TIMEOUT;
+    }
+    return (expected == crc) ? IMAGE_OK : IMAGE_BAD_CRC;
+}
+
+/**
+ * Erase a range of pages with as few commands as possible: whole
+ * sectors, then whole blocks, then single pages at the edges.
+ * @param page First page.
+ * @param count Number of pages.
+ * @return false if a page of the range is protected.
+ **/
+bool DataFlashImageReceiver::erase(uint16_t page, uint16_t count)
+{
+    uint32_t end = (uint32_t)page + count;
+    while(page < end)
+    {
+        int8_t sector = m_dataflash.pageToSector(page);
+        uint16_t sectorPages = m_dataflash.sectorPageCount(sector);
+        bool done;
+
+        if((page == m_dataflash.sectorFirstPage(sector)) && ((uint32_t)page + sectorPages <= end))
+        {
+            done  = m_dataflash.sectorErase(sector);
+            page += sectorPages;
+        }
+        else if(((page & 7) == 0) && ((uint32_t)page + 8 <= end))
+        {
+            done  = m_dataflash.blockErase(page >> 3);
+            page += 8;
+        }
+        else
+        {
+            done  = m_dataflash.pageErase(page);
+            page += 1;
+        }
+
+        if(!done)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Report the result to the host and restore the erase mode.
+ * @param result Result of receive().
+ * @return result.
+ **/
+int8_t DataFlashImageReceiver::finish(int8_t result)
+{
+    m_dataflash.waitUntilReady();
+    if(m_erase == DataFlash::ERASE_AUTO)
+    {
+        m_dataflash.autoErase();
+    }
+    else
+    {
+        m_dataflash.manualErase();
+    }
+
+    if(result == IMAGE_OK)
+    {
+        m_stream.write(AT45_IMAGE_DONE);
+    }
+    else
+    {
+        m_stream.write(AT45_IMAGE_NAK);
+        m_stream.write(result);
+    }
+    return result;
+}
+
+/**
+ * @}
+ **/
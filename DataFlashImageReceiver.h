@@ -0,0 +1,164 @@
+/**************************************************************************//**
+ * @file DataFlashImageReceiver.h
+ * @brief Production image receiver for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashImageReceiver.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_IMAGE_RECEIVER_H_
+#define DATAFLASH_IMAGE_RECEIVER_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+class Stream;
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_IMAGE_RECEIVER Image receiver settings.
+ * @{
+ **/
+/** Maximum time to wait for a byte from the host, in milliseconds. **/
+#define AT45_IMAGE_TIMEOUT      5000
+/** Sent to the host when the next page can be sent. **/
+#define AT45_IMAGE_ACK          '>'
+/** Sent to the host, followed by the error code, when programming fails. **/
+#define AT45_IMAGE_NAK          '!'
+/** Sent to the host when the whole image is programmed and verified. **/
+#define AT45_IMAGE_DONE         '#'
+/**
+ * @}
+ **/
+
+/**
+ * Receive an image built by extras/imagepack and program it.
+ * The image starts with a header (magic, page size, first page, page
+ * count, CRC), followed by the pages, each with its CRC. The target range
+ * is erased first, then pages are programmed without erase. A page is
+ * received into one SRAM buffer while the previous one is programmed
+ * from the other buffer, then compared with the main memory on-chip.
+ * The host sends a page each time it gets AT45_IMAGE_ACK.
+ **/
+class DataFlashImageReceiver
+{
+    public:
+        /**
+         * Result of receive().
+         **/
+        enum result
+        {
+            IMAGE_OK = 0,           /**< Image programmed and verified. **/
+            IMAGE_TIMEOUT,          /**< The host stopped sending. **/
+            IMAGE_BAD_HEADER,       /**< Invalid header. **/
+            IMAGE_BAD_GEOMETRY,     /**< The image doesn't fit the device. **/
+            IMAGE_BAD_CRC,          /**< A page was corrupted on the way. **/
+            IMAGE_PROTECTED,        /**< The target range is protected. **/
+            IMAGE_VERIFY_FAILED     /**< A page doesn't match after programming. **/
+        };
+
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param stream Stream the image is received from (Serial for
+         *        example).
+         **/
+        DataFlashImageReceiver(DataFlash &dataflash, Stream &stream);
+
+        /**
+         * Receive and program an image.
+         * The erase mode of the device is restored when done.
+         * @note Both SRAM buffers are used, their content is lost.
+         * @return IMAGE_OK, or the reason of the failure.
+         **/
+        int8_t receive();
+
+        /** First page of the last image. **/
+        inline uint16_t firstPage() const;
+
+        /** Number of pages programmed by the last receive(). **/
+        inline uint16_t pages() const;
+
+    private:
+        /**
+         * Read a byte from the stream.
+         * @return false on timeout.
+         **/
+        bool readByte(uint8_t &value);
+
+        /** Read a 16 bits little endian value from the stream. **/
+        bool read16(uint16_t &value);
+
+        /** Read the image header. **/
+        int8_t readHeader(uint16_t &count);
+
+        /**
+         * Receive a page into a SRAM buffer.
+         * @return IMAGE_OK, IMAGE_TIMEOUT or IMAGE_BAD_CRC.
+         **/
+        int8_t readPage(uint8_t bufferNum);
+
+        /**
+         * Erase a range of pages with as few commands as possible.
+         * @return false if a page of the range is protected.
+         **/
+        bool erase(uint16_t page, uint16_t count);
+
+        /** Report the result to the host and restore the erase mode. **/
+        int8_t finish(int8_t result);
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        Stream    &m_stream;        /**< Image source. **/
+        uint16_t   m_first;         /**< First page of the image. **/
+        uint16_t   m_pages;         /**< Pages programmed. **/
+        DataFlash::erasemode m_erase;   /**< Erase mode before receive(). **/
+};
+
+/** First page of the last image. **/
+inline uint16_t DataFlashImageReceiver::firstPage() const
+{
+    return m_first;
+}
+
+/** Number of pages programmed by the last receive(). **/
+inline uint16_t DataFlashImageReceiver::pages() const
+{
+    return m_pages;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_IMAGE_RECEIVER_H_ */
@@ -48,6 +48,13 @@
 inline void DataFlash::enable()
 {
     digitalWrite(m_chipSelectPin, LOW);
+#ifdef AT45_USE_STATS
+    ++m_stats.selects;
+    m_statsCommand = true;
+#endif
+#ifdef AT45_USE_TRACE
+    trace(TRACE_SELECT);
+#endif
 }
 
 /**
@@ -56,6 +63,148 @@ inline void DataFlash::enable()
 inline void DataFlash::disable()
 {
     digitalWrite(m_chipSelectPin, HIGH);
+    m_streamOwner = 0;
+#ifdef AT45_USE_TRACE
+    trace(TRACE_DESELECT);
+#endif
+}
+
+/**
+ * Same as SPI.transfer(), but accounted in the statistics.
+ **/
+inline uint8_t DataFlash::transfer(uint8_t data)
+{
+#ifdef AT45_USE_STATS
+    statsTransfer(data);
+#endif
+#ifdef AT45_USE_TRACE
+    trace(data);
+#endif
+    return SPI.transfer(data);
+}
+
+/** Get the current modify hook. **/
+inline DataFlash::ModifyHook DataFlash::modifyHook() const
+{
+    return m_modifyHook;
+}
+
+/** Get the user data of the current modify hook. **/
+inline void *DataFlash::modifyHookContext() const
+{
+    return m_modifyHookContext;
+}
+
+/** Page size in bytes. **/
+inline uint16_t DataFlash::pageSize() const
+{
+    /* "Power of 2" pages use all the buffer address bits, standard pages
+     * hold 1/32 more bytes (264 = 256 + 8). */
+    if(m_bufferSize != m_infos[m_deviceIndex].bufferSize)
+    {
+        return 1 << m_bufferSize;
+    }
+    return (1 << (m_bufferSize - 1)) + (1 << (m_bufferSize - 6));
+}
+
+/** Number of pages of the main memory. **/
+inline uint16_t DataFlash::pageCount() const
+{
+    return 1 << m_pageSize;
+}
+
+/** Number of sectors (sectors 0a and 0b count as one). **/
+inline uint8_t DataFlash::sectorCount() const
+{
+    return 1 << m_sectorSize;
+}
+
+/**
+ * First page of a sector.
+ * Sector 0a holds the first 8 pages, sector 0b the rest of sector 0.
+ **/
+inline uint16_t DataFlash::sectorFirstPage(int8_t sector) const
+{
+    if(sector == AT45_SECTOR_0A)
+    {
+        return 0;
+    }
+    if(sector == AT45_SECTOR_0B)
+    {
+        return 8;
+    }
+    return (uint16_t)sector << (m_pageSize - m_sectorSize);
+}
+
+/** Number of pages of a sector. **/
+inline uint16_t DataFlash::sectorPageCount(int8_t sector) const
+{
+    if(sector == AT45_SECTOR_0A)
+    {
+        return 8;
+    }
+    if(sector == AT45_SECTOR_0B)
+    {
+        return (1 << (m_pageSize - m_sectorSize)) - 8;
+    }
+    return 1 << (m_pageSize - m_sectorSize);
+}
+
+/** Sector holding a page. **/
+inline int8_t DataFlash::pageToSector(uint16_t page) const
+{
+    int8_t sector = page >> (m_pageSize - m_sectorSize);
+    if((sector == 0) && (page < 8))
+    {
+        return AT45_SECTOR_0A;
+    }
+    return sector;
+}
+
+/**
+ * Same as SPI.transfer(buffer, count), but accounted in the statistics.
+ **/
+inline void DataFlash::transfer(void *buffer, size_t count)
+{
+#if defined(AT45_USE_STATS) || defined(AT45_USE_TRACE)
+    uint8_t *data = static_cast<uint8_t*>(buffer);
+    for(size_t i=0; i<count; i++)
+    {
+        data[i] = transfer(data[i]);
+    }
+#else
+    SPI.transfer(buffer, count);
+#endif
+}
+
+/**
+ * Mark the open stream as owned by the caller.
+ **/
+inline void DataFlash::claimStream(const void *owner)
+{
+    m_streamOwner = owner;
+}
+
+/**
+ * Owner of the open stream.
+ **/
+inline const void *DataFlash::streamOwner() const
+{
+    return m_streamOwner;
+}
+
+/**
+ * Current erase mode.
+ **/
+inline DataFlash::erasemode DataFlash::eraseMode() const
+{
+    return m_erase;
+}
+
+/** Get the SPI clock set by setClock() (0 if none). **/
+inline uint32_t DataFlash::clock() const
+{
+    return m_clock;
 }
 
 /** Get chip Select (CS) pin **/
@@ -76,6 +225,14 @@ inline int8_t DataFlash::writeProtectPin() const
     return m_writeProtectPin;
 }
 
+/**
+ * Return whether the device is in Deep Power-down.
+ **/
+inline bool DataFlash::isPoweredDown() const
+{
+    return (m_power == POWER_DOWN);
+}
+
 /**
  * Compute page address high byte.
  */
@@ -92,6 +249,99 @@ inline uint8_t DataFlash::pageToLoU8(uint16_t page) const
     return page << (m_bufferSize  - 8);
 }
 
+/**
+ * Tell if the operation in progress may still use a SRAM buffer.
+ * @param bufferNum Buffer (0 or 1).
+ **/
+inline bool DataFlash::isBufferBusy(uint8_t bufferNum) const
+{
+    return m_busyBuffers & bufferMask(bufferNum);
+}
+
+/**
+ * Bit mask of a SRAM buffer in m_busyBuffers.
+ **/
+inline uint8_t DataFlash::bufferMask(uint8_t bufferNum) const
+{
+    return bufferNum ? 0x02 : 0x01;
+}
+
+/**
+ * Stream data from the main memory to a sink, a chunk at a time.
+ * @param page Page of the main memory where the read starts.
+ * @param offset Starting byte address within the page.
+ * @param length Number of bytes to read.
+ * @param sink Data sink (copied).
+ * @return Number of bytes passed to the sink.
+ **/
+template <uint16_t CHUNK, typename Sink>
+uint32_t DataFlash::readTo(uint16_t page, uint16_t offset, uint32_t length, Sink sink)
+{
+    uint8_t chunk[CHUNK];
+    uint32_t done = 0;
+
+    waitUntilReady();
+    arrayRead(page, offset);
+    while(done < length)
+    {
+        uint16_t count = ((length - done) > CHUNK) ? CHUNK : (uint16_t)(length - done);
+        transfer(chunk, count);
+        done += count;
+        if(!sink(chunk, count))
+        {
+            break;
+        }
+    }
+    disable();
+
+    return done;
+}
+
+#ifdef AT45_USE_TRACE
+/**
+ * Record an event in the trace ring buffer.
+ * @param event Byte sent, TRACE_SELECT or TRACE_DESELECT.
+ **/
+inline void DataFlash::trace(uint16_t event)
+{
+    m_trace[m_traceNext] = event;
+    if(++m_traceNext >= AT45_TRACE_SIZE)
+    {
+        m_traceNext    = 0;
+        m_traceWrapped = true;
+    }
+}
+#endif
+
+/**
+ * Typical duration of an internal operation (us).
+ **/
+inline uint32_t DataFlash::typicalTime(uint8_t operation) const
+{
+    return (operation < TIMING_COUNT) ? m_typical[operation] : 0;
+}
+
+/**
+ * Remember the internal operation just started.
+ **/
+inline void DataFlash::startOperation(uint8_t operation)
+{
+    m_operation      = operation;
+    m_operationStart = micros();
+}
+
+/**
+ * Call the yield hook, if any.
+ * @param start Start of the wait (us).
+ **/
+inline void DataFlash::yieldWait(uint32_t start)
+{
+    if(m_yieldHook)
+    {
+        m_yieldHook(m_yieldHookContext, micros() - start);
+    }
+}
+
 /**
  * Same as waitUntilReady
  * @todo This method will be removed.
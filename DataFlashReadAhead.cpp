@@ -0,0 +1,181 @@
+/**************************************************************************//**
+ * @file DataFlashReadAhead.cpp
+ * @brief Double buffered sequential page scan for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Sequential scan alternating the two SRAM buffers. A page to buffer
+ * transfer takes up to 200us (t_XFR), during which the chip is busy. The
+ * buffer not involved in the transfer can still be read, so the next page
+ * is transferred while the current one is read from the other buffer.
+ * Buffer reads use the low frequency opcodes, which don't need a don't care
+ * byte.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashReadAhead.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashReadAhead::DataFlashReadAhead(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_page(0)
+    , m_offset(0)
+    , m_remaining(0)
+    , m_buffer(0)
+    , m_started(false)
+{}
+
+/**
+ * Start a scan. The transfer of the first page is started.
+ * @param page First page.
+ * @param count Number of pages.
+ **/
+void DataFlashReadAhead::begin(uint16_t page, uint16_t count)
+{
+    end();
+
+    m_page      = page;
+    m_offset    = 0;
+    m_remaining = count;
+    m_buffer    = 0;
+    m_started   = false;
+
+    if(count)
+    {
+        m_dataflash.pageToBuffer(m_page, m_buffer);
+    }
+}
+
+/**
+ * Move to the next page of the scan, starting the transfer of the
+ * following one into the other buffer.
+ * @return false if the scan is over.
+ **/
+bool DataFlashReadAhead::next()
+{
+    if(m_started && m_remaining)
+    {
+        --m_remaining;
+        ++m_page;
+        m_buffer ^= 1;
+    }
+    m_started = true;
+    m_offset  = 0;
+
+    end();
+    if(m_remaining == 0)
+    {
+        return false;
+    }
+
+    /* Only waits if reading the previous page was faster than the
+     * transfer of this one. */
+    m_dataflash.waitUntilReady();
+
+    if(m_remaining > 1)
+    {
+        m_dataflash.pageToBuffer(m_page + 1, m_buffer ^ 1);
+    }
+    return true;
+}
+
+/**
+ * Read data from the current page.
+ * @param buffer Destination buffer.
+ * @param length Number of bytes to read.
+ **/
+void DataFlashReadAhead::read(void *buffer, uint16_t length)
+{
+    open();
+
+    memset(buffer, 0xff, length);
+    m_dataflash.transfer(buffer, length);
+
+    m_offset = (m_offset + length) % m_dataflash.pageSize();
+}
+
+/**
+ * Read a byte from the current page.
+ * @return Byte read.
+ **/
+uint8_t DataFlashReadAhead::read()
+{
+    open();
+
+    uint8_t data = m_dataflash.transfer(0xff);
+
+    if(++m_offset >= m_dataflash.pageSize())
+    {
+        m_offset = 0;
+    }
+    return data;
+}
+
+/**
+ * Stop the scan and deselect the chip.
+ **/
+void DataFlashReadAhead::end()
+{
+    if(m_dataflash.streamOwner() == this)
+    {
+        m_dataflash.disable();
+    }
+}
+
+/**
+ * Make sure the buffer read is open at the current offset.
+ **/
+void DataFlashReadAhead::open()
+{
+    if(m_dataflash.streamOwner() == this)
+    {
+        return;
+    }
+
+    /* The transfer in progress uses the other buffer, this doesn't
+     * wait. */
+    m_dataflash.bufferRead(m_buffer, m_offset);
+    m_dataflash.claimStream(this);
+}
+
+/**
+ * @}
+ **/
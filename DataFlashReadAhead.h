@@ -0,0 +1,143 @@
+/**************************************************************************//**
+ * @file DataFlashReadAhead.h
+ * @brief Double buffered sequential page scan for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashReadAhead.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_READ_AHEAD_H_
+#define DATAFLASH_READ_AHEAD_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Sequential page scan through both SRAM buffers.
+ * While the application reads a page from one buffer, the next page is
+ * transferred into the other one. The page to buffer transfer time is
+ * hidden as long as reading a page takes longer than the transfer.
+ * @note Both SRAM buffers are used, their content is lost.
+ * @note Call end() (or any other %Dataflash command) before talking
+ * to another device on the SPI bus.
+ **/
+class DataFlashReadAhead
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashReadAhead(DataFlash &dataflash);
+
+        /**
+         * Start a scan. The transfer of the first page is started.
+         * @param page First page.
+         * @param count Number of pages.
+         **/
+        void begin(uint16_t page, uint16_t count);
+
+        /**
+         * Move to the next page of the scan, starting the transfer of
+         * the following one. The first call moves to the first page.
+         * @return false if the scan is over.
+         **/
+        bool next();
+
+        /**
+         * Read data from the current page. Reading past the end of the
+         * page wraps around to its beginning.
+         * @param buffer Destination buffer.
+         * @param length Number of bytes to read.
+         **/
+        void read(void *buffer, uint16_t length);
+
+        /**
+         * Read a byte from the current page.
+         * @return Byte read.
+         **/
+        uint8_t read();
+
+        /**
+         * Stop the scan and deselect the chip.
+         **/
+        void end();
+
+        /** Current page. **/
+        inline uint16_t page() const;
+
+        /** Current byte offset within the page. **/
+        inline uint16_t offset() const;
+
+        /** SRAM buffer holding the current page. **/
+        inline uint8_t buffer() const;
+
+    private:
+        /**
+         * Make sure the buffer read is open at the current offset.
+         **/
+        void open();
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint16_t   m_page;          /**< Current page. **/
+        uint16_t   m_offset;        /**< Current byte offset within the page. **/
+        uint16_t   m_remaining;     /**< Number of pages left, current one included. **/
+        uint8_t    m_buffer;        /**< SRAM buffer holding the current page. **/
+        bool       m_started;       /**< next() was called since begin(). **/
+};
+
+/** Current page. **/
+inline uint16_t DataFlashReadAhead::page() const
+{
+    return m_page;
+}
+
+/** Current byte offset within the page. **/
+inline uint16_t DataFlashReadAhead::offset() const
+{
+    return m_offset;
+}
+
+/** SRAM buffer holding the current page. **/
+inline uint8_t DataFlashReadAhead::buffer() const
+{
+    return m_buffer;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_READ_AHEAD_H_ */
@@ -0,0 +1,262 @@
+/**************************************************************************//**
+ * @file DataFlashReadCache.cpp
+ * @brief LRU read cache for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * * Random reads of a few bytes are dominated by the command, address and
+ *  * dummy bytes sent for each access. This cache keeps recently read parts
+ *  * of pages in RAM, so repeated lookups don't use the SPI bus at all.
+ *  * It stays coherent with the main memory by chaining itself to the
+ *  * %Dataflash modify hook, which is notified by every program and erase
+ *  * function.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashReadCache.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Page number of an empty line. **/
+#define AT45_CACHE_EMPTY    0xffff
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashReadCache::DataFlashReadCache(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_previousHook(0)
+    , m_previousContext(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+    invalidate();
+}
+
+/**
+ * Empty the cache and start watching modify operations.
+ **/
+void DataFlashReadCache::begin()
+{
+    invalidate();
+    resetCounters();
+
+    m_previousHook    = m_dataflash.modifyHook();
+    m_previousContext = m_dataflash.modifyHookContext();
+    m_dataflash.setModifyHook(onModify, this);
+}
+
+/**
+ * Stop watching modify operations.
+ * The cache is emptied as it can't be kept coherent anymore.
+ **/
+void DataFlashReadCache::end()
+{
+    if((m_dataflash.modifyHook() == onModify) && (m_dataflash.modifyHookContext() == this))
+    {
+        m_dataflash.setModifyHook(m_previousHook, m_previousContext);
+    }
+    invalidate();
+}
+
+/**
+ * Read data from the main memory.
+ * @param page Page number.
+ * @param offset Offset in the page.
+ * @param data Destination.
+ * @param length Number of bytes to read. Reads continue on the next
+ *        page when the end of a page is reached.
+ **/
+void DataFlashReadCache::read(uint16_t page, uint16_t offset, void *data, uint16_t length)
+{
+    uint8_t *out = static_cast<uint8_t*>(data);
+    uint16_t pageSize = m_dataflash.pageSize();
+
+    while(length)
+    {
+        uint16_t start = offset - (offset % AT45_CACHE_LINE_SIZE);
+        uint8_t line = lookup(page, start);
+
+        uint16_t end = start + AT45_CACHE_LINE_SIZE;
+        if(end > pageSize)
+        {
+            end = pageSize;
+        }
+        uint16_t count = end - offset;
+        if(count > length)
+        {
+            count = length;
+        }
+
+        memcpy(out, m_data[line] + (offset - start), count);
+        out    += count;
+        length -= count;
+        offset += count;
+        if(offset >= pageSize)
+        {
+            offset = 0;
+            ++page;
+        }
+    }
+}
+
+/**
+ * Read a byte from the main memory.
+ * @param page Page number.
+ * @param offset Offset in the page.
+ * @return Byte value.
+ **/
+uint8_t DataFlashReadCache::read(uint16_t page, uint16_t offset)
+{
+    uint16_t start = offset - (offset % AT45_CACHE_LINE_SIZE);
+    return m_data[lookup(page, start)][offset - start];
+}
+
+/**
+ * Drop all the lines.
+ **/
+void DataFlashReadCache::invalidate()
+{
+    for(uint8_t i=0; i<AT45_CACHE_LINES; i++)
+    {
+        m_page[i]  = AT45_CACHE_EMPTY;
+        m_order[i] = i;
+    }
+}
+
+/**
+ * Drop the lines of a range of pages.
+ * @param page First page.
+ * @param count Number of pages.
+ **/
+void DataFlashReadCache::invalidate(uint16_t page, uint16_t count)
+{
+    for(uint8_t i=0; i<AT45_CACHE_LINES; i++)
+    {
+        if((m_page[i] != AT45_CACHE_EMPTY) && ((uint16_t)(m_page[i] - page) < count))
+        {
+            m_page[i] = AT45_CACHE_EMPTY;
+        }
+    }
+}
+
+/**
+ * Reset the hit and miss counters.
+ **/
+void DataFlashReadCache::resetCounters()
+{
+    m_hits   = 0;
+    m_misses = 0;
+}
+
+/**
+ * %Dataflash modify hook.
+ * @param context Read cache.
+ * @param operation Combination of OPERATION_PROGRAM and OPERATION_ERASE.
+ * @param page First page affected.
+ * @param count Number of pages affected.
+ **/
+void DataFlashReadCache::onModify(void *context, uint8_t operation, uint16_t page, uint16_t count)
+{
+    DataFlashReadCache *cache = static_cast<DataFlashReadCache*>(context);
+
+    if(cache->m_previousHook)
+    {
+        cache->m_previousHook(cache->m_previousContext, operation, page, count);
+    }
+
+    cache->invalidate(page, count);
+}
+
+/**
+ * Find or load a line.
+ * On a miss, the least recently used line is replaced.
+ * @param page Page number.
+ * @param start Offset of the line in the page.
+ * @return Line index.
+ **/
+uint8_t DataFlashReadCache::lookup(uint16_t page, uint16_t start)
+{
+    uint8_t position;
+    for(position=0; position<AT45_CACHE_LINES; position++)
+    {
+        uint8_t line = m_order[position];
+        if((m_page[line] == page) && (m_start[line] == start))
+        {
+            ++m_hits;
+            touch(position);
+            return line;
+        }
+    }
+
+    ++m_misses;
+    position = AT45_CACHE_LINES - 1;
+    uint8_t line = m_order[position];
+
+    uint16_t count = m_dataflash.pageSize() - start;
+    if(count > AT45_CACHE_LINE_SIZE)
+    {
+        count = AT45_CACHE_LINE_SIZE;
+    }
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.arrayRead(page, start);
+    m_dataflash.transfer(m_data[line], count);
+    m_dataflash.disable();
+
+    m_page[line]  = page;
+    m_start[line] = start;
+    touch(position);
+    return line;
+}
+
+/**
+ * Move a line to the front of the LRU order.
+ * @param position Position of the line in the LRU order.
+ **/
+void DataFlashReadCache::touch(uint8_t position)
+{
+    uint8_t line = m_order[position];
+    for(; position>0; position--)
+    {
+        m_order[position] = m_order[position-1];
+    }
+    m_order[0] = line;
+}
+
+/**
+ * @}
+ **/
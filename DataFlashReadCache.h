@@ -0,0 +1,163 @@
+/**************************************************************************//**
+ * @file DataFlashReadCache.h
+ * @brief LRU read cache for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashReadCache.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_READ_CACHE_H_
+#define DATAFLASH_READ_CACHE_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_READ_CACHE Read cache settings.
+ * @{
+ **/
+/**
+ * Number of cache lines (255 at most).
+ **/
+#define AT45_CACHE_LINES        8
+/**
+ * Size of a cache line in bytes. Lines are aligned on this size within
+ * a page. The cache costs AT45_CACHE_LINES * (AT45_CACHE_LINE_SIZE + 5)
+ * bytes of RAM.
+ **/
+#define AT45_CACHE_LINE_SIZE    64
+/**
+ * @}
+ **/
+
+/**
+ * Main memory read cache with LRU replacement.
+ * Lines are filled with continuous array reads. The cache watches every
+ * program and erase operation through the %Dataflash modify hook, and
+ * drops the lines of the modified pages.
+ **/
+class DataFlashReadCache
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashReadCache(DataFlash &dataflash);
+
+        /**
+         * Empty the cache and start watching modify operations.
+         **/
+        void begin();
+
+        /**
+         * Stop watching modify operations.
+         **/
+        void end();
+
+        /**
+         * Read data from the main memory.
+         * @param page Page number.
+         * @param offset Offset in the page.
+         * @param data Destination.
+         * @param length Number of bytes to read, may span several pages.
+         **/
+        void read(uint16_t page, uint16_t offset, void *data, uint16_t length);
+
+        /**
+         * Read a byte from the main memory.
+         * @param page Page number.
+         * @param offset Offset in the page.
+         **/
+        uint8_t read(uint16_t page, uint16_t offset);
+
+        /** Drop all the lines. **/
+        void invalidate();
+
+        /** Drop the lines of a range of pages. **/
+        void invalidate(uint16_t page, uint16_t count);
+
+        /** Number of line lookups served from RAM. **/
+        inline uint32_t hits() const;
+
+        /** Number of line lookups that read the %Dataflash. **/
+        inline uint32_t misses() const;
+
+        /** Reset the hit and miss counters. **/
+        void resetCounters();
+
+    private:
+        /** %Dataflash modify hook. **/
+        static void onModify(void *context, uint8_t operation, uint16_t page, uint16_t count);
+
+        /**
+         * Find or load a line.
+         * @return Line index.
+         **/
+        uint8_t lookup(uint16_t page, uint16_t start);
+
+        /** Move a line to the front of the LRU order. **/
+        void touch(uint8_t position);
+
+    private:
+        DataFlash &m_dataflash;         /**< %Dataflash device. **/
+
+        DataFlash::ModifyHook m_previousHook;   /**< Modify hook to chain. **/
+        void      *m_previousContext;   /**< User data of the chained hook. **/
+
+        uint16_t m_page[AT45_CACHE_LINES];      /**< Page of each line. **/
+        uint16_t m_start[AT45_CACHE_LINES];     /**< Offset of each line. **/
+        uint8_t  m_order[AT45_CACHE_LINES];     /**< Lines, most recently used first. **/
+        uint8_t  m_data[AT45_CACHE_LINES][AT45_CACHE_LINE_SIZE];  /**< Line data. **/
+
+        uint32_t m_hits;                /**< Lookups served from RAM. **/
+        uint32_t m_misses;              /**< Lookups that read the device. **/
+};
+
+/** Number of line lookups served from RAM. **/
+inline uint32_t DataFlashReadCache::hits() const
+{
+    return m_hits;
+}
+
+/** Number of line lookups that read the %Dataflash. **/
+inline uint32_t DataFlashReadCache::misses() const
+{
+    return m_misses;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_READ_CACHE_H_ */
@@ -0,0 +1,173 @@
+/**************************************************************************//**
+ * @file DataFlashReader.cpp
+ * @brief Sequential read cursor for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * DataFlash::arrayRead() leaves the chip selected, and the data keeps
+ * flowing for as long as clocks are sent. Sending the opcode and the 3
+ * address bytes for every chunk of a large blob is a waste of bus time.
+ * The reader uses DataFlash::claimStream() to know whether its stream is
+ * still open: any other command deselects the chip and clears the claim.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashReader.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashReader::DataFlashReader(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_page(0)
+    , m_offset(0)
+{}
+
+/**
+ * Move the cursor.
+ * The stream is only re-addressed if the position actually changes.
+ * @param page Page number.
+ * @param offset Byte offset within the page.
+ **/
+void DataFlashReader::seek(uint16_t page, uint16_t offset)
+{
+    if((page != m_page) || (offset != m_offset))
+    {
+        close();
+        m_page   = page;
+        m_offset = offset;
+    }
+}
+
+/**
+ * Read data at the cursor position and advance the cursor.
+ * @param buffer Destination buffer.
+ * @param length Number of bytes to read.
+ **/
+void DataFlashReader::read(void *buffer, uint16_t length)
+{
+    open();
+
+    memset(buffer, 0xff, length);
+    m_dataflash.transfer(buffer, length);
+
+    advance(length);
+}
+
+/**
+ * Read a byte at the cursor position and advance the cursor.
+ * @return Byte read.
+ **/
+uint8_t DataFlashReader::read()
+{
+    open();
+
+    uint8_t data = m_dataflash.transfer(0xff);
+
+    advance(1);
+    return data;
+}
+
+/**
+ * Skip data.
+ * Short skips are clocked through the open stream, long ones
+ * re-address it.
+ * @param length Number of bytes to skip.
+ **/
+void DataFlashReader::skip(uint32_t length)
+{
+    /* Re-addressing costs 4 bytes. */
+    if((length <= 4) && (m_dataflash.streamOwner() == this))
+    {
+        for(uint8_t i=0; i<length; i++)
+        {
+            m_dataflash.transfer(0xff);
+        }
+    }
+    else
+    {
+        close();
+    }
+    advance(length);
+}
+
+/**
+ * Deselect the chip, ending the continuous read.
+ **/
+void DataFlashReader::close()
+{
+    if(m_dataflash.streamOwner() == this)
+    {
+        m_dataflash.disable();
+    }
+}
+
+/**
+ * Make sure the continuous read is open at the cursor position.
+ **/
+void DataFlashReader::open()
+{
+    if(m_dataflash.streamOwner() == this)
+    {
+        return;
+    }
+
+    /* Reading the array while a program or an erase is running would
+     * return garbage. */
+    m_dataflash.waitUntilReady();
+    m_dataflash.arrayRead(m_page, m_offset);
+    m_dataflash.claimStream(this);
+}
+
+/**
+ * Advance the cursor, following the continuous read wrap around.
+ * @param length Number of bytes.
+ **/
+void DataFlashReader::advance(uint32_t length)
+{
+    uint16_t pageSize  = m_dataflash.pageSize();
+    uint16_t pageCount = m_dataflash.pageCount();
+
+    length  += m_offset;
+    m_page   = (m_page + (length / pageSize)) % pageCount;
+    m_offset = length % pageSize;
+}
+
+/**
+ * @}
+ **/
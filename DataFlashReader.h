@@ -0,0 +1,136 @@
+/**************************************************************************//**
+ * @file DataFlashReader.h
+ * @brief Sequential read cursor for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashReader.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_READER_H_
+#define DATAFLASH_READER_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Sequential read cursor.
+ * The cursor keeps the continuous array read opened by its last read()
+ * alive. As long as successive reads are contiguous and no other
+ * command deselected the chip in between, the data is clocked out
+ * directly, without sending the opcode and address again.
+ * Reading past the end of the last page wraps around to the first page.
+ * @note Call close() (or any other %Dataflash command) before talking
+ * to another device on the SPI bus.
+ **/
+class DataFlashReader
+{
+    public:
+        /**
+         * Constructor.
+         * The cursor is set to the beginning of the main memory.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashReader(DataFlash &dataflash);
+
+        /**
+         * Move the cursor.
+         * @param page Page number.
+         * @param offset Byte offset within the page.
+         **/
+        void seek(uint16_t page, uint16_t offset=0);
+
+        /**
+         * Read data at the cursor position and advance the cursor.
+         * @param buffer Destination buffer.
+         * @param length Number of bytes to read.
+         **/
+        void read(void *buffer, uint16_t length);
+
+        /**
+         * Read a byte at the cursor position and advance the cursor.
+         * @return Byte read.
+         **/
+        uint8_t read();
+
+        /**
+         * Skip data.
+         * @param length Number of bytes to skip.
+         **/
+        void skip(uint32_t length);
+
+        /**
+         * Deselect the chip, ending the continuous read.
+         **/
+        void close();
+
+        /** Current page. **/
+        inline uint16_t page() const;
+
+        /** Current byte offset within the page. **/
+        inline uint16_t offset() const;
+
+    private:
+        /**
+         * Make sure the continuous read is open at the cursor position.
+         **/
+        void open();
+
+        /**
+         * Advance the cursor.
+         * @param length Number of bytes.
+         **/
+        void advance(uint32_t length);
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint16_t   m_page;          /**< Current page. **/
+        uint16_t   m_offset;        /**< Current byte offset within the page. **/
+};
+
+/** Current page. **/
+inline uint16_t DataFlashReader::page() const
+{
+    return m_page;
+}
+
+/** Current byte offset within the page. **/
+inline uint16_t DataFlashReader::offset() const
+{
+    return m_offset;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_READER_H_ */
@@ -0,0 +1,289 @@
+/**************************************************************************//**
+ * @file DataFlashScheduler.cpp
+ * @brief Shared SPI bus scheduler for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * The %Dataflash spends most of its time programming or erasing pages
+ * internally. Polling the status register in a tight loop during that
+ * time starves the other devices sharing the SPI bus. This scheduler
+ * interleaves queued %Dataflash commands with the transactions of
+ * other bus clients according to their priority.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashScheduler.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param priority Bus priority of the %Dataflash (higher value means
+ *        higher priority).
+ **/
+DataFlashScheduler::DataFlashScheduler(DataFlash &dataflash, uint8_t priority)
+    : m_dataflash(dataflash)
+    , m_clientCount(1)
+    , m_head(0)
+    , m_count(0)
+    , m_written(0)
+    , m_busy(false)
+    , m_lastPoll(0)
+    , m_worst(0)
+{
+    /* The dataflash is a client without callback. */
+    m_clients[0].callback = 0;
+    m_clients[0].context  = 0;
+    m_clients[0].priority = priority;
+}
+
+/**
+ * Register a bus client.
+ * @param callback Client callback.
+ * @param context User data passed to the callback.
+ * @param priority Bus priority (higher value means higher priority).
+ * @return true if the client was added, false if there's no room left.
+ **/
+bool DataFlashScheduler::addClient(ClientCallback callback, void *context, uint8_t priority)
+{
+    if((callback == 0) || (m_clientCount > AT45_SCHEDULER_MAX_CLIENTS))
+    {
+        return false;
+    }
+
+    /* Keep the client list sorted by decreasing priority. Clients with
+     * the same priority are served in registration order. */
+    uint8_t i;
+    for(i=m_clientCount; (i > 0) && (m_clients[i-1].priority < priority); i--)
+    {
+        m_clients[i] = m_clients[i-1];
+    }
+    m_clients[i].callback = callback;
+    m_clients[i].context  = context;
+    m_clients[i].priority = priority;
+    ++m_clientCount;
+
+    return true;
+}
+
+/**
+ * Queue a %Dataflash command.
+ * @param command Command descriptor. The data pointed by command.data
+ *        must remain valid until completion.
+ * @return true if the command was queued, false if the queue is full.
+ **/
+bool DataFlashScheduler::submit(const Command &command)
+{
+    if(m_count >= AT45_SCHEDULER_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t tail = (m_head + m_count) % AT45_SCHEDULER_QUEUE_SIZE;
+    m_queue[tail] = command;
+    ++m_count;
+
+    return true;
+}
+
+/**
+ * Perform one scheduling step.
+ * Clients are offered the bus by decreasing priority. The first one
+ * actually using it ends the step.
+ * @return true if the bus was used during this step.
+ **/
+bool DataFlashScheduler::run()
+{
+    for(uint8_t i=0; i<m_clientCount; i++)
+    {
+        uint32_t start = micros();
+        bool used;
+
+        if(m_clients[i].callback)
+        {
+            used = m_clients[i].callback(m_clients[i].context);
+        }
+        else
+        {
+            used = serviceDataFlash();
+        }
+
+        if(used)
+        {
+            uint32_t elapsed = micros() - start;
+            if(elapsed > m_worst)
+            {
+                m_worst = elapsed;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Run the %Dataflash state machine.
+ * @return true if the bus was used.
+ **/
+bool DataFlashScheduler::serviceDataFlash()
+{
+    if(m_count == 0)
+    {
+        return false;
+    }
+
+    if(m_busy)
+    {
+        /* The chip is working on its own. Don't flood the bus with status
+         * reads, other clients may need it. */
+        uint32_t now = micros();
+        if((now - m_lastPoll) < AT45_SCHEDULER_POLL_DELAY)
+        {
+            return false;
+        }
+        m_lastPoll = now;
+
+        uint8_t status = m_dataflash.status();
+        if(status & AT45_READY)
+        {
+            Command &command = m_queue[m_head];
+
+            m_busy = false;
+            m_head = (m_head + 1) % AT45_SCHEDULER_QUEUE_SIZE;
+            --m_count;
+
+            if(command.done)
+            {
+                command.done(command.context, status);
+            }
+        }
+        return true;
+    }
+
+    issue(m_queue[m_head]);
+    return true;
+}
+
+/**
+ * Start the command at the head of the queue.
+ * Buffer writes are split into chunks of at most
+ * AT45_SCHEDULER_CHUNK_SIZE bytes. The other commands only send their
+ * opcode and address, and then let the chip work while the bus is
+ * released.
+ * Programs and erases refused because the sector is protected are
+ * completed right away with AT45_PROTECT as status.
+ * @param command Command at the head of the queue.
+ **/
+void DataFlashScheduler::issue(Command &command)
+{
+    bool accepted = true;
+
+    switch(command.operation)
+    {
+        case OP_BUFFER_WRITE:
+        {
+            uint16_t count = command.length - m_written;
+            if(count > AT45_SCHEDULER_CHUNK_SIZE)
+            {
+                count = AT45_SCHEDULER_CHUNK_SIZE;
+            }
+
+            m_dataflash.bufferWrite(command.bufferNum, command.offset + m_written);
+            for(uint16_t i=0; i<count; i++)
+            {
+                m_dataflash.transfer(command.data[m_written + i]);
+            }
+            m_dataflash.disable();
+
+            m_written += count;
+            if(m_written < command.length)
+            {
+                return;
+            }
+            m_written = 0;
+
+            /* Buffer writes are not internal operations, they're completed
+             * as soon as the last byte is sent. */
+            m_head = (m_head + 1) % AT45_SCHEDULER_QUEUE_SIZE;
+            --m_count;
+            if(command.done)
+            {
+                command.done(command.context, AT45_READY);
+            }
+            return;
+        }
+
+        case OP_BUFFER_TO_PAGE:
+            accepted = m_dataflash.bufferToPage(command.bufferNum, command.address);
+            break;
+
+        case OP_PAGE_TO_BUFFER:
+            m_dataflash.pageToBuffer(command.address, command.bufferNum);
+            break;
+
+        case OP_PAGE_ERASE:
+            accepted = m_dataflash.pageErase(command.address);
+            break;
+
+        case OP_BLOCK_ERASE:
+            accepted = m_dataflash.blockErase(command.address);
+            break;
+
+        case OP_SECTOR_ERASE:
+            accepted = m_dataflash.sectorErase(static_cast<int8_t>(command.address));
+            break;
+    }
+
+    if(!accepted)
+    {
+        /* Nothing was sent, the chip isn't busy. */
+        m_head = (m_head + 1) % AT45_SCHEDULER_QUEUE_SIZE;
+        --m_count;
+        if(command.done)
+        {
+            command.done(command.context, AT45_PROTECT);
+        }
+        return;
+    }
+
+    /* The bus is released. Completion is detected by polling. */
+    m_busy     = true;
+    m_lastPoll = micros();
+}
+
+/**
+ * @}
+ **/
@@ -0,0 +1,231 @@
+/**************************************************************************//**
+ * @file DataFlashScheduler.h
+ * @brief Shared SPI bus scheduler for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashScheduler.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_SCHEDULER_H_
+#define DATAFLASH_SCHEDULER_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_SCHEDULER Shared bus scheduler limits.
+ * @{
+ **/
+/** Maximum number of bus clients (the %Dataflash excluded). **/
+#define AT45_SCHEDULER_MAX_CLIENTS  4
+/** Maximum number of queued %Dataflash commands. **/
+#define AT45_SCHEDULER_QUEUE_SIZE   8
+/**
+ * Maximum number of bytes written to a SRAM buffer in a single bus
+ * transaction. This bounds the time the %Dataflash holds the bus.
+ **/
+#define AT45_SCHEDULER_CHUNK_SIZE   32
+/** Minimum delay between two status polls of a busy %Dataflash (in us). **/
+#define AT45_SCHEDULER_POLL_DELAY   100
+/**
+ * @}
+ **/
+
+/**
+ * Cooperative scheduler sharing the SPI bus between a %Dataflash and
+ * other devices.
+ * %Dataflash commands are queued as descriptors and executed in order.
+ * Each call to run() performs at most one short bus transaction for the
+ * highest priority client requesting the bus. While the %Dataflash is
+ * internally busy (program, erase, transfer) the bus is left to the
+ * other clients, and the status register is only polled when nobody
+ * with a higher priority needs the bus.
+ * The worst case bus wait of the highest priority client is therefore
+ * bounded by the longest single transaction of any client, which is
+ * reported by worstTransaction().
+ **/
+class DataFlashScheduler
+{
+    public:
+        /**
+         * Bus client callback.
+         * The callback must perform at most one short bus transaction
+         * (select, transfer a few bytes, deselect).
+         * @param context User data given to addClient().
+         * @return true if the bus was used, false if the client had
+         *         nothing to do.
+         **/
+        typedef bool (*ClientCallback)(void *context);
+
+        /**
+         * %Dataflash command completion callback.
+         * @param context User data given with the command.
+         * @param status %Dataflash status register at completion, or
+         *               AT45_PROTECT alone (AT45_READY cleared) if the
+         *               command was refused because the sector is
+         *               protected.
+         **/
+        typedef void (*DoneCallback)(void *context, uint8_t status);
+
+        /**
+         * @brief %Dataflash operations.
+         **/
+        enum Operation
+        {
+            OP_BUFFER_WRITE,        /**< Write data to a SRAM buffer. **/
+            OP_BUFFER_TO_PAGE,      /**< Program a page from a SRAM buffer. **/
+            OP_PAGE_TO_BUFFER,      /**< Transfer a page to a SRAM buffer. **/
+            OP_PAGE_ERASE,          /**< Erase a page. **/
+            OP_BLOCK_ERASE,         /**< Erase a block. **/
+            OP_SECTOR_ERASE         /**< Erase a sector. **/
+        };
+
+        /**
+         * @brief %Dataflash command descriptor.
+         **/
+        struct Command
+        {
+            uint8_t        operation;   /**< Operation (see Operation). **/
+            uint8_t        bufferNum;   /**< SRAM buffer (0 or 1). **/
+            uint16_t       address;     /**< Page, block or sector number. **/
+            uint16_t       offset;      /**< Buffer offset (OP_BUFFER_WRITE). **/
+            uint16_t       length;      /**< Data length (OP_BUFFER_WRITE). **/
+            const uint8_t *data;        /**< Data to write (OP_BUFFER_WRITE). **/
+            DoneCallback   done;        /**< Completion callback (optional). **/
+            void          *context;     /**< Completion callback user data. **/
+        };
+
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param priority Bus priority of the %Dataflash (higher value
+         *        means higher priority).
+         **/
+        DataFlashScheduler(DataFlash &dataflash, uint8_t priority=0);
+
+        /**
+         * Register a bus client.
+         * @param callback Client callback.
+         * @param context User data passed to the callback.
+         * @param priority Bus priority (higher value means higher priority).
+         * @return true if the client was added, false if there's no room left.
+         **/
+        bool addClient(ClientCallback callback, void *context, uint8_t priority);
+
+        /**
+         * Queue a %Dataflash command.
+         * @param command Command descriptor. The data pointed by
+         *        command.data must remain valid until completion.
+         * @return true if the command was queued, false if the queue is full.
+         **/
+        bool submit(const Command &command);
+
+        /**
+         * Perform one scheduling step.
+         * @return true if the bus was used during this step.
+         **/
+        bool run();
+
+        /**
+         * Return whether all the queued %Dataflash commands are completed.
+         **/
+        inline bool idle() const;
+
+        /** Number of queued %Dataflash commands. **/
+        inline uint8_t pending() const;
+
+        /** Longest bus transaction observed so far (in us). **/
+        inline uint32_t worstTransaction() const;
+
+    private:
+        /**
+         * Run the %Dataflash state machine.
+         * @return true if the bus was used.
+         **/
+        bool serviceDataFlash();
+
+        /** Start the command at the head of the queue. **/
+        void issue(Command &command);
+
+    private:
+        /**
+         * Bus client entry.
+         **/
+        struct Client
+        {
+            ClientCallback callback;    /**< Callback (0 for the %Dataflash). **/
+            void          *context;     /**< Callback user data. **/
+            uint8_t        priority;    /**< Bus priority. **/
+        };
+
+        DataFlash &m_dataflash;         /**< %Dataflash device. **/
+
+        Client  m_clients[AT45_SCHEDULER_MAX_CLIENTS+1];    /**< Clients sorted by decreasing priority. **/
+        uint8_t m_clientCount;          /**< Number of clients (%Dataflash included). **/
+
+        Command  m_queue[AT45_SCHEDULER_QUEUE_SIZE];        /**< Command ring buffer. **/
+        uint8_t  m_head;                /**< Index of the oldest command. **/
+        uint8_t  m_count;               /**< Number of queued commands. **/
+        uint16_t m_written;             /**< Bytes of the head command already written. **/
+
+        bool     m_busy;                /**< The head command is running inside the chip. **/
+        uint32_t m_lastPoll;            /**< Time of the last status poll (us). **/
+        uint32_t m_worst;               /**< Longest transaction (us). **/
+};
+
+/**
+ * Return whether all the queued %Dataflash commands are completed.
+ **/
+inline bool DataFlashScheduler::idle() const
+{
+    return (m_count == 0);
+}
+
+/** Number of queued %Dataflash commands. **/
+inline uint8_t DataFlashScheduler::pending() const
+{
+    return m_count;
+}
+
+/** Longest bus transaction observed so far (in us). **/
+inline uint32_t DataFlashScheduler::worstTransaction() const
+{
+    return m_worst;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_SCHEDULER_H_ */
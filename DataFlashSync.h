@@ -0,0 +1,403 @@
+/**************************************************************************//**
+ * @file DataFlashSync.h
+ * @brief Locked access to the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Commands like pageRead(), arrayRead() or bufferWrite() leave the chip
+ * selected until the caller is done with the data, and most operations
+ * are made of several SPI transactions. When several tasks share the
+ * %Dataflash, each of these sequences must run under a lock. This file
+ * provides a wrapper applying a lock policy to whole operations, and a
+ * session object holding the lock across an open-ended stream. The lock
+ * is only taken once the chip is ready: it's released between status
+ * polls, so that busy waits never hold it.
+ *
+ * Lock policies are classes with lock() and unlock() members:
+ * - DataFlashNoLock: single task, compiles to nothing.
+ * - DataFlashIsrLock: disables interrupts, for data shared with ISRs.
+ * - DataFlashMutexLock<Mutex>: any mutex type with lock() and unlock()
+ *   (std::mutex on a host, a small FreeRTOS semaphore wrapper on
+ *   target).
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_SYNC_H_
+#define DATAFLASH_SYNC_H_
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+#if defined(__arm__) && defined(__ARM_ARCH_PROFILE) && (__ARM_ARCH_PROFILE == 'M')
+/** Cortex-M core, interrupts are masked by PRIMASK. **/
+#define AT45_CORTEX_M
+#endif
+
+/**
+ * No locking, for single task applications.
+ **/
+struct DataFlashNoLock
+{
+    /** Does nothing. **/
+    inline void lock() {}
+    /** Does nothing. **/
+    inline void unlock() {}
+};
+
+/**
+ * Lock by disabling interrupts. The interrupt state (SREG on AVR,
+ * PRIMASK on Cortex-M) is saved by the outermost lock() and restored by
+ * the outermost unlock(), so the lock can be taken with interrupts
+ * already disabled. Elsewhere the state can't be read, and the outermost
+ * unlock() enables interrupts.
+ * @warning micros() and millis() don't run with interrupts disabled. A
+ *          Session must not wait for an operation it started: close it
+ *          and let the next one wait, with the lock released.
+ **/
+struct DataFlashIsrLock
+{
+#if defined(__AVR__)
+    typedef uint8_t State;
+#elif defined(AT45_CORTEX_M)
+    typedef uint32_t State;
+#else
+    typedef bool State;
+#endif
+
+    DataFlashIsrLock() : depth(0), state(0) {}
+
+    /** Disable interrupts, saving their state. **/
+    inline void lock()
+    {
+#if defined(__AVR__)
+        State saved = SREG;
+#elif defined(AT45_CORTEX_M)
+        State saved;
+        __asm__ volatile ("mrs %0, primask" : "=r" (saved));
+#else
+        State saved = true;
+#endif
+        noInterrupts();
+        if(depth++ == 0)
+        {
+            state = saved;
+        }
+    }
+
+    /** Restore the interrupt state when the outermost lock is released. **/
+    inline void unlock()
+    {
+        if(--depth == 0)
+        {
+#if defined(__AVR__)
+            SREG = state;
+#elif defined(AT45_CORTEX_M)
+            __asm__ volatile ("msr primask, %0" : : "r" (state) : "memory");
+#else
+            interrupts();
+#endif
+        }
+    }
+
+    uint8_t depth;  /**< Lock nesting depth. **/
+    State   state;  /**< Interrupt state before the outermost lock. **/
+};
+
+/**
+ * Lock with a mutex. Mutex is any class with lock() and unlock()
+ * members, std::mutex for example. For FreeRTOS, wrap a semaphore
+ * created with xSemaphoreCreateMutex() in lock() (xSemaphoreTake() with
+ * portMAX_DELAY) and unlock() (xSemaphoreGive()).
+ **/
+template <typename Mutex>
+struct DataFlashMutexLock
+{
+    /** Take the mutex. **/
+    inline void lock()
+    {
+        mutex.lock();
+    }
+
+    /** Release the mutex. **/
+    inline void unlock()
+    {
+        mutex.unlock();
+    }
+
+    Mutex mutex;    /**< Mutex. **/
+};
+
+/**
+ * %Dataflash shared between several tasks.
+ * Each member runs a whole operation under the lock: command, data and
+ * chip deselection. For anything else, or to keep the chip selected
+ * across several calls, open a Session.
+ * The SRAM buffers are shared too: a sequence using a buffer (page to
+ * buffer transfer, then buffer read) must run in a single session.
+ * The lock is taken once the chip is ready (or done with the buffer
+ * used), so operations don't wait while holding it. The status is polled
+ * with the lock released in between, at intervals doubling from
+ * AT45_POLL_MIN_INTERVAL to AT45_POLL_MAX_INTERVAL.
+ **/
+template <typename Lock>
+class DataFlashSync
+{
+    public:
+        /**
+         * Lock held for the lifetime of the object. The %Dataflash is
+         * reached through the session only, calling the members of the
+         * DataFlashSync object from a session deadlocks with a non
+         * recursive lock.
+         * The session starts once the chip is ready. Waiting for an
+         * operation started in the session holds the lock, and never
+         * ends with DataFlashIsrLock.
+         **/
+        class Session
+        {
+            public:
+                /**
+                 * Take the lock once the chip is ready.
+                 * @param sync Locked device.
+                 * @param bufferNum Only wait until the chip is done with
+                 *        this SRAM buffer (0 or 1), -1 for the whole chip.
+                 **/
+                explicit Session(DataFlashSync &sync, int8_t bufferNum = -1)
+                    : m_sync(sync)
+                {
+                    m_sync.acquire(bufferNum);
+                }
+
+                /** Release the lock. **/
+                ~Session()
+                {
+                    m_sync.m_lock.unlock();
+                }
+
+                /** %Dataflash device. **/
+                inline DataFlash &dataflash()
+                {
+                    return m_sync.m_dataflash;
+                }
+
+                /** %Dataflash device. **/
+                inline DataFlash *operator->()
+                {
+                    return &m_sync.m_dataflash;
+                }
+
+            private:
+                Session(const Session &);
+                Session &operator=(const Session &);
+
+                DataFlashSync &m_sync;  /**< Locked device. **/
+        };
+
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device. It must not be used
+         *        directly anymore.
+         **/
+        explicit DataFlashSync(DataFlash &dataflash)
+            : m_dataflash(dataflash)
+        {}
+
+        /** Lock policy object. **/
+        inline Lock &lock()
+        {
+            return m_lock;
+        }
+
+        /**
+         * Read from the main memory (continuous array read).
+         * @param page Page number.
+         * @param offset Offset in the page.
+         * @param data Destination.
+         * @param length Number of bytes.
+         **/
+        void read(uint16_t page, uint16_t offset, void *data, uint16_t length)
+        {
+            Session session(*this);
+            m_dataflash.waitUntilReady();
+            m_dataflash.arrayRead(page, offset);
+            m_dataflash.transfer(data, length);
+            m_dataflash.disable();
+        }
+
+        /**
+         * Read from a SRAM buffer.
+         * @param bufferNum Buffer (0 or 1).
+         * @param offset Offset in the buffer.
+         * @param data Destination.
+         * @param length Number of bytes.
+         **/
+        void bufferRead(uint8_t bufferNum, uint16_t offset, void *data, uint16_t length)
+        {
+            Session session(*this, bufferNum);
+            m_dataflash.bufferRead(bufferNum, offset);
+            m_dataflash.transfer(data, length);
+            m_dataflash.disable();
+        }
+
+        /**
+         * Write to a SRAM buffer.
+         * @param bufferNum Buffer (0 or 1).
+         * @param offset Offset in the buffer.
+         * @param data Data.
+         * @param length Number of bytes.
+         **/
+        void bufferWrite(uint8_t bufferNum, uint16_t offset, const void *data, uint16_t length)
+        {
+            Session session(*this, bufferNum);
+            const uint8_t *bytes = static_cast<const uint8_t*>(data);
+            m_dataflash.bufferWrite(bufferNum, offset);
+            for(uint16_t i=0; i<length; i++)
+            {
+                m_dataflash.transfer(bytes[i]);
+            }
+            m_dataflash.disable();
+        }
+
+        /** @see DataFlash::bufferToPage() **/
+        bool bufferToPage(uint8_t bufferNum, uint16_t page)
+        {
+            Session session(*this);
+            return m_dataflash.bufferToPage(bufferNum, page);
+        }
+
+        /** @see DataFlash::pageToBuffer() **/
+        void pageToBuffer(uint16_t page, uint8_t bufferNum)
+        {
+            Session session(*this);
+            m_dataflash.pageToBuffer(page, bufferNum);
+        }
+
+        /** @see DataFlash::pageErase() **/
+        bool pageErase(uint16_t page)
+        {
+            Session session(*this);
+            return m_dataflash.pageErase(page);
+        }
+
+        /** @see DataFlash::blockErase() **/
+        bool blockErase(uint16_t block)
+        {
+            Session session(*this);
+            return m_dataflash.blockErase(block);
+        }
+
+        /** @see DataFlash::sectorErase() **/
+        bool sectorErase(int8_t sector)
+        {
+            Session session(*this);
+            return m_dataflash.sectorErase(sector);
+        }
+
+        /**
+         * @see DataFlash::copyPages()
+         * Each transfer and program runs in its own session, so the lock
+         * is released while the chip works.
+         **/
+        bool copyPages(uint16_t src, uint16_t dst, uint16_t count)
+        {
+            bool backward = (dst > src) && ((dst - src) < count);
+            for(uint16_t i=0; i<count; i++)
+            {
+                uint16_t index = backward ? (count - 1 - i) : i;
+                {
+                    Session session(*this);
+                    session->pageToBuffer(src + index, 0);
+                }
+                Session session(*this);
+                if(!session->bufferToPage(0, dst + index))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /** @see DataFlash::waitUntilReady() **/
+        void waitUntilReady()
+        {
+            Session session(*this);
+        }
+
+        /** @see DataFlash::status() **/
+        uint8_t status()
+        {
+            Session session(*this);
+            return m_dataflash.status();
+        }
+
+    private:
+        /**
+         * Take the lock once the chip is ready, polling the status with
+         * the lock released in between.
+         * @param bufferNum Only wait until the chip is done with this
+         *        SRAM buffer (0 or 1), -1 for the whole chip.
+         **/
+        void acquire(int8_t bufferNum)
+        {
+            uint32_t interval = AT45_POLL_MIN_INTERVAL;
+            m_lock.lock();
+            while(((bufferNum < 0) ? (m_dataflash.isBufferBusy(0) || m_dataflash.isBufferBusy(1)) :
+                                     m_dataflash.isBufferBusy(bufferNum)) &&
+                  !m_dataflash.isReady())
+            {
+                m_lock.unlock();
+                /* Doesn't need interrupts, unlike micros(). */
+                delayMicroseconds(interval);
+                interval <<= 1;
+                if(interval > AT45_POLL_MAX_INTERVAL)
+                {
+                    interval = AT45_POLL_MAX_INTERVAL;
+                }
+                m_lock.lock();
+            }
+        }
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        Lock       m_lock;          /**< Lock policy. **/
+};
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_SYNC_H_ */
@@ -0,0 +1,574 @@
+/**************************************************************************//**
+ * @file DataFlashTimeSeries.cpp
+ * @brief Time series storage with page and sector summaries for the AT45DBxxxD
+ * Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * * Fixed size records are packed in pages, behind a header summarizing
+ *  * the page: sequence number, record count, first and last timestamps,
+ *  * per channel minimum and maximum, CRC. When a sector is full, its last
+ *  * page receives the same summary for the whole sector. As timestamps
+ *  * never decrease, a range query reads the sector summaries, looks for
+ *  * the first matching page of a sector with a binary search over the
+ *  * page headers, and only reads the records of the matching pages,
+ *  * instead of the whole memory.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashTimeSeries.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Data page magic number. **/
+#define AT45_TS_PAGE_MAGIC      0x5450
+/** Sector summary page magic number. **/
+#define AT45_TS_SECTOR_MAGIC    0x5453
+
+/** Send a 16 bits little endian value and update the CRC. **/
+static void put16(DataFlash &dataflash, uint16_t value, uint16_t &crc)
+{
+    dataflash.transfer(value & 0xff);
+    dataflash.transfer(value >> 8);
+    crc = dataflashCrc16(crc, value & 0xff);
+    crc = dataflashCrc16(crc, value >> 8);
+}
+
+/** Read a 16 bits little endian value and update the CRC. **/
+static uint16_t get16(DataFlash &dataflash, uint16_t &crc)
+{
+    uint8_t lo = dataflash.transfer(0xff);
+    uint8_t hi = dataflash.transfer(0xff);
+    crc = dataflashCrc16(crc, lo);
+    crc = dataflashCrc16(crc, hi);
+    return lo | ((uint16_t)hi << 8);
+}
+
+/** Send a 32 bits little endian value and update the CRC. **/
+static void put32(DataFlash &dataflash, uint32_t value, uint16_t &crc)
+{
+    put16(dataflash, value & 0xffff, crc);
+    put16(dataflash, value >> 16, crc);
+}
+
+/** Read a 32 bits little endian value and update the CRC. **/
+static uint32_t get32(DataFlash &dataflash, uint16_t &crc)
+{
+    uint32_t lo = get16(dataflash, crc);
+    uint32_t hi = get16(dataflash, crc);
+    return lo | (hi << 16);
+}
+
+/** Check if a summary overlaps a timestamp range. **/
+static inline bool overlaps(const DataFlashTimeSeries::Summary &summary, uint32_t from, uint32_t to)
+{
+    return (summary.first <= to) && (summary.last >= from);
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ **/
+DataFlashTimeSeries::DataFlashTimeSeries(DataFlash &dataflash)
+    : m_dataflash(dataflash)
+    , m_first(0)
+    , m_count(0)
+    , m_channels(0)
+    , m_perPage(0)
+    , m_sector(0)
+    , m_page(0)
+    , m_buffer(0)
+    , m_sequence(0)
+    , m_queryBytes(0)
+{
+    m_pageSummary.count   = 0;
+    m_sectorSummary.count = 0;
+}
+
+/**
+ * Find the end of the stored series and get ready to append.
+ * The newest complete sector is given by the sector summaries. The
+ * pages of the following sector are then checked until the sequence
+ * numbers stop following each other.
+ * @param sector First sector of the storage area (1 or above).
+ * @param count Number of sectors.
+ * @param channels Number of channels per record.
+ * @return false if the parameters are invalid, or if the area couldn't
+ *         be repaired because a sector is protected.
+ **/
+bool DataFlashTimeSeries::begin(int8_t sector, int8_t count, uint8_t channels)
+{
+    if((sector < 1) || (count < 1) || ((sector + count) > m_dataflash.sectorCount()) ||
+       (channels == 0) || (channels > AT45_TS_MAX_CHANNELS))
+    {
+        return false;
+    }
+
+    m_first    = sector;
+    m_count    = count;
+    m_channels = channels;
+    m_perPage  = (m_dataflash.pageSize() - headerSize()) / recordSize();
+    m_buffer   = 0;
+    m_pageSummary.count = 0;
+
+    Summary summary;
+    bool found = false;
+    uint32_t newest = 0;
+    int8_t current = m_first;
+    for(int8_t i=0; i<m_count; i++)
+    {
+        if(sectorSummary(m_first + i, summary) &&
+           (!found || ((int32_t)(summary.sequence - newest) > 0)))
+        {
+            found   = true;
+            newest  = summary.sequence;
+            current = m_first + ((i + 1) % m_count);
+        }
+    }
+
+    m_sector = current;
+    m_page   = m_dataflash.sectorFirstPage(current);
+    m_sectorSummary.count = 0;
+
+    uint32_t expected = newest + 1;
+    if(!found)
+    {
+        /* The first sector was never completed. */
+        expected = pageSummary(m_page, summary) ? summary.sequence : 0;
+    }
+
+    uint16_t last = summaryPage(current);
+    for(; m_page < last; m_page++)
+    {
+        if(!pageSummary(m_page, summary) || (summary.sequence != expected))
+        {
+            break;
+        }
+        merge(m_sectorSummary, summary);
+        m_sectorSummary.sequence = summary.sequence;
+        ++m_sectorSummary.count;
+        ++expected;
+    }
+    m_sequence = expected;
+
+    if(m_page == last)
+    {
+        /* The sector was filled but its summary was not written. */
+        if(!closeSector())
+        {
+            return false;
+        }
+    }
+    else if(m_sectorSummary.count == 0)
+    {
+        /* Remove the summary of the previous pass. */
+        if(!m_dataflash.pageErase(last))
+        {
+            return false;
+        }
+    }
+
+    m_queryBytes = 0;
+    return true;
+}
+
+/**
+ * Append a record.
+ * The record goes to the SRAM buffer of the current page, which is
+ * programmed once full.
+ * @param timestamp Timestamp, not lower than the previous one.
+ * @param values One value per channel.
+ * @return false if the record was dropped because the current page is
+ *         full and couldn't be programmed. The page is kept in the buffer
+ *         and programmed again by the next append() or flush().
+ **/
+bool DataFlashTimeSeries::append(uint32_t timestamp, const int16_t *values)
+{
+    if(((m_pageSummary.count >= m_perPage) || (m_page == summaryPage(m_sector))) &&
+       !closePage())
+    {
+        return false;
+    }
+
+    Summary record;
+    record.first = record.last = timestamp;
+    for(uint8_t i=0; i<m_channels; i++)
+    {
+        record.min[i] = record.max[i] = values[i];
+    }
+
+    uint16_t crc = AT45_CRC16_INIT;
+    m_dataflash.bufferWrite(m_buffer, headerSize() + m_pageSummary.count * recordSize());
+    put32(m_dataflash, timestamp, crc);
+    for(uint8_t i=0; i<m_channels; i++)
+    {
+        put16(m_dataflash, values[i], crc);
+    }
+    m_dataflash.disable();
+
+    merge(m_pageSummary, record);
+    if(++m_pageSummary.count >= m_perPage)
+    {
+        /* A failure is reported by the next call. */
+        closePage();
+    }
+    return true;
+}
+
+/**
+ * Program the current page, even if it's not full. The next records
+ * start a new page.
+ * @return false if a page couldn't be programmed.
+ **/
+bool DataFlashTimeSeries::flush()
+{
+    return closePage();
+}
+
+/**
+ * Find the records with a timestamp in a range.
+ * Sectors are visited from the oldest to the newest, so records are
+ * reported in chronological order.
+ * @warning The callback is called while the %Dataflash is being read.
+ *          It must not access the device.
+ * @param from First timestamp.
+ * @param to Last timestamp.
+ * @param callback Function called for each record.
+ * @param context User data passed to the callback.
+ * @return Number of records found.
+ **/
+uint32_t DataFlashTimeSeries::query(uint32_t from, uint32_t to, RecordCallback callback, void *context)
+{
+    uint32_t found = 0;
+    m_queryBytes = 0;
+
+    for(int8_t i=1; i<=m_count; i++)
+    {
+        int8_t sector = m_first + ((m_sector - m_first + i) % m_count);
+        uint16_t first = m_dataflash.sectorFirstPage(sector);
+        uint16_t end;
+
+        Summary summary;
+        if(sector == m_sector)
+        {
+            /* The current sector has no summary yet. */
+            end = m_page;
+        }
+        else if(sectorSummary(sector, summary) && overlaps(summary, from, to))
+        {
+            end = first + summary.count;
+        }
+        else
+        {
+            continue;
+        }
+
+        /* Pages are sorted. Look for the first one ending after from. */
+        uint16_t lo = first;
+        uint16_t hi = end;
+        while(lo < hi)
+        {
+            uint16_t mid = lo + (hi - lo) / 2;
+            if(pageSummary(mid, summary) && (summary.last < from))
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        for(uint16_t page=lo; page<end; page++)
+        {
+            if(!pageSummary(page, summary))
+            {
+                continue;
+            }
+            if(summary.first > to)
+            {
+                break;
+            }
+            found += scanPage(page, summary, from, to, callback, context);
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Read the summary of a sector.
+ * @param sector Sector number.
+ * @param summary Sector summary. Its count is the number of pages.
+ * @return false if the sector is not complete.
+ **/
+bool DataFlashTimeSeries::sectorSummary(int8_t sector, Summary &summary)
+{
+    return readSummary(summaryPage(sector), AT45_TS_SECTOR_MAGIC, summary);
+}
+
+/**
+ * Read the summary of a page.
+ * @param page Page number.
+ * @param summary Page summary.
+ * @return false if the page doesn't hold records.
+ **/
+bool DataFlashTimeSeries::pageSummary(uint16_t page, Summary &summary)
+{
+    return readSummary(page, AT45_TS_PAGE_MAGIC, summary);
+}
+
+/**
+ * Read a summary header.
+ * @param page Page number.
+ * @param magic Expected magic number.
+ * @param summary Summary.
+ * @return true if the header is valid.
+ **/
+bool DataFlashTimeSeries::readSummary(uint16_t page, uint16_t magic, Summary &summary)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.arrayRead(page, 0);
+    uint16_t pageMagic = get16(m_dataflash, crc);
+    uint16_t channels  = get16(m_dataflash, crc);
+    bool valid = (pageMagic == magic) && (channels == m_channels);
+    if(valid)
+    {
+        summary.sequence = get32(m_dataflash, crc);
+        summary.count    = get16(m_dataflash, crc);
+        summary.first    = get32(m_dataflash, crc);
+        summary.last     = get32(m_dataflash, crc);
+        for(uint8_t i=0; i<m_channels; i++)
+        {
+            summary.min[i] = get16(m_dataflash, crc);
+            summary.max[i] = get16(m_dataflash, crc);
+        }
+        uint16_t dummy = 0;
+        valid = (get16(m_dataflash, dummy) == crc);
+    }
+    m_dataflash.disable();
+
+    m_queryBytes += valid ? headerSize() : 4;
+    return valid;
+}
+
+/**
+ * Write a summary header at the start of a buffer.
+ * @param bufferNum SRAM buffer (0 or 1).
+ * @param magic Magic number.
+ * @param summary Summary.
+ **/
+void DataFlashTimeSeries::writeSummary(uint8_t bufferNum, uint16_t magic, const Summary &summary)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+
+    m_dataflash.bufferWrite(bufferNum, 0);
+    put16(m_dataflash, magic, crc);
+    put16(m_dataflash, m_channels, crc);
+    put32(m_dataflash, summary.sequence, crc);
+    put16(m_dataflash, summary.count, crc);
+    put32(m_dataflash, summary.first, crc);
+    put32(m_dataflash, summary.last, crc);
+    for(uint8_t i=0; i<m_channels; i++)
+    {
+        put16(m_dataflash, summary.min[i], crc);
+        put16(m_dataflash, summary.max[i], crc);
+    }
+    uint16_t dummy = 0;
+    put16(m_dataflash, crc, dummy);
+    m_dataflash.disable();
+}
+
+/**
+ * Merge a record or a summary into a summary.
+ * The count and sequence number are left to the caller.
+ * @param summary Summary to update.
+ * @param other Summary to merge, newer than the first one.
+ **/
+void DataFlashTimeSeries::merge(Summary &summary, const Summary &other)
+{
+    if(summary.count == 0)
+    {
+        summary.first = other.first;
+        for(uint8_t i=0; i<m_channels; i++)
+        {
+            summary.min[i] = other.min[i];
+            summary.max[i] = other.max[i];
+        }
+    }
+    else
+    {
+        for(uint8_t i=0; i<m_channels; i++)
+        {
+            if(other.min[i] < summary.min[i])
+            {
+                summary.min[i] = other.min[i];
+            }
+            if(other.max[i] > summary.max[i])
+            {
+                summary.max[i] = other.max[i];
+            }
+        }
+    }
+    summary.last = other.last;
+}
+
+/**
+ * Read the records of a page in a range.
+ * @param page Page number.
+ * @param summary Page summary.
+ * @param from First timestamp.
+ * @param to Last timestamp.
+ * @param callback Function called for each record.
+ * @param context User data passed to the callback.
+ * @return Number of records found.
+ **/
+uint32_t DataFlashTimeSeries::scanPage(uint16_t page, const Summary &summary, uint32_t from, uint32_t to,
+                                       RecordCallback callback, void *context)
+{
+    uint32_t found = 0;
+    uint16_t crc = AT45_CRC16_INIT;
+    int16_t values[AT45_TS_MAX_CHANNELS];
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.arrayRead(page, headerSize());
+    for(uint16_t i=0; i<summary.count; i++)
+    {
+        uint32_t timestamp = get32(m_dataflash, crc);
+        for(uint8_t j=0; j<m_channels; j++)
+        {
+            values[j] = get16(m_dataflash, crc);
+        }
+        m_queryBytes += recordSize();
+
+        if(timestamp > to)
+        {
+            break;
+        }
+        if(timestamp >= from)
+        {
+            callback(context, timestamp, values);
+            ++found;
+        }
+    }
+    m_dataflash.disable();
+
+    return found;
+}
+
+/**
+ * Program the current page and move to the next one.
+ * The sector summary is written when the last data page of a sector is
+ * programmed.
+ * Nothing moves when a program fails, so that it's tried again by the
+ * next call.
+ * @return false if a page couldn't be programmed.
+ **/
+bool DataFlashTimeSeries::closePage()
+{
+    if(!closeSector())
+    {
+        return false;
+    }
+    if(m_pageSummary.count == 0)
+    {
+        return true;
+    }
+
+    m_pageSummary.sequence = m_sequence;
+    writeSummary(m_buffer, AT45_TS_PAGE_MAGIC, m_pageSummary);
+    if(!m_dataflash.bufferToPage(m_buffer, m_page))
+    {
+        return false;
+    }
+    ++m_sequence;
+    m_buffer ^= 1;
+
+    merge(m_sectorSummary, m_pageSummary);
+    m_sectorSummary.sequence = m_pageSummary.sequence;
+    ++m_sectorSummary.count;
+    m_pageSummary.count = 0;
+
+    ++m_page;
+    return closeSector();
+}
+
+/**
+ * Write the sector summary if the last data page of the sector was
+ * programmed, then start the next sector.
+ * @return false if the summary couldn't be programmed or the next sector
+ *         is protected.
+ **/
+bool DataFlashTimeSeries::closeSector()
+{
+    if(m_page != summaryPage(m_sector))
+    {
+        return true;
+    }
+
+    writeSummary(m_buffer, AT45_TS_SECTOR_MAGIC, m_sectorSummary);
+    if(!m_dataflash.bufferToPage(m_buffer, m_page))
+    {
+        return false;
+    }
+    m_buffer ^= 1;
+    return openSector(m_first + ((m_sector - m_first + 1) % m_count));
+}
+
+/**
+ * Start writing a sector.
+ * Data pages are rewritten with the built-in erase of page programs.
+ * Only the summary of the previous pass is erased here.
+ * @param sector Sector number.
+ * @return false if the sector is protected. The current sector is kept.
+ **/
+bool DataFlashTimeSeries::openSector(int8_t sector)
+{
+    if(!m_dataflash.pageErase(summaryPage(sector)))
+    {
+        return false;
+    }
+    m_sector = sector;
+    m_page   = m_dataflash.sectorFirstPage(sector);
+    m_sectorSummary.count = 0;
+    return true;
+}
+
+/**
+ * @}
+ **/
@@ -0,0 +1,242 @@
+/**************************************************************************//**
+ * @file DataFlashTimeSeries.h
+ * @brief Time series storage with page and sector summaries for the AT45DBxxxD
+ * Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashTimeSeries.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_TIME_SERIES_H_
+#define DATAFLASH_TIME_SERIES_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_TIME_SERIES Time series settings.
+ * @{
+ **/
+/**
+ * Maximum number of channels of a record.
+ **/
+#define AT45_TS_MAX_CHANNELS 4
+/**
+ * @}
+ **/
+
+/**
+ * Circular time series storage.
+ * Records (a timestamp and one 16 bits value per channel) are packed in
+ * pages. Each page starts with a summary of its records: first and last
+ * timestamps, per channel minimum and maximum. The last page of each
+ * sector holds the summary of the whole sector, written when the sector
+ * is full. Range queries skip the sectors and pages that can't match
+ * after reading their summary.
+ * Timestamps must not decrease.
+ * @note Both SRAM buffers are used, their content is lost.
+ * @note Data pages are rewritten without a separate erase, the device
+ *       must be in auto erase mode (the default).
+ **/
+class DataFlashTimeSeries
+{
+    public:
+        /**
+         * Summary of a page or a sector.
+         **/
+        struct Summary
+        {
+            uint32_t sequence;      /**< Sequence number of the (last) page. **/
+            uint16_t count;         /**< Number of records (pages for a sector). **/
+            uint32_t first;         /**< First timestamp. **/
+            uint32_t last;          /**< Last timestamp. **/
+            int16_t  min[AT45_TS_MAX_CHANNELS];    /**< Minimum value per channel. **/
+            int16_t  max[AT45_TS_MAX_CHANNELS];    /**< Maximum value per channel. **/
+        };
+
+        /**
+         * Query callback.
+         * @param context User data.
+         * @param timestamp Record timestamp.
+         * @param values Record values, one per channel.
+         **/
+        typedef void (*RecordCallback)(void *context, uint32_t timestamp, const int16_t *values);
+
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         **/
+        DataFlashTimeSeries(DataFlash &dataflash);
+
+        /**
+         * Find the end of the stored series and get ready to append.
+         * @param sector First sector of the storage area (1 or above).
+         * @param count Number of sectors.
+         * @param channels Number of channels per record.
+         * @return false if the parameters are invalid, or if the area
+         *         couldn't be repaired because a sector is protected.
+         **/
+        bool begin(int8_t sector, int8_t count, uint8_t channels);
+
+        /**
+         * Append a record.
+         * @param timestamp Timestamp, not lower than the previous one.
+         * @param values One value per channel.
+         * @return false if the record was dropped because the current
+         *         page is full and couldn't be programmed.
+         **/
+        bool append(uint32_t timestamp, const int16_t *values);
+
+        /**
+         * Program the current page, even if it's not full. The next
+         * records start a new page.
+         * @return false if a page couldn't be programmed.
+         **/
+        bool flush();
+
+        /**
+         * Find the records with a timestamp in a range. Records not
+         * flushed yet are not returned.
+         * @param from First timestamp.
+         * @param to Last timestamp.
+         * @param callback Function called for each record.
+         * @param context User data passed to the callback.
+         * @return Number of records found.
+         **/
+        uint32_t query(uint32_t from, uint32_t to, RecordCallback callback, void *context);
+
+        /**
+         * Read the summary of a sector.
+         * @return false if the sector is not complete.
+         **/
+        bool sectorSummary(int8_t sector, Summary &summary);
+
+        /**
+         * Read the summary of a page.
+         * @return false if the page doesn't hold records.
+         **/
+        bool pageSummary(uint16_t page, Summary &summary);
+
+        /** Number of bytes read from the chip by the last query. **/
+        inline uint32_t queryBytes() const;
+
+    private:
+        /**
+         * Read a summary header.
+         * @param magic Expected magic number.
+         **/
+        bool readSummary(uint16_t page, uint16_t magic, Summary &summary);
+
+        /** Write a summary header at the start of a buffer. **/
+        void writeSummary(uint8_t bufferNum, uint16_t magic, const Summary &summary);
+
+        /** Merge a record or a summary into a summary. **/
+        void merge(Summary &summary, const Summary &other);
+
+        /** Read the records of a page in a range. **/
+        uint32_t scanPage(uint16_t page, const Summary &summary, uint32_t from, uint32_t to,
+                          RecordCallback callback, void *context);
+
+        /**
+         * Program the current page and move to the next one.
+         * @return false if a page couldn't be programmed.
+         **/
+        bool closePage();
+
+        /**
+         * Write the sector summary once the data pages are programmed.
+         * @return false if the summary couldn't be programmed.
+         **/
+        bool closeSector();
+
+        /**
+         * Start writing a sector.
+         * @return false if the sector is protected.
+         **/
+        bool openSector(int8_t sector);
+
+        /** Page holding the summary of a sector. **/
+        inline uint16_t summaryPage(int8_t sector) const;
+
+        /** Size of a summary header. **/
+        inline uint16_t headerSize() const;
+
+        /** Size of a record. **/
+        inline uint16_t recordSize() const;
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        int8_t     m_first;         /**< First sector of the area. **/
+        int8_t     m_count;         /**< Number of sectors. **/
+        uint8_t    m_channels;      /**< Number of channels. **/
+        uint16_t   m_perPage;       /**< Number of records per page. **/
+
+        int8_t     m_sector;        /**< Sector being written. **/
+        uint16_t   m_page;          /**< Page being written. **/
+        uint8_t    m_buffer;        /**< SRAM buffer of the current page. **/
+        uint32_t   m_sequence;      /**< Sequence number of the next page. **/
+        Summary    m_pageSummary;   /**< Summary of the current page. **/
+        Summary    m_sectorSummary; /**< Summary of the current sector. **/
+        uint32_t   m_queryBytes;    /**< Bytes read by the last query. **/
+};
+
+/** Number of bytes read from the chip by the last query. **/
+inline uint32_t DataFlashTimeSeries::queryBytes() const
+{
+    return m_queryBytes;
+}
+
+/** Page holding the summary of a sector. **/
+inline uint16_t DataFlashTimeSeries::summaryPage(int8_t sector) const
+{
+    return m_dataflash.sectorFirstPage(sector) + m_dataflash.sectorPageCount(sector) - 1;
+}
+
+/** Size of a summary header. **/
+inline uint16_t DataFlashTimeSeries::headerSize() const
+{
+    return 20 + 4*m_channels;
+}
+
+/** Size of a record. **/
+inline uint16_t DataFlashTimeSeries::recordSize() const
+{
+    return 4 + 2*m_channels;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_TIME_SERIES_H_ */
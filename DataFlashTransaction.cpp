@@ -0,0 +1,415 @@
+/**************************************************************************//**
+ * @file DataFlashTransaction.cpp
+ * @brief Atomic multi page updates for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Shadow paging transactions. Modified pages are written out of place and
+ * the switch to the new version is a single root page program, so a power
+ * loss leaves either the old or the new version, never a mix of both.
+ * Root page layout (little endian): magic (2 bytes), sequence number (4
+ * bytes), number of logical pages (2 bytes), page map (2 bytes per logical
+ * page, pool index), CRC-16 of all the previous bytes. The two root pages
+ * are written alternately. Mounting reads both of them and keeps the valid
+ * one with the highest sequence number, whatever the number of transactions
+ * done before.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashTransaction.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Root page magic number. **/
+#define AT45_TRANSACTION_MAGIC          0x5452
+/** Size of the root page header. **/
+#define AT45_TRANSACTION_HEADER_SIZE    8
+
+/** Send a byte and update the CRC. **/
+static inline void put8(DataFlash &dataflash, uint8_t value, uint16_t &crc)
+{
+    dataflash.transfer(value);
+    crc = dataflashCrc16(crc, value);
+}
+
+/** Send a 16 bits little endian value and update the CRC. **/
+static void put16(DataFlash &dataflash, uint16_t value, uint16_t &crc)
+{
+    put8(dataflash, value & 0xff, crc);
+    put8(dataflash, value >> 8, crc);
+}
+
+/** Read a byte and update the CRC. **/
+static inline uint8_t get8(DataFlash &dataflash, uint16_t &crc)
+{
+    uint8_t value = dataflash.transfer(0xff);
+    crc = dataflashCrc16(crc, value);
+    return value;
+}
+
+/** Read a 16 bits little endian value and update the CRC. **/
+static uint16_t get16(DataFlash &dataflash, uint16_t &crc)
+{
+    uint16_t value = get8(dataflash, crc);
+    return value | ((uint16_t)get8(dataflash, crc) << 8);
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param bufferNum SRAM buffer used for writes (0 or 1).
+ **/
+DataFlashTransaction::DataFlashTransaction(DataFlash &dataflash, uint8_t bufferNum)
+    : m_dataflash(dataflash)
+    , m_bufferNum(bufferNum)
+    , m_first(0)
+    , m_poolCount(0)
+    , m_count(0)
+    , m_root(0)
+    , m_sequence(0)
+    , m_cursor(0)
+    , m_active(false)
+{}
+
+/**
+ * Load the page map from the most recent valid root page, or format
+ * the area.
+ * @param page First page of the area.
+ * @param poolCount Number of pages of the pool.
+ * @param count Number of logical pages.
+ * @return true if a valid root page was found.
+ **/
+bool DataFlashTransaction::mount(uint16_t page, uint16_t poolCount, uint16_t count)
+{
+    m_active = false;
+    if((count == 0) || (count > AT45_TRANSACTION_MAX_PAGES) ||
+       (poolCount <= count) || (poolCount > AT45_TRANSACTION_MAX_POOL) ||
+       ((AT45_TRANSACTION_HEADER_SIZE + 2*count + 2) > m_dataflash.pageSize()))
+    {
+        m_count = 0;
+        return false;
+    }
+
+    m_first     = page;
+    m_poolCount = poolCount;
+    m_count     = count;
+    m_cursor    = 0;
+
+    uint32_t sequence[2];
+    bool valid[2];
+    valid[0] = readRoot(0, sequence[0], 0);
+    valid[1] = readRoot(1, sequence[1], 0);
+
+    bool found = valid[0] || valid[1];
+    if(found)
+    {
+        if(valid[0] && valid[1])
+        {
+            /* Wrap around safe comparison. */
+            m_root = ((int32_t)(sequence[1] - sequence[0]) > 0) ? 1 : 0;
+        }
+        else
+        {
+            m_root = valid[0] ? 0 : 1;
+        }
+        readRoot(m_root, m_sequence, m_committed);
+    }
+    else
+    {
+        for(uint16_t i=0; i<m_count; i++)
+        {
+            m_committed[i] = i;
+            m_working[i]   = i;
+        }
+        m_sequence = 0;
+        if(!writeRoot(0))
+        {
+            m_count = 0;
+            return false;
+        }
+        m_dataflash.waitUntilReady();
+        m_root     = 0;
+        m_sequence = 1;
+    }
+
+    memset(m_used, 0, sizeof(m_used));
+    for(uint16_t i=0; i<m_count; i++)
+    {
+        m_working[i] = m_committed[i];
+        setUsed(m_committed[i], true);
+    }
+    return found;
+}
+
+/**
+ * Start a transaction.
+ * @return false if a transaction is already running.
+ **/
+bool DataFlashTransaction::begin()
+{
+    if(m_active || (m_count == 0))
+    {
+        return false;
+    }
+    m_active = true;
+    return true;
+}
+
+/**
+ * Write data to a logical page.
+ * The page is copied to the SRAM buffer, patched and programmed to its
+ * shadow page with a single page program through buffer.
+ * @param page Logical page.
+ * @param offset Byte offset within the page.
+ * @param data Data.
+ * @param length Data length in bytes.
+ * @return false if the write failed.
+ **/
+bool DataFlashTransaction::write(uint16_t page, uint16_t offset, const void *data, uint16_t length)
+{
+    if(!m_active || (page >= m_count) ||
+       ((uint32_t)offset + length) > m_dataflash.pageSize())
+    {
+        return false;
+    }
+
+    uint16_t source = m_working[page];
+    if(source == m_committed[page])
+    {
+        int16_t shadow = allocate();
+        if(shadow < 0)
+        {
+            return false;
+        }
+        m_working[page] = shadow;
+    }
+
+    m_dataflash.pageToBuffer(m_first + 2 + source, m_bufferNum);
+    m_dataflash.waitUntilReady();
+    if(!m_dataflash.beginPageWriteThroughBuffer(m_first + 2 + m_working[page], offset, m_bufferNum))
+    {
+        /* Give the shadow page back if it was allocated for this write. */
+        if(source == m_committed[page])
+        {
+            setUsed(m_working[page], false);
+            m_working[page] = source;
+        }
+        return false;
+    }
+    const uint8_t *src = static_cast<const uint8_t*>(data);
+    for(uint16_t i=0; i<length; i++)
+    {
+        m_dataflash.transfer(src[i]);
+    }
+    m_dataflash.disable();
+
+    return true;
+}
+
+/**
+ * Read data from a logical page.
+ * @param page Logical page.
+ * @param offset Byte offset within the page.
+ * @param data Destination buffer.
+ * @param length Data length in bytes.
+ **/
+void DataFlashTransaction::read(uint16_t page, uint16_t offset, void *data, uint16_t length)
+{
+    if(page >= m_count)
+    {
+        return;
+    }
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(physicalPage(page), offset);
+    memset(data, 0xff, length);
+    m_dataflash.transfer(data, length);
+    m_dataflash.disable();
+}
+
+/**
+ * Make the writes of the transaction permanent.
+ * @return false if no transaction is running or if the root page is
+ *         protected.
+ **/
+bool DataFlashTransaction::commit()
+{
+    if(!m_active)
+    {
+        return false;
+    }
+
+    uint8_t root = m_root ^ 1;
+    if(!writeRoot(root))
+    {
+        return false;
+    }
+    /* The transaction is only committed once the root is programmed. */
+    m_dataflash.waitUntilReady();
+
+    m_root = root;
+    ++m_sequence;
+    for(uint16_t i=0; i<m_count; i++)
+    {
+        if(m_working[i] != m_committed[i])
+        {
+            setUsed(m_committed[i], false);
+            m_committed[i] = m_working[i];
+        }
+    }
+    m_active = false;
+    return true;
+}
+
+/**
+ * Drop the writes of the transaction.
+ **/
+void DataFlashTransaction::abort()
+{
+    for(uint16_t i=0; i<m_count; i++)
+    {
+        if(m_working[i] != m_committed[i])
+        {
+            setUsed(m_working[i], false);
+            m_working[i] = m_committed[i];
+        }
+    }
+    m_active = false;
+}
+
+/**
+ * Read and check a root page.
+ * @param root Root page (0 or 1).
+ * @param sequence Sequence number of the root page.
+ * @param map Page map to fill, or 0 to only check the page.
+ * @return true if the root page is valid.
+ **/
+bool DataFlashTransaction::readRoot(uint8_t root, uint32_t &sequence, uint16_t *map)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+    uint16_t dummy = AT45_CRC16_INIT;
+    bool valid = true;
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(m_first + root, 0);
+
+    uint16_t magic = get16(m_dataflash, crc);
+    sequence  = get16(m_dataflash, crc);
+    sequence |= (uint32_t)get16(m_dataflash, crc) << 16;
+    uint16_t count = get16(m_dataflash, crc);
+    if((magic != AT45_TRANSACTION_MAGIC) || (count != m_count))
+    {
+        valid = false;
+    }
+    else
+    {
+        for(uint16_t i=0; i<count; i++)
+        {
+            uint16_t index = get16(m_dataflash, crc);
+            if(index >= m_poolCount)
+            {
+                valid = false;
+                break;
+            }
+            if(map)
+            {
+                map[i] = index;
+            }
+        }
+        valid = valid && (get16(m_dataflash, dummy) == crc);
+    }
+
+    m_dataflash.disable();
+    return valid;
+}
+
+/**
+ * Write the working page map to a root page.
+ * The page is programmed in the background.
+ * @param root Root page (0 or 1).
+ * @return false if the root page is protected.
+ **/
+bool DataFlashTransaction::writeRoot(uint8_t root)
+{
+    uint16_t crc = AT45_CRC16_INIT;
+    uint32_t sequence = m_sequence + 1;
+
+    m_dataflash.waitUntilReady();
+    if(!m_dataflash.beginPageWriteThroughBuffer(m_first + root, 0, m_bufferNum))
+    {
+        return false;
+    }
+    put16(m_dataflash, AT45_TRANSACTION_MAGIC, crc);
+    put16(m_dataflash, sequence & 0xffff, crc);
+    put16(m_dataflash, sequence >> 16, crc);
+    put16(m_dataflash, m_count, crc);
+    for(uint16_t i=0; i<m_count; i++)
+    {
+        put16(m_dataflash, m_working[i], crc);
+    }
+    uint16_t dummy = AT45_CRC16_INIT;
+    put16(m_dataflash, crc, dummy);
+    m_dataflash.disable();
+    return true;
+}
+
+/**
+ * Find a free page in the pool and mark it as used.
+ * The search starts after the last allocated page in order to spread
+ * the writes over the pool.
+ * @return Pool index, or -1 if the pool is full.
+ **/
+int16_t DataFlashTransaction::allocate()
+{
+    for(uint16_t i=0; i<m_poolCount; i++)
+    {
+        uint16_t index = m_cursor;
+        if(++m_cursor >= m_poolCount)
+        {
+            m_cursor = 0;
+        }
+        if(!(m_used[index >> 3] & (1 << (index & 7))))
+        {
+            setUsed(index, true);
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @}
+ **/
@@ -0,0 +1,233 @@
+/**************************************************************************//**
+ * @file DataFlashTransaction.h
+ * @brief Atomic multi page updates for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashTransaction.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_TRANSACTION_H_
+#define DATAFLASH_TRANSACTION_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_TRANSACTION Transaction settings.
+ * @{
+ **/
+/**
+ * Maximum number of logical pages. Each one costs 4 bytes of RAM.
+ **/
+#define AT45_TRANSACTION_MAX_PAGES  64
+/**
+ * Maximum number of pages of the pool (logical pages plus shadow pages).
+ * Each one costs one bit of RAM.
+ **/
+#define AT45_TRANSACTION_MAX_POOL   128
+/**
+ * @}
+ **/
+
+/**
+ * Atomic updates of a set of logical pages using shadow paging.
+ * Logical pages are mapped to the pages of a pool. Inside a transaction,
+ * a modified logical page is written to a free page of the pool (its
+ * shadow), leaving the committed version untouched. The commit writes
+ * the new page map to the root page not holding the current one, so the
+ * map switches to the new version in a single page program. If power is
+ * lost before the end of this program, the CRC of the new root doesn't
+ * match and the previous map is used at mount.
+ *
+ * The area starts with the two root pages followed by the pool.
+ * @note Writes go through the SRAM buffer given to the constructor, its
+ * content is lost.
+ **/
+class DataFlashTransaction
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param bufferNum SRAM buffer used for writes (0 or 1).
+         **/
+        DataFlashTransaction(DataFlash &dataflash, uint8_t bufferNum=0);
+
+        /**
+         * Load the page map from the most recent valid root page.
+         * If none is found, the area is formatted: logical page i is
+         * mapped to page i of the pool. The content of the pages is left
+         * as is.
+         * @param page First page of the area (two root pages and the pool).
+         * @param poolCount Number of pages of the pool.
+         * @param count Number of logical pages. The pool must be larger,
+         *        the extra pages limit the number of pages a single
+         *        transaction can modify.
+         * @return true if a valid root page was found, false if the area
+         *         was formatted or the parameters are invalid. If the
+         *         area can't be formatted because it's in a protected
+         *         sector, no transaction can be started.
+         **/
+        bool mount(uint16_t page, uint16_t poolCount, uint16_t count);
+
+        /**
+         * Start a transaction.
+         * @return false if a transaction is already running.
+         **/
+        bool begin();
+
+        /**
+         * Write data to a logical page. The first write to a page in a
+         * transaction copies it to a free page of the pool.
+         * @param page Logical page.
+         * @param offset Byte offset within the page.
+         * @param data Data.
+         * @param length Data length in bytes.
+         * @return false if no transaction is running, the write crosses
+         *         the end of the page, there's no free page left or the
+         *         pool is in a protected sector.
+         **/
+        bool write(uint16_t page, uint16_t offset, const void *data, uint16_t length);
+
+        /**
+         * Read data from a logical page. Inside a transaction, the data
+         * written by the transaction is returned.
+         * @param page Logical page.
+         * @param offset Byte offset within the page.
+         * @param data Destination buffer.
+         * @param length Data length in bytes.
+         **/
+        void read(uint16_t page, uint16_t offset, void *data, uint16_t length);
+
+        /**
+         * Make the writes of the transaction permanent.
+         * Returns once the root page is programmed.
+         * @return false if no transaction is running, or if the root
+         *         page is in a protected sector. The transaction is then
+         *         still running.
+         **/
+        bool commit();
+
+        /**
+         * Drop the writes of the transaction.
+         **/
+        void abort();
+
+        /** A transaction is running. **/
+        inline bool active() const;
+
+        /** Sequence number of the committed page map. **/
+        inline uint32_t sequence() const;
+
+        /** Physical page of the current version of a logical page. **/
+        inline uint16_t physicalPage(uint16_t page) const;
+
+    private:
+        /**
+         * Read and check a root page.
+         * @param root Root page (0 or 1).
+         * @param sequence Sequence number of the root page.
+         * @param map Page map to fill, or 0 to only check the page.
+         * @return true if the root page is valid.
+         **/
+        bool readRoot(uint8_t root, uint32_t &sequence, uint16_t *map);
+
+        /**
+         * Write the working page map to a root page.
+         * @param root Root page (0 or 1).
+         * @return false if the root page is in a protected sector.
+         **/
+        bool writeRoot(uint8_t root);
+
+        /**
+         * Find a free page in the pool and mark it as used.
+         * @return Pool index, or -1 if the pool is full.
+         **/
+        int16_t allocate();
+
+        /** Mark a pool page as used or free. **/
+        inline void setUsed(uint16_t index, bool used);
+
+    private:
+        DataFlash &m_dataflash;     /**< %Dataflash device. **/
+        uint8_t    m_bufferNum;     /**< SRAM buffer used for writes. **/
+
+        uint16_t m_first;           /**< First page of the area (root 0). **/
+        uint16_t m_poolCount;       /**< Number of pages of the pool. **/
+        uint16_t m_count;           /**< Number of logical pages. **/
+        uint8_t  m_root;            /**< Root page holding the committed map. **/
+        uint32_t m_sequence;        /**< Sequence number of the committed map. **/
+        uint16_t m_cursor;          /**< Next pool page to try for allocation. **/
+        bool     m_active;          /**< A transaction is running. **/
+
+        uint16_t m_committed[AT45_TRANSACTION_MAX_PAGES];   /**< Committed page map. **/
+        uint16_t m_working[AT45_TRANSACTION_MAX_PAGES];     /**< Page map of the transaction. **/
+        uint8_t  m_used[AT45_TRANSACTION_MAX_POOL / 8];     /**< Used pool pages. **/
+};
+
+/** A transaction is running. **/
+inline bool DataFlashTransaction::active() const
+{
+    return m_active;
+}
+
+/** Sequence number of the committed page map. **/
+inline uint32_t DataFlashTransaction::sequence() const
+{
+    return m_sequence;
+}
+
+/** Physical page of the current version of a logical page. **/
+inline uint16_t DataFlashTransaction::physicalPage(uint16_t page) const
+{
+    return m_first + 2 + (m_active ? m_working[page] : m_committed[page]);
+}
+
+/** Mark a pool page as used or free. **/
+inline void DataFlashTransaction::setUsed(uint16_t index, bool used)
+{
+    if(used)
+    {
+        m_used[index >> 3] |= (1 << (index & 7));
+    }
+    else
+    {
+        m_used[index >> 3] &= ~(1 << (index & 7));
+    }
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_TRANSACTION_H_ */
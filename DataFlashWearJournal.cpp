@@ -0,0 +1,669 @@
+/**************************************************************************//**
+ * @file DataFlashWearJournal.cpp
+ * @brief Persistent per block erase counters for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Erase counters give an idea of how close a device is to its endurance
+ * limit. They are stored as a table of 4 bytes per block, split over a
+ * few pages of a reserved sector. Only the pending counts (erases since
+ * the last write) are kept in RAM, 1 byte per block.
+ * Writing the journal rewrites each table page with pending counts: the
+ * current copy is transferred to the SRAM buffer, the pending counts are
+ * added to the counters in place, and the buffer is programmed to the
+ * next free page of the sector. Pages holding a current copy are
+ * skipped, so that a power loss during a write leaves the previous copy
+ * intact. The copy with the highest sequence number and a valid CRC is
+ * the current one.
+ * Page layout (little endian):
+ *   - magic (2 bytes), table page number (1), table page count (1),
+ *     sequence (4)
+ *   - counters of the blocks of the page (4 bytes each)
+ *   - CRC-16 of all the above (2)
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#endif
+
+#include "DataFlashWearJournal.h"
+#include "DataFlashCrc.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/** Journal page magic number. **/
+#define AT45_WEAR_MAGIC         0x574B
+/** Size of the page header. **/
+#define AT45_WEAR_HEADER_SIZE   8
+/** Size of a counter. **/
+#define AT45_WEAR_ENTRY_SIZE    4
+/** Location of a table page never written. **/
+#define AT45_WEAR_NONE          0xffff
+
+/** Send a byte and update the CRC. **/
+static inline void put8(DataFlash &dataflash, uint8_t value, uint16_t &crc)
+{
+    dataflash.transfer(value);
+    crc = dataflashCrc16(crc, value);
+}
+
+/** Send a 32 bits little endian value and update the CRC. **/
+static void put32(DataFlash &dataflash, uint32_t value, uint16_t &crc)
+{
+    for(uint8_t i=0; i<32; i+=8)
+    {
+        put8(dataflash, (uint8_t)(value >> i), crc);
+    }
+}
+
+/** Read a byte and update the CRC. **/
+static inline uint8_t get8(DataFlash &dataflash, uint16_t &crc)
+{
+    uint8_t value = dataflash.transfer(0xff);
+    crc = dataflashCrc16(crc, value);
+    return value;
+}
+
+/** Read a 16 bits little endian value and update the CRC. **/
+static uint16_t get16(DataFlash &dataflash, uint16_t &crc)
+{
+    uint16_t value = get8(dataflash, crc);
+    return value | ((uint16_t)get8(dataflash, crc) << 8);
+}
+
+/** Read a 32 bits little endian value and update the CRC. **/
+static uint32_t get32(DataFlash &dataflash, uint16_t &crc)
+{
+    uint32_t value = get16(dataflash, crc);
+    return value | ((uint32_t)get16(dataflash, crc) << 16);
+}
+
+/**
+ * Constructor.
+ * @param dataflash %Dataflash device.
+ * @param bufferNum SRAM buffer used to write the journal (0 or 1).
+ **/
+DataFlashWearJournal::DataFlashWearJournal(DataFlash &dataflash, uint8_t bufferNum)
+    : m_dataflash(dataflash)
+    , m_bufferNum(bufferNum)
+    , m_previousHook(0)
+    , m_previousContext(0)
+    , m_sector(0)
+    , m_first(0)
+    , m_pages(0)
+    , m_next(0)
+    , m_sequence(0)
+    , m_writing(false)
+    , m_tablePages(0)
+    , m_maxDelta(0)
+    , m_blocks(0)
+    , m_max(0)
+    , m_total(0)
+    , m_events(0)
+    , m_pending(0)
+    , m_writes(0)
+{}
+
+/**
+ * Load the counter table location from the reserved sector and start
+ * watching erase operations.
+ * The sector is scanned for the copy of each table page with the
+ * highest sequence number. Its CRC is checked, and older copies are
+ * looked for if it's corrupted.
+ * @param sector Sector reserved for the journal.
+ * @return true if saved counters were found, false if the journal starts
+ *         from scratch or if the device isn't supported.
+ **/
+bool DataFlashWearJournal::begin(int8_t sector)
+{
+    m_sector     = sector;
+    m_first      = m_dataflash.sectorFirstPage(sector);
+    m_pages      = m_dataflash.sectorPageCount(sector);
+    m_blocks     = m_dataflash.pageCount() >> 3;
+    m_tablePages = (m_blocks + perPage() - 1) / perPage();
+
+    memset(m_deltas, 0, sizeof(m_deltas));
+    m_maxDelta = 0;
+    m_pending  = 0;
+    m_total    = 0;
+    m_max      = 0;
+    for(uint8_t i=0; i<AT45_WEAR_TABLE_PAGES; i++)
+    {
+        m_location[i] = AT45_WEAR_NONE;
+    }
+
+    /* The sector must hold the table twice, for the old copy of a page
+     * to survive while its new copy is written. */
+    if((m_blocks > AT45_WEAR_MAX_BLOCKS) ||
+       (m_tablePages > AT45_WEAR_TABLE_PAGES) ||
+       (m_pages < (2 * m_tablePages)))
+    {
+        m_blocks     = 0;
+        m_tablePages = 0;
+        return false;
+    }
+
+    /* Latest copy of each table page. */
+    Header header;
+    uint32_t sequences[AT45_WEAR_TABLE_PAGES] = { 0 };
+    uint16_t last = AT45_WEAR_NONE;
+    for(uint16_t page=m_first; page<(m_first + m_pages); page++)
+    {
+        if(!readHeader(page, header))
+        {
+            continue;
+        }
+        if((last == AT45_WEAR_NONE) || (header.sequence > m_sequence))
+        {
+            last       = page;
+            m_sequence = header.sequence;
+        }
+        if((m_location[header.index] == AT45_WEAR_NONE) || (header.sequence > sequences[header.index]))
+        {
+            m_location[header.index] = page;
+            sequences[header.index]  = header.sequence;
+        }
+    }
+
+    /* A copy interrupted by a power loss is replaced by the previous one. */
+    bool found = false;
+    for(uint8_t index=0; index<m_tablePages; index++)
+    {
+        while((m_location[index] != AT45_WEAR_NONE) && !check(m_location[index]))
+        {
+            uint32_t below = sequences[index];
+            m_location[index] = AT45_WEAR_NONE;
+            for(uint16_t page=m_first; page<(m_first + m_pages); page++)
+            {
+                if(readHeader(page, header) && (header.index == index) && (header.sequence < below) &&
+                   ((m_location[index] == AT45_WEAR_NONE) || (header.sequence > sequences[index])))
+                {
+                    m_location[index] = page;
+                    sequences[index]  = header.sequence;
+                }
+            }
+        }
+        found = found || (m_location[index] != AT45_WEAR_NONE);
+    }
+
+    if(last == AT45_WEAR_NONE)
+    {
+        m_next     = m_first;
+        m_sequence = 0;
+    }
+    else
+    {
+        m_next = last;
+        ++m_sequence;
+        advance();
+    }
+
+    m_max = scan(&m_total, 0, 0, 1);
+
+    m_previousHook    = m_dataflash.modifyHook();
+    m_previousContext = m_dataflash.modifyHookContext();
+    m_dataflash.setModifyHook(onModify, this);
+
+    return found;
+}
+
+/**
+ * Stop watching erase operations.
+ **/
+void DataFlashWearJournal::end()
+{
+    if((m_dataflash.modifyHook() == onModify) && (m_dataflash.modifyHookContext() == this))
+    {
+        m_dataflash.setModifyHook(m_previousHook, m_previousContext);
+    }
+}
+
+/**
+ * Write the journal if AT45_WEAR_FLUSH_EVENTS erase operations were
+ * recorded, or if a pending count reached AT45_WEAR_FLUSH_DELTA. With
+ * random erases, this keeps the journal overhead well below 1 page per
+ * 100 erases.
+ * @return true if the journal was written.
+ **/
+bool DataFlashWearJournal::update()
+{
+    if((m_pending >= AT45_WEAR_FLUSH_EVENTS) || (m_maxDelta >= AT45_WEAR_FLUSH_DELTA))
+    {
+        return flush();
+    }
+    return false;
+}
+
+/**
+ * Write all the pending counts to the journal.
+ * Only the table pages with pending counts are rewritten.
+ * @return false if the reserved sector is protected.
+ **/
+bool DataFlashWearJournal::flush()
+{
+    if(m_writing || (m_blocks == 0))
+    {
+        return false;
+    }
+    if(m_dataflash.isSectorProtected(m_sector))
+    {
+        return false;
+    }
+    m_writing = true;
+
+    /* Counts of the journal writes themselves are left for the next flush
+     * when their table page was already written. */
+    bool written = true;
+    for(uint8_t index=0; written && (index<m_tablePages); index++)
+    {
+        uint16_t first = index * perPage();
+        uint16_t last  = first + perPage();
+        if(last > m_blocks)
+        {
+            last = m_blocks;
+        }
+
+        uint16_t block;
+        for(block=first; (block < last) && (m_deltas[block] == 0); block++)
+        {}
+        if(block < last)
+        {
+            written = writePage(index);
+        }
+    }
+
+    m_maxDelta = 0;
+    for(uint16_t block=0; block<m_blocks; block++)
+    {
+        if(m_deltas[block] > m_maxDelta)
+        {
+            m_maxDelta = m_deltas[block];
+        }
+    }
+
+    m_dataflash.waitUntilReady();
+    if(written)
+    {
+        m_pending = 0;
+    }
+    m_writing = false;
+    return written;
+}
+
+/**
+ * Erase count of a block.
+ * @param block Block number.
+ **/
+uint32_t DataFlashWearJournal::eraseCount(uint16_t block) const
+{
+    if(block >= m_blocks)
+    {
+        return 0;
+    }
+
+    uint32_t value = 0;
+    uint16_t page  = m_location[block / perPage()];
+    if(page != AT45_WEAR_NONE)
+    {
+        uint16_t dummy = AT45_CRC16_INIT;
+
+        m_dataflash.waitUntilReady();
+        m_dataflash.pageRead(page, AT45_WEAR_HEADER_SIZE + (block % perPage()) * AT45_WEAR_ENTRY_SIZE);
+        value = get32(m_dataflash, dummy);
+        m_dataflash.disable();
+    }
+    return value + m_deltas[block];
+}
+
+/**
+ * Average erase count over all the blocks of the device.
+ **/
+uint32_t DataFlashWearJournal::meanEraseCount() const
+{
+    return m_blocks ? (m_total / m_blocks) : 0;
+}
+
+/**
+ * Build a histogram of the erase counts.
+ * The counter table is read twice: once for the highest erase count,
+ * then to fill the bins.
+ * @param bins Bins, binCount entries.
+ * @param binCount Number of bins.
+ **/
+void DataFlashWearJournal::histogram(uint16_t *bins, uint8_t binCount) const
+{
+    if(binCount == 0)
+    {
+        return;
+    }
+
+    uint32_t width = (scan(0, 0, 0, 1) / binCount) + 1;
+    memset(bins, 0, binCount * sizeof(uint16_t));
+    scan(0, bins, binCount, width);
+}
+
+/**
+ * Write amplification of the journal: pages programmed by the journal
+ * per thousand recorded erase operations.
+ **/
+uint16_t DataFlashWearJournal::overhead() const
+{
+    return m_events ? (uint16_t)((m_writes * 1000) / m_events) : 0;
+}
+
+/**
+ * %Dataflash modify hook.
+ * Only erases are counted. A sector erase is one operation, but counts
+ * for each of its blocks.
+ **/
+void DataFlashWearJournal::onModify(void *context, uint8_t operation, uint16_t page, uint16_t count)
+{
+    DataFlashWearJournal *journal = static_cast<DataFlashWearJournal*>(context);
+
+    if(journal->m_previousHook)
+    {
+        journal->m_previousHook(journal->m_previousContext, operation, page, count);
+    }
+
+    if(!(operation & DataFlash::OPERATION_ERASE) || (count == 0))
+    {
+        return;
+    }
+
+    uint16_t last = (page + count - 1) >> 3;
+    for(uint16_t block=page >> 3; block<=last; block++)
+    {
+        journal->record(block);
+    }
+
+    /* The journal wears the reserved sector too, but this isn't accounted
+     * as an erase operation in order to measure the journal overhead. */
+    if(!journal->m_writing)
+    {
+        ++journal->m_events;
+        ++journal->m_pending;
+    }
+}
+
+/**
+ * Count an erase of a block.
+ * Erases of a block whose pending count saturated are lost.
+ * @param block Block number.
+ **/
+void DataFlashWearJournal::record(uint16_t block)
+{
+    if((block >= m_blocks) || (m_deltas[block] == 0xff))
+    {
+        return;
+    }
+
+    uint8_t delta = ++m_deltas[block];
+    ++m_total;
+    if(delta > m_maxDelta)
+    {
+        m_maxDelta = delta;
+    }
+}
+
+/**
+ * Read a page header.
+ * @param page Page number.
+ * @param header Header.
+ * @return true if the page looks like a page of the counter table.
+ **/
+bool DataFlashWearJournal::readHeader(uint16_t page, Header &header) const
+{
+    uint16_t dummy = AT45_CRC16_INIT;
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(page, 0);
+    uint16_t magic  = get16(m_dataflash, dummy);
+    header.index    = get8(m_dataflash, dummy);
+    header.pages    = get8(m_dataflash, dummy);
+    header.sequence = get32(m_dataflash, dummy);
+    m_dataflash.disable();
+
+    return (magic == AT45_WEAR_MAGIC) &&
+           (header.pages == m_tablePages) &&
+           (header.index < m_tablePages);
+}
+
+/**
+ * Check the CRC of a table page.
+ * @param page Page number.
+ * @return true if the page is valid.
+ **/
+bool DataFlashWearJournal::check(uint16_t page) const
+{
+    uint16_t crc = AT45_CRC16_INIT;
+    uint16_t dummy = AT45_CRC16_INIT;
+    uint16_t size = AT45_WEAR_HEADER_SIZE + perPage() * AT45_WEAR_ENTRY_SIZE;
+
+    m_dataflash.waitUntilReady();
+    m_dataflash.pageRead(page, 0);
+    for(uint16_t i=0; i<size; i++)
+    {
+        get8(m_dataflash, crc);
+    }
+    bool valid = (get16(m_dataflash, dummy) == crc);
+    m_dataflash.disable();
+
+    return valid;
+}
+
+/**
+ * Rewrite a table page with its pending counts.
+ * The current copy is transferred to the SRAM buffer, the pending counts
+ * are added to the counters in the buffer, then the buffer is programmed
+ * with built-in erase, whatever the %Dataflash erase mode.
+ * @param index Table page number.
+ * @return false if the page couldn't be programmed.
+ **/
+bool DataFlashWearJournal::writePage(uint8_t index)
+{
+    uint16_t size  = AT45_WEAR_HEADER_SIZE + perPage() * AT45_WEAR_ENTRY_SIZE;
+    uint16_t first = index * perPage();
+    uint16_t last  = first + perPage();
+    uint16_t crc   = AT45_CRC16_INIT;
+    uint16_t dummy = AT45_CRC16_INIT;
+    if(last > m_blocks)
+    {
+        last = m_blocks;
+    }
+
+    if(m_location[index] != AT45_WEAR_NONE)
+    {
+        m_dataflash.pageToBuffer(m_location[index], m_bufferNum);
+        m_dataflash.waitUntilReady();
+    }
+    else
+    {
+        m_dataflash.waitUntilReady();
+        m_dataflash.bufferWrite(m_bufferNum, 0);
+        for(uint16_t i=0; i<size; i++)
+        {
+            m_dataflash.transfer(0x00);
+        }
+        m_dataflash.disable();
+    }
+
+    m_dataflash.bufferWrite(m_bufferNum, 0);
+    put8(m_dataflash, lowByte(AT45_WEAR_MAGIC), dummy);
+    put8(m_dataflash, highByte(AT45_WEAR_MAGIC), dummy);
+    put8(m_dataflash, index, dummy);
+    put8(m_dataflash, m_tablePages, dummy);
+    put32(m_dataflash, m_sequence, dummy);
+    m_dataflash.disable();
+
+    /* Pending counts are cleared as they are moved to the buffer: the
+     * erase of the page written below is counted anew. */
+    for(uint16_t block=first; block<last; block++)
+    {
+        if(m_deltas[block] == 0)
+        {
+            continue;
+        }
+
+        uint16_t offset = AT45_WEAR_HEADER_SIZE + (block - first) * AT45_WEAR_ENTRY_SIZE;
+        m_dataflash.bufferRead(m_bufferNum, offset);
+        uint32_t value = get32(m_dataflash, dummy) + m_deltas[block];
+        m_dataflash.disable();
+
+        m_dataflash.bufferWrite(m_bufferNum, offset);
+        put32(m_dataflash, value, dummy);
+        m_dataflash.disable();
+
+        m_deltas[block] = 0;
+        if(value > m_max)
+        {
+            m_max = value;
+        }
+    }
+
+    m_dataflash.bufferRead(m_bufferNum, 0);
+    for(uint16_t i=0; i<size; i++)
+    {
+        get8(m_dataflash, crc);
+    }
+    m_dataflash.disable();
+
+    /* Program the buffer, CRC included. */
+    if(!m_dataflash.beginPageWriteThroughBuffer(m_next, size, m_bufferNum))
+    {
+        return false;
+    }
+    m_dataflash.transfer(lowByte(crc));
+    m_dataflash.transfer(highByte(crc));
+    m_dataflash.disable();
+
+    m_location[index] = m_next;
+    ++m_sequence;
+    ++m_writes;
+    advance();
+
+    return true;
+}
+
+/**
+ * Read the counter table, pending counts included.
+ * @param total Sum of the erase counts (optional).
+ * @param bins Histogram bins (optional).
+ * @param binCount Number of bins.
+ * @param width Width of a bin.
+ * @return Highest erase count.
+ **/
+uint32_t DataFlashWearJournal::scan(uint32_t *total, uint16_t *bins, uint8_t binCount, uint32_t width) const
+{
+    uint32_t max = 0;
+    uint16_t dummy = AT45_CRC16_INIT;
+
+    if(total)
+    {
+        *total = 0;
+    }
+    for(uint16_t block=0; block<m_blocks; block++)
+    {
+        uint16_t index  = block / perPage();
+        uint16_t page   = m_location[index];
+        uint32_t value  = m_deltas[block];
+        if(page != AT45_WEAR_NONE)
+        {
+            if((block % perPage()) == 0)
+            {
+                m_dataflash.waitUntilReady();
+                m_dataflash.pageRead(page, AT45_WEAR_HEADER_SIZE);
+            }
+            value += get32(m_dataflash, dummy);
+            if(((block % perPage()) == (perPage() - 1)) || (block == (m_blocks - 1)))
+            {
+                m_dataflash.disable();
+            }
+        }
+
+        if(value > max)
+        {
+            max = value;
+        }
+        if(total)
+        {
+            *total += value;
+        }
+        if(bins)
+        {
+            uint32_t bin = value / width;
+            ++bins[(bin < binCount) ? bin : (binCount - 1)];
+        }
+    }
+    return max;
+}
+
+/**
+ * Whether a page of the sector holds the current copy of a table page.
+ * @param page Page number.
+ **/
+bool DataFlashWearJournal::isCurrent(uint16_t page) const
+{
+    for(uint8_t index=0; index<m_tablePages; index++)
+    {
+        if(m_location[index] == page)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Move to the next page of the sector not holding a current table page.
+ * There is always one, as the sector holds at least twice the table.
+ **/
+void DataFlashWearJournal::advance()
+{
+    do
+    {
+        if(++m_next >= (m_first + m_pages))
+        {
+            m_next = m_first;
+        }
+    } while(isCurrent(m_next));
+}
+
+/** Number of counters per page. **/
+inline uint16_t DataFlashWearJournal::perPage() const
+{
+    return (m_dataflash.pageSize() - AT45_WEAR_HEADER_SIZE - 2) / AT45_WEAR_ENTRY_SIZE;
+}
+
+/**
+ * @}
+ **/
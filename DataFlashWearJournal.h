@@ -0,0 +1,275 @@
+/**************************************************************************//**
+ * @file DataFlashWearJournal.h
+ * @brief Persistent per block erase counters for the AT45DBxxxD Atmel
+ * Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref DataFlashWearJournal.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DATAFLASH_WEAR_JOURNAL_H_
+#define DATAFLASH_WEAR_JOURNAL_H_
+
+#include <inttypes.h>
+#include "DataFlash.h"
+
+/**
+ * @addtogroup AT45DBxxxD
+ * @{
+ **/
+
+/**
+ * @defgroup AT45_WEAR_JOURNAL Wear journal settings.
+ * @{
+ **/
+/**
+ * Number of blocks tracked. 1024 covers every device up to the
+ * AT45DB642D. Each block costs 1 byte of RAM (its pending count), the
+ * counters themselves are kept in the reserved sector. It can be lowered
+ * to 512 (up to the AT45DB161D) to save RAM, begin() then refuses larger
+ * devices.
+ **/
+#define AT45_WEAR_MAX_BLOCKS    1024
+/**
+ * Maximum number of pages of the counter table. 16 covers every device
+ * with up to 1024 blocks.
+ **/
+#define AT45_WEAR_TABLE_PAGES   16
+/**
+ * Number of erase operations after which update() writes the journal.
+ **/
+#define AT45_WEAR_FLUSH_EVENTS  1024
+/**
+ * Pending count of a block after which update() writes the journal.
+ * Pending counts saturate at 255, update() must be called often enough
+ * for a block not to be erased that many times between two calls.
+ **/
+#define AT45_WEAR_FLUSH_DELTA   192
+/**
+ * @}
+ **/
+
+/**
+ * Per block erase counters, saved to a reserved sector.
+ * The journal watches every erase (including the built-in erase of page
+ * programs) through the %Dataflash modify hook, and counts them in RAM
+ * as pending counts of 1 byte per block.
+ * The counters themselves are a table of 4 bytes per block stored in the
+ * reserved sector, a few pages long. Writing the journal rewrites the
+ * table pages with pending counts to free pages of the sector, in turn,
+ * which spreads the journal wear over the whole sector.
+ * @note Journal pages are written through the SRAM buffer given to the
+ * constructor, its content is lost when the journal is written.
+ **/
+class DataFlashWearJournal
+{
+    public:
+        /**
+         * Constructor.
+         * @param dataflash %Dataflash device.
+         * @param bufferNum SRAM buffer used to write the journal (0 or 1).
+         **/
+        DataFlashWearJournal(DataFlash &dataflash, uint8_t bufferNum=1);
+
+        /**
+         * Load the counter table location from the reserved sector and
+         * start watching erase operations.
+         * @param sector Sector reserved for the journal. It must not be
+         *        used for anything else.
+         * @return true if saved counters were found, false if the
+         *         journal starts from scratch or if the device isn't
+         *         supported (blocks() is then 0).
+         **/
+        bool begin(int8_t sector);
+
+        /**
+         * Stop watching erase operations. Pending counts are not
+         * written, call flush() first if needed.
+         **/
+        void end();
+
+        /**
+         * Write the journal if enough erases are pending.
+         * This should be called regularly (from loop() for example).
+         * @return true if the journal was written.
+         **/
+        bool update();
+
+        /**
+         * Write all the pending counts to the journal.
+         * @return false if the reserved sector is protected, the counts
+         *         are then kept pending.
+         **/
+        bool flush();
+
+        /**
+         * Number of blocks tracked, 0 if begin() refused the device
+         * (more than AT45_WEAR_MAX_BLOCKS blocks, or a reserved sector
+         * too small for the counter table).
+         **/
+        inline uint16_t blocks() const;
+
+        /**
+         * Erase count of a block.
+         * The saved counter is read from the %Dataflash.
+         * @param block Block number.
+         **/
+        uint32_t eraseCount(uint16_t block) const;
+
+        /** Highest erase count, as of the last journal write. **/
+        inline uint32_t maxEraseCount() const;
+
+        /** Average erase count over all the blocks of the device. **/
+        uint32_t meanEraseCount() const;
+
+        /**
+         * Build a histogram of the erase counts.
+         * Bins are evenly spread from 0 to the highest erase count. The
+         * counter table is read from the %Dataflash.
+         * @param bins Bins, binCount entries.
+         * @param binCount Number of bins.
+         **/
+        void histogram(uint16_t *bins, uint8_t binCount) const;
+
+        /** Number of erase operations recorded (journal writes excluded). **/
+        inline uint32_t events() const;
+
+        /** Number of pages written by the journal itself. **/
+        inline uint32_t journalWrites() const;
+
+        /**
+         * Write amplification of the journal: pages programmed by the
+         * journal per thousand recorded erase operations.
+         **/
+        uint16_t overhead() const;
+
+    private:
+        /**
+         * Table page header.
+         **/
+        struct Header
+        {
+            uint8_t  index;     /**< Table page number. **/
+            uint8_t  pages;     /**< Number of pages of the table. **/
+            uint32_t sequence;  /**< Write sequence number. **/
+        };
+
+        /** %Dataflash modify hook. **/
+        static void onModify(void *context, uint8_t operation, uint16_t page, uint16_t count);
+
+        /** Count an erase of a block. **/
+        void record(uint16_t block);
+
+        /** Read a page header. **/
+        bool readHeader(uint16_t page, Header &header) const;
+
+        /** Check the CRC of a table page. **/
+        bool check(uint16_t page) const;
+
+        /**
+         * Rewrite a table page with its pending counts.
+         * @param index Table page number.
+         * @return false if the page couldn't be programmed.
+         **/
+        bool writePage(uint8_t index);
+
+        /**
+         * Read the counter table.
+         * @param total Sum of the erase counts (optional).
+         * @param bins Histogram bins (optional).
+         * @param binCount Number of bins.
+         * @param width Width of a bin.
+         * @return Highest erase count.
+         **/
+        uint32_t scan(uint32_t *total, uint16_t *bins, uint8_t binCount, uint32_t width) const;
+
+        /** Whether a page of the sector holds the current copy of a table page. **/
+        bool isCurrent(uint16_t page) const;
+
+        /** Move to the next page of the sector not holding a current table page. **/
+        void advance();
+
+        /** Number of counters per page. **/
+        inline uint16_t perPage() const;
+
+    private:
+        DataFlash &m_dataflash;         /**< %Dataflash device. **/
+        uint8_t    m_bufferNum;         /**< SRAM buffer used for writes. **/
+
+        DataFlash::ModifyHook m_previousHook;   /**< Modify hook to chain. **/
+        void      *m_previousContext;   /**< User data of the chained hook. **/
+
+        int8_t   m_sector;              /**< Reserved sector. **/
+        uint16_t m_first;               /**< First page of the reserved sector. **/
+        uint16_t m_pages;               /**< Number of pages of the reserved sector. **/
+        uint16_t m_next;                /**< Next page to write. **/
+        uint32_t m_sequence;            /**< Next page sequence number. **/
+        bool     m_writing;             /**< The journal is being written. **/
+
+        uint8_t  m_tablePages;          /**< Number of pages of the counter table. **/
+        uint16_t m_location[AT45_WEAR_TABLE_PAGES];     /**< Current copy of each table page (0xffff if never written). **/
+        uint8_t  m_deltas[AT45_WEAR_MAX_BLOCKS];        /**< Pending counts. **/
+        uint8_t  m_maxDelta;            /**< Highest pending count. **/
+        uint16_t m_blocks;              /**< Number of blocks tracked. **/
+
+        uint32_t m_max;                 /**< Highest saved erase count. **/
+        uint32_t m_total;               /**< Sum of the erase counts. **/
+        uint32_t m_events;              /**< Recorded erase operations. **/
+        uint32_t m_pending;             /**< Erase operations since the last write. **/
+        uint32_t m_writes;              /**< Pages written by the journal. **/
+};
+
+/** Number of blocks tracked. **/
+inline uint16_t DataFlashWearJournal::blocks() const
+{
+    return m_blocks;
+}
+
+/** Highest erase count, as of the last journal write. **/
+inline uint32_t DataFlashWearJournal::maxEraseCount() const
+{
+    return m_max;
+}
+
+/** Number of erase operations recorded (journal writes excluded). **/
+inline uint32_t DataFlashWearJournal::events() const
+{
+    return m_events;
+}
+
+/** Number of pages written by the journal itself. **/
+inline uint32_t DataFlashWearJournal::journalWrites() const
+{
+    return m_writes;
+}
+
+/**
+ * @}
+ **/
+
+#endif /* DATAFLASH_WEAR_JOURNAL_H_ */
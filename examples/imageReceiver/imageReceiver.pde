@@ -0,0 +1,42 @@
+#include <SPI.h>
+#include "DataFlash.h"
+#include "DataFlashImageReceiver.h"
+
+/*
+ * Factory programming sketch. Pack a binary file on the host with
+ *   imagepack pack 161 0 firmware.bin firmware.img
+ * then send it with
+ *   imagepack send firmware.img /dev/ttyUSB0
+ * The serial speed bounds the programming time, use the highest one the
+ * board supports.
+ */
+
+DataFlash dataflash;
+DataFlashImageReceiver receiver(dataflash, Serial);
+
+void setup()
+{
+  /* Initialize SPI */
+  SPI.begin();
+
+  /* Initialize dataflash */
+  dataflash.setup(5,6,7);
+
+  delay(10);
+
+  /* Set baud rate for serial communication */
+  Serial.begin(115200);
+}
+
+void loop()
+{
+  dataflash.begin();
+
+  /* Wait for an image. The result is reported to the host. */
+  if(Serial.available())
+  {
+    receiver.receive();
+  }
+
+  dataflash.end();
+}
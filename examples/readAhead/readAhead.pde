@@ -0,0 +1,110 @@
+#include <SPI.h>
+#include "DataFlash.h"
+#include "DataFlashReader.h"
+#include "DataFlashReadAhead.h"
+
+#define FIRST_PAGE 0
+#define NUM_PAGES  64
+
+DataFlash dataflash;
+uint8_t   buffer[64];
+
+/* Read NUM_PAGES pages with a continuous array read. */
+uint32_t scanArray()
+{
+  DataFlashReader reader(dataflash);
+  uint16_t pageSize = dataflash.pageSize();
+  uint32_t start = micros();
+
+  reader.seek(FIRST_PAGE);
+  for(uint16_t i=0; i<NUM_PAGES; i++)
+  {
+    for(uint16_t j=0; j<pageSize; j+=sizeof(buffer))
+    {
+      reader.read(buffer, min(sizeof(buffer), (size_t)(pageSize - j)));
+    }
+  }
+  reader.close();
+
+  return micros() - start;
+}
+
+/* Read NUM_PAGES pages through both SRAM buffers. */
+uint32_t scanReadAhead()
+{
+  DataFlashReadAhead scan(dataflash);
+  uint16_t pageSize = dataflash.pageSize();
+  uint32_t start = micros();
+
+  scan.begin(FIRST_PAGE, NUM_PAGES);
+  while(scan.next())
+  {
+    for(uint16_t j=0; j<pageSize; j+=sizeof(buffer))
+    {
+      scan.read(buffer, min(sizeof(buffer), (size_t)(pageSize - j)));
+    }
+  }
+  scan.end();
+
+  return micros() - start;
+}
+
+/* Read NUM_PAGES pages, waiting for each page to buffer transfer. */
+uint32_t scanBuffer()
+{
+  uint16_t pageSize = dataflash.pageSize();
+  uint32_t start = micros();
+
+  for(uint16_t i=0; i<NUM_PAGES; i++)
+  {
+    dataflash.pageToBuffer(FIRST_PAGE + i, 0);
+    dataflash.bufferRead(0, 0);
+    for(uint16_t j=0; j<pageSize; j++)
+    {
+      SPI.transfer(0xff);
+    }
+    dataflash.disable();
+  }
+
+  return micros() - start;
+}
+
+void report(const char *name, uint32_t elapsed)
+{
+  uint32_t bytes = (uint32_t)NUM_PAGES * dataflash.pageSize();
+
+  Serial.print(name);
+  Serial.print(elapsed);
+  Serial.print(" us, ");
+  Serial.print((bytes * 1000) / elapsed);
+  Serial.print(" kB/s\n");
+}
+
+void setup()
+{
+  /* Initialize SPI */
+  SPI.begin();
+
+  /* Let's wait 1 second, allowing use to press the serial monitor button :p */
+  delay(1000);
+
+  /* Initialize dataflash */
+  dataflash.setup(5,6,7);
+
+  delay(10);
+
+  dataflash.begin();
+
+  /* Set baud rate for serial communication */
+  Serial.begin(115200);
+}
+
+void loop()
+{
+  report("Array read      : ", scanArray());
+  report("Read-ahead      : ", scanReadAhead());
+  report("Buffer (no r/a) : ", scanBuffer());
+  Serial.print('\n');
+
+  delay(5000);
+}
@@ -0,0 +1,92 @@
+#include <SPI.h>
+#include "DataFlash.h"
+
+/* Number of reads per measure. */
+#define NUM_READS 256
+
+DataFlash dataflash;
+uint8_t   buffer[256];
+
+/* SPI clocks to try (Hz). Frequencies above the MCU capability are
+ * rounded down by the SPI library. */
+const uint32_t clocks[] = { 4000000, 8000000, 16000000, 24000000, 33000000, 48000000, 66000000 };
+/* Read sizes (bytes). */
+const uint16_t sizes[] = { 4, 16, 64, 256 };
+
+/* Time NUM_READS array reads of the given size. */
+uint32_t measure(uint16_t size)
+{
+  uint32_t start = micros();
+
+  for(uint16_t i=0; i<NUM_READS; i++)
+  {
+    dataflash.arrayRead(i, 0);
+    for(uint16_t j=0; j<size; j++)
+    {
+      buffer[j] = SPI.transfer(0xff);
+    }
+    dataflash.disable();
+  }
+
+  return micros() - start;
+}
+
+void setup()
+{
+  /* Initialize SPI */
+  SPI.begin();
+
+  /* Let's wait 1 second, allowing use to press the serial monitor button :p */
+  delay(1000);
+
+  /* Initialize dataflash */
+  dataflash.setup(5,6,7);
+
+  delay(10);
+
+  /* Set baud rate for serial communication */
+  Serial.begin(115200);
+}
+
+void loop()
+{
+  /* For each clock, compare the low frequency opcodes with the high
+   * frequency ones (one more don't care byte per command). setClock()
+   * picks the low frequency opcodes up to 33MHz, the high frequency ones
+   * above. */
+  Serial.print("clock(Hz) size low(us) high(us)\n");
+  for(uint8_t c=0; c<(sizeof(clocks)/sizeof(clocks[0])); c++)
+  {
+    dataflash.setClock(clocks[c]);
+    dataflash.begin();
+
+    for(uint8_t s=0; s<(sizeof(sizes)/sizeof(sizes[0])); s++)
+    {
+      Serial.print(clocks[c]);
+      Serial.print(' ');
+      Serial.print(sizes[s]);
+      Serial.print(' ');
+
+      if(clocks[c] <= 33000000)
+      {
+        dataflash.setTransferSpeed(DataFlash::SPEED_LOW);
+        Serial.print(measure(sizes[s]));
+      }
+      else
+      {
+        /* Low frequency opcodes are out of spec. */
+        Serial.print('-');
+      }
+      Serial.print(' ');
+
+      dataflash.setTransferSpeed(DataFlash::SPEED_HIGH);
+      Serial.print(measure(sizes[s]));
+      Serial.print('\n');
+    }
+
+    dataflash.end();
+  }
+  Serial.print('\n');
+
+  delay(10000);
+}
@@ -0,0 +1,68 @@
+#include <SPI.h>
+#include "DataFlash.h"
+
+/* Number of bytes dumped. */
+#define DUMP_LENGTH 4096
+
+DataFlash dataflash;
+
+/* Send a chunk to the serial port. */
+bool serialSink(const uint8_t *data, uint16_t length)
+{
+  Serial.write(data, length);
+  return true;
+}
+
+/* Sink computing a checksum of the data. readTo() works on a copy of
+ * the sink, so the sum is kept outside. */
+struct SumSink
+{
+  uint32_t *sum;
+
+  bool operator()(const uint8_t *data, uint16_t length)
+  {
+    for(uint16_t i=0; i<length; i++)
+    {
+      *sum += data[i];
+    }
+    return true;
+  }
+};
+
+void setup()
+{
+  /* Initialize SPI */
+  SPI.begin();
+
+  /* Let's wait 1 second, allowing use to press the serial monitor button :p */
+  delay(1000);
+
+  /* Initialize dataflash */
+  dataflash.setup(5,6,7);
+
+  delay(10);
+
+  /* Set baud rate for serial communication */
+  Serial.begin(115200);
+}
+
+void loop()
+{
+  dataflash.begin();
+
+  /* Dump the first pages, 32 bytes at a time. Only the 32 bytes chunk
+   * is held in RAM, whatever the length. */
+  dataflash.readTo<32>(0, 0, DUMP_LENGTH, serialSink);
+  Serial.print('\n');
+
+  /* Same thing with a functor and larger chunks. */
+  uint32_t sum = 0;
+  SumSink sink = { &sum };
+  dataflash.readTo<64>(0, 0, DUMP_LENGTH, sink);
+  Serial.print("sum: ");
+  Serial.println(sum);
+
+  dataflash.end();
+
+  delay(10000);
+}
@@ -0,0 +1,136 @@
+/**************************************************************************//**
+ * @file extras/hostsim/Arduino.h
+ * @brief Arduino core stub for the AT45DBxxxD Atmel Dataflash host simulation.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Minimal Arduino core for the host simulation: only what the library and
+ * the simulation programs use. Time is simulated (see hostsim.h), it only
+ * advances with SPI transfers and calls to micros(), delay() and
+ * delayMicroseconds().
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef HOSTSIM_ARDUINO_H_
+#define HOSTSIM_ARDUINO_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARDUINO
+#define ARDUINO 100
+#endif
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+
+#define DEC     10
+#define HEX     16
+
+#define lowByte(w)  ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void noInterrupts();
+void interrupts();
+
+/**
+ * Character output.
+ **/
+class Print
+{
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        size_t write(const uint8_t *buffer, size_t size);
+
+        size_t print(const char *s);
+        size_t print(char c);
+        size_t print(unsigned long n, int base=DEC);
+        size_t print(long n, int base=DEC);
+        size_t print(unsigned int n, int base=DEC)  { return print((unsigned long)n, base); }
+        size_t print(int n, int base=DEC)           { return print((long)n, base); }
+        size_t print(unsigned char n, int base=DEC) { return print((unsigned long)n, base); }
+
+        size_t println()                              { return print('\n'); }
+        size_t println(const char *s)                 { return print(s) + println(); }
+        size_t println(unsigned long n, int base=DEC) { return print(n, base) + println(); }
+        size_t println(long n, int base=DEC)          { return print(n, base) + println(); }
+        size_t println(unsigned int n, int base=DEC)  { return print(n, base) + println(); }
+        size_t println(int n, int base=DEC)           { return print(n, base) + println(); }
+};
+
+/**
+ * Character input and output.
+ **/
+class Stream : public Print
+{
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() { return -1; }
+
+        void setTimeout(unsigned long timeout) { m_timeout = timeout; }
+        size_t readBytes(uint8_t *buffer, size_t length);
+        size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+
+    protected:
+        Stream() : m_timeout(1000) {}
+
+        unsigned long m_timeout;
+};
+
+/**
+ * Serial port writing to the standard output. Nothing is ever received.
+ **/
+class HardwareSerial : public Stream
+{
+    public:
+        void begin(unsigned long) {}
+        void flush() {}
+        operator bool() { return true; }
+
+        int available() { return 0; }
+        int read() { return -1; }
+        size_t write(uint8_t c);
+        using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif /* HOSTSIM_ARDUINO_H_ */
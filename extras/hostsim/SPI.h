@@ -0,0 +1,76 @@
+/**************************************************************************//**
+ * @file extras/hostsim/SPI.h
+ * @brief SPI library stub for the AT45DBxxxD Atmel Dataflash host simulation.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * SPI library stub for the host simulation. Transfers go to the simulated
+ * device whose chip select is low.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef HOSTSIM_SPI_H_
+#define HOSTSIM_SPI_H_
+
+#include "Arduino.h"
+
+#define SPI_MODE0       0x00
+#define SPI_MODE3       0x0C
+#define MSBFIRST        1
+#define SPI_CLOCK_DIV2  0x04
+
+/**
+ * SPI transaction settings (ignored).
+ **/
+class SPISettings
+{
+    public:
+        SPISettings() {}
+        SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+/**
+ * SPI bus.
+ * Each byte transferred takes 1 us of simulated time (8 MHz clock).
+ **/
+class SPIClass
+{
+    public:
+        static uint8_t transfer(uint8_t data);
+        static void transfer(void *buffer, size_t count);
+
+        static void begin() {}
+        static void end() {}
+        static void setDataMode(uint8_t) {}
+        static void setBitOrder(uint8_t) {}
+        static void setClockDivider(uint8_t) {}
+        static void beginTransaction(SPISettings) {}
+        static void endTransaction() {}
+};
+
+extern SPIClass SPI;
+
+#endif /* HOSTSIM_SPI_H_ */
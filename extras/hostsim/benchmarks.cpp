@@ -0,0 +1,486 @@
+/**************************************************************************//**
+ * @file extras/hostsim/benchmarks.cpp
+ * @brief Benchmarks of the AT45DBxxxD Atmel Dataflash library on the host
+ * simulation.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Measurements of several modules of the library on a simulated
+ * AT45DB161D:
+ * - SPI traffic of DataFlashConfigStore::load(), and save() without a
+ *   prior load(),
+ * - DataFlashCompressor ratio on CSV sensor records, round trip, and host
+ *   CPU time per byte of write() and read(),
+ * - bytes read by a DataFlashTimeSeries range query compared to a full
+ *   scan,
+ * - duration of an 8 pages DataFlash::copyPages(),
+ * - page scan throughput of DataFlashReadAhead compared to a continuous
+ *   DataFlash::arrayRead(),
+ * - status polls of DataFlash::waitUntilReady() compared to a tight poll
+ *   loop, and status polls of a page compare,
+ * - delay between the end of a sector erase and its detection,
+ * - accuracy of the calibrated typical times,
+ * - interval between yield hook calls during programs and erases, and
+ *   accuracy of the calibrated typical times with the hook.
+ * Each measurement is checked against a bound, the program exits with a non
+ * zero status if one doesn't hold.
+ *
+ * Build with: g++ -std=gnu++11 -O2 -DARDUINO=100 -I. -I../.. -o benchmarks
+ * benchmarks.cpp hostsim.cpp ../../DataFlash*.cpp
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "hostsim.h"
+#include "DataFlash.h"
+#include "DataFlashConfigStore.h"
+#include "DataFlashCompressor.h"
+#include "DataFlashTimeSeries.h"
+#include "DataFlashReadAhead.h"
+
+/** Number of failed checks. **/
+static int failures = 0;
+
+/** Report a measurement and check it against a bound. **/
+static void report(const char *name, double value, const char *unit, bool ok)
+{
+    printf("%-44s %12.2f %-8s %s\n", name, value, unit, ok ? "ok" : "FAILED");
+    if(!ok)
+    {
+        ++failures;
+    }
+}
+
+/** Host clock used for CPU time measurements. **/
+typedef std::chrono::steady_clock Clock;
+
+/** Host time elapsed since start, in nanoseconds. **/
+static double nanoseconds(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+/** Bytes transferred with the simulated device. **/
+static unsigned long traffic(uint8_t cs)
+{
+    return hostsimDevice(cs)->bytes;
+}
+
+/**
+ * Configuration store: SPI traffic of load(), and save() on a store that
+ * was never loaded.
+ **/
+static void configStore(DataFlash &dataflash, uint8_t cs)
+{
+    struct Config
+    {
+        uint32_t id;
+        char     name[20];
+    } config = { 1, "benchmark" }, loaded;
+
+    DataFlashConfigStore store(dataflash);
+    store.begin(10, 20);
+    store.save(&config, sizeof(config));
+    config.id = 2;
+    store.save(&config, sizeof(config));
+
+    DataFlashConfigStore other(dataflash);
+    other.begin(10, 20);
+    unsigned long before = traffic(cs);
+    int16_t length = other.load(&loaded, sizeof(loaded));
+    unsigned long bytes = traffic(cs) - before;
+
+    report("config store load (bytes)", bytes, "bytes",
+           (length == (int16_t)sizeof(config)) && (loaded.id == 2) && (bytes <= 100));
+
+    /* A save straight after begin() must supersede the newest slot. */
+    DataFlashConfigStore fresh(dataflash);
+    fresh.begin(10, 20);
+    config.id = 3;
+    int8_t saved = fresh.save(&config, sizeof(config));
+    other.begin(10, 20);
+    length = other.load(&loaded, sizeof(loaded));
+    report("config store version after a fresh save", other.version(), "",
+           (saved == 1) && (length == (int16_t)sizeof(config)) && (loaded.id == 3) && (other.version() == 3));
+}
+
+/**
+ * Compressor: ratio on CSV sensor records, round trip, and host CPU time per
+ * byte of write() and read(), simulated SPI transfers included.
+ **/
+static void compressor(DataFlash &dataflash)
+{
+    static char input[50000];
+    static uint8_t output[sizeof(input)];
+
+    /* timestamp,temperature,state records. */
+    uint16_t length = 0;
+    for(uint16_t i=0; length<(sizeof(input) - 32); i++)
+    {
+        int temperature = 200 + ((i / 8) % 20) - ((i / 64) % 10);
+        length += snprintf(input + length, 32, "%u,%d,%u\n", 1000 + i, temperature, i % 7);
+    }
+
+    DataFlashCompressor compressor(dataflash);
+    compressor.begin(100, 200);
+    Clock::time_point start = Clock::now();
+    for(uint16_t i=0; i<length; i+=37)
+    {
+        compressor.write(input + i, ((length - i) < 37) ? (length - i) : 37);
+    }
+    compressor.flush();
+    double writeCost = nanoseconds(start) / length;
+
+    DataFlashDecompressor decompressor(dataflash);
+    uint16_t position = 0;
+    bool ok = true;
+    start = Clock::now();
+    for(uint16_t page=100; page<compressor.page(); page++)
+    {
+        int16_t frame = decompressor.frameLength(page);
+        if((frame < 0) || ((position + (uint16_t)frame) > sizeof(output)) ||
+           (decompressor.read(page, 0, output + position, frame) != frame))
+        {
+            ok = false;
+            break;
+        }
+        position += frame;
+    }
+    double readCost = nanoseconds(start) / length;
+    ok = ok && (position == length) && (memcmp(input, output, length) == 0);
+
+    double ratio = (double)compressor.rawBytes() / compressor.compressedBytes();
+    report("compressor ratio on CSV records", ratio, ":1", ok && (ratio >= 1.5));
+    /* Loose bounds: only a gross regression of the encoder or decoder
+     * loops should fail on a slow or loaded host. */
+    report("compressor write() host CPU time", writeCost, "ns/byte", writeCost < 2000.0);
+    report("decompressor read() host CPU time", readCost, "ns/byte", readCost < 2000.0);
+}
+
+/** Time series query callback. **/
+static void count(void *context, uint32_t, const int16_t *)
+{
+    ++*static_cast<uint32_t*>(context);
+}
+
+/**
+ * Time series: bytes read by a range query.
+ **/
+static void timeSeries(DataFlash &dataflash)
+{
+    DataFlashTimeSeries series(dataflash);
+    series.begin(1, 3, 2);
+
+    /* Two full sectors and part of a third one. */
+    for(uint32_t t=0; t<32000; t++)
+    {
+        int16_t values[2] = { (int16_t)(t * 3), (int16_t)-t };
+        series.append(t, values);
+    }
+    series.flush();
+
+    uint32_t found = 0;
+    series.query(20000, 20099, count, &found);
+    uint32_t full = 3UL * dataflash.sectorPageCount(1) * dataflash.pageSize();
+
+    report("time series 100 records query (bytes)", series.queryBytes(), "bytes",
+           (found == 100) && (series.queryBytes() < (full / 100)));
+}
+
+/**
+ * Page copy: duration of 8 pages.
+ **/
+static void copy(DataFlash &dataflash, uint8_t cs)
+{
+    const HostSimTimings &timings = hostsimDevice(cs)->timings;
+
+    uint64_t start = hostsimNow();
+    dataflash.copyPages(300, 320, 8);
+    dataflash.waitUntilReady();
+    double elapsed = (hostsimNow() - start) / 1000.0;
+
+    /* The chip runs one operation at a time: transfer then program, plus
+     * the polling delay at the end of each operation. */
+    double bound = 8 * (timings.transfer + timings.eraseProgram) * 1.1 / 1000.0;
+    report("copy of 8 pages", elapsed, "ms", elapsed <= bound);
+}
+
+/** Pages read by each scan. **/
+#define SCAN_PAGES      64
+
+/**
+ * Scan throughput in kB/s: continuous array read, read-ahead through both
+ * buffers, and page to buffer transfers waited for. The simulation counts
+ * 1 us per SPI byte.
+ **/
+static void scan(DataFlash &dataflash)
+{
+    static uint8_t expected[SCAN_PAGES][HostSimDevice::PAGE_SIZE];
+    uint8_t  chunk[64];
+    uint16_t pageSize = dataflash.pageSize();
+    double   rate[3];
+    bool     ok = true;
+
+    for(uint8_t mode=0; mode<3; mode++)
+    {
+        DataFlashReadAhead readAhead(dataflash);
+        uint64_t start = hostsimNow();
+
+        if(mode == 0)
+        {
+            dataflash.arrayRead(700);
+            for(uint16_t i=0; i<SCAN_PAGES; i++)
+            {
+                dataflash.transfer(expected[i], pageSize);
+            }
+            dataflash.disable();
+        }
+        else
+        {
+            if(mode == 1)
+            {
+                readAhead.begin(700, SCAN_PAGES);
+            }
+            for(uint16_t i=0; i<SCAN_PAGES; i++)
+            {
+                if(mode == 1)
+                {
+                    readAhead.next();
+                }
+                else
+                {
+                    dataflash.pageToBuffer(700 + i, 0);
+                    dataflash.bufferRead(0, 0);
+                }
+                for(uint16_t j=0; j<pageSize; j+=sizeof(chunk))
+                {
+                    uint16_t length = ((pageSize - j) < (uint16_t)sizeof(chunk)) ? (pageSize - j) : sizeof(chunk);
+                    if(mode == 1)
+                    {
+                        readAhead.read(chunk, length);
+                    }
+                    else
+                    {
+                        memset(chunk, 0xff, length);
+                        dataflash.transfer(chunk, length);
+                    }
+                    ok = ok && (memcmp(chunk, expected[i] + j, length) == 0);
+                }
+                if(mode == 2)
+                {
+                    dataflash.disable();
+                }
+            }
+            readAhead.end();
+        }
+
+        rate[mode] = (double)SCAN_PAGES * pageSize * 1000.0 / (hostsimNow() - start);
+    }
+
+    report("array read scan", rate[0], "kB/s", true);
+    report("read-ahead scan", rate[1], "kB/s", ok && (rate[1] >= 0.95 * rate[0]));
+    report("scan waiting for each page transfer", rate[2], "kB/s", ok && (rate[2] < rate[1]));
+}
+
+/**
+ * Status polling: waitUntilReady() against a tight poll loop.
+ **/
+static void polling(DataFlash &dataflash, uint8_t cs)
+{
+    HostSimDevice *device = hostsimDevice(cs);
+    unsigned long polls[2];
+
+    for(uint8_t tight=0; tight<2; tight++)
+    {
+        unsigned long before = device->statusPolls;
+        for(uint16_t i=0; i<50; i++)
+        {
+            dataflash.bufferToPage(0, 400 + i);
+            if(tight)
+            {
+                while(!(dataflash.status() & AT45_READY))
+                {}
+            }
+            else
+            {
+                dataflash.waitUntilReady();
+            }
+        }
+        for(uint16_t i=0; i<10; i++)
+        {
+            dataflash.blockErase(60 + i);
+            if(tight)
+            {
+                while(!(dataflash.status() & AT45_READY))
+                {}
+            }
+            else
+            {
+                dataflash.waitUntilReady();
+            }
+        }
+        polls[tight] = device->statusPolls - before;
+    }
+
+    double saved = 100.0 * (polls[1] - polls[0]) / polls[1];
+    printf("status polls: %lu with waitUntilReady(), %lu with a tight loop\n", polls[0], polls[1]);
+    report("status polls saved", saved, "%", saved >= 90.0);
+
+    /* Compares follow the typical compare time too. */
+    unsigned long comparePolls = 0;
+    bool equal = true;
+    for(uint16_t i=0; i<50; i++)
+    {
+        dataflash.pageToBuffer(400 + i, 0);
+        dataflash.waitUntilReady();
+        unsigned long start = device->statusPolls;
+        equal = dataflash.isPageEqualBuffer(400 + i, 0) && equal;
+        comparePolls += device->statusPolls - start;
+    }
+    report("status polls per page compare", comparePolls / 50.0, "polls",
+           equal && (comparePolls <= 50 * 8));
+
+    /* An erase ending early in the polling phase is seen within the
+     * longest poll interval. */
+    uint32_t typical = dataflash.typicalTime(DataFlash::TIMING_SECTOR_ERASE);
+    uint32_t actual  = device->timings.sectorErase;
+    device->timings.sectorErase = typical - (typical >> 2) + (typical >> 6);
+    uint64_t start = hostsimNow();
+    dataflash.sectorErase(3);
+    dataflash.waitUntilReady();
+    double late = (double)(hostsimNow() - start) - device->timings.sectorErase;
+    device->timings.sectorErase = actual;
+    dataflash.setTypicalTime(DataFlash::TIMING_SECTOR_ERASE, typical);
+    report("sector erase end seen late by", late, "us", late <= 2 * AT45_POLL_MAX_INTERVAL);
+}
+
+/**
+ * Timing model: accuracy of the calibrated typical times.
+ **/
+static void calibration(DataFlash &dataflash, uint8_t cs)
+{
+    const HostSimTimings &timings = hostsimDevice(cs)->timings;
+
+    for(uint16_t i=0; i<50; i++)
+    {
+        dataflash.bufferToPage(0, 500 + i);
+        dataflash.waitUntilReady();
+    }
+    for(uint16_t i=0; i<10; i++)
+    {
+        dataflash.blockErase(80 + i);
+        dataflash.waitUntilReady();
+    }
+
+    double program = 100.0 * ((double)dataflash.typicalTime(DataFlash::TIMING_ERASE_PROGRAM) - timings.eraseProgram) / timings.eraseProgram;
+    double erase   = 100.0 * ((double)dataflash.typicalTime(DataFlash::TIMING_BLOCK_ERASE) - timings.blockErase) / timings.blockErase;
+    /* The end of an operation is only known within a poll interval. */
+    report("calibrated program time error", program, "%", (program > -2.0) && (program < 2.0));
+    report("calibrated block erase time error", erase, "%", (erase > -2.0) && (erase < 2.0));
+}
+
+/** Yield hook measuring the interval between calls. **/
+struct YieldProbe
+{
+    uint64_t last;      /**< Time of the last call (0 at the start of a wait). **/
+    uint64_t worst;     /**< Longest interval between two calls. **/
+    uint32_t calls;     /**< Number of calls. **/
+};
+
+static void probe(void *context, uint32_t)
+{
+    YieldProbe *p = static_cast<YieldProbe*>(context);
+    uint64_t now = hostsimNow();
+    if(p->last && ((now - p->last) > p->worst))
+    {
+        p->worst = now - p->last;
+    }
+    p->last = now;
+    ++p->calls;
+
+    /* Some work. */
+    delayMicroseconds(300);
+}
+
+/**
+ * Yield hook: interval between calls, and calibration of the typical
+ * times.
+ **/
+static void yieldHook(DataFlash &dataflash, uint8_t cs)
+{
+    const HostSimTimings &timings = hostsimDevice(cs)->timings;
+    YieldProbe p = { 0, 0, 0 };
+
+    dataflash.setYieldHook(probe, &p);
+    for(uint16_t i=0; i<50; i++)
+    {
+        dataflash.bufferToPage(0, 600 + i);
+        dataflash.waitUntilReady();
+        p.last = 0;
+    }
+    for(uint16_t i=0; i<10; i++)
+    {
+        dataflash.blockErase(100 + i);
+        dataflash.waitUntilReady();
+        p.last = 0;
+    }
+    dataflash.setYieldHook(0, 0);
+
+    report("longest interval between 300 us hooks", (double)p.worst, "us",
+           (p.calls > 0) && (p.worst <= (300 + 2*AT45_POLL_MIN_INTERVAL)));
+
+    double program = 100.0 * ((double)dataflash.typicalTime(DataFlash::TIMING_ERASE_PROGRAM) - timings.eraseProgram) / timings.eraseProgram;
+    double erase   = 100.0 * ((double)dataflash.typicalTime(DataFlash::TIMING_BLOCK_ERASE) - timings.blockErase) / timings.blockErase;
+    /* The end of an operation is only known within a poll interval, here
+     * stretched by the hook. */
+    report("calibrated program time error with the hook", program, "%", (program > -2.0) && (program < 2.0));
+    report("calibrated erase time error with the hook", erase, "%", (erase > -2.0) && (erase < 2.0));
+}
+
+int main()
+{
+    const uint8_t cs = 10;
+    hostsimAddDevice(cs);
+
+    DataFlash dataflash;
+    dataflash.setup(cs);
+    dataflash.begin();
+
+    configStore(dataflash, cs);
+    compressor(dataflash);
+    timeSeries(dataflash);
+    copy(dataflash, cs);
+    scan(dataflash);
+    polling(dataflash, cs);
+    calibration(dataflash, cs);
+    yieldHook(dataflash, cs);
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/**************************************************************************//**
+ * @file extras/hostsim/dual_logger_stall.cpp
+ * @brief Write stalls of the AT45DBxxxD Atmel Dataflash dual device logger.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Checks that DataFlashDualLogger hides sector erases: a producer logs 32
+ * bytes records at a fixed rate on two simulated AT45DB161D, with the
+ * typical and the maximum erase times of the datasheet. As long as a
+ * sector is filled in more time than the other device needs to erase its
+ * next one, write() must never wait for an erase (no erase stall), and the
+ * longest write() call must stay within a page program. A producer too
+ * fast for the maximum erase time must get erase stalls, which are counted.
+ * The sector erase a single device logger would wait for is reported for
+ * comparison.
+ *
+ * Build with: g++ -std=gnu++11 -O2 -DARDUINO=100 -I. -I../.. -o
+ * dual_logger_stall dual_logger_stall.cpp hostsim.cpp ../../DataFlash*.cpp
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+
+#include "hostsim.h"
+#include "DataFlashDualLogger.h"
+
+/** Record length (bytes). **/
+#define RECORD_SIZE     32
+
+/** Number of sectors filled by each run. **/
+#define SECTORS         6
+
+/** Maximum timings of the AT45DB161D datasheet. **/
+static const HostSimTimings maximum =
+{
+    200,        /* tXFR */
+    4000,       /* tP */
+    35000,      /* tEP */
+    35000,      /* tPE */
+    75000,      /* tBE */
+    5000000,    /* tSE */
+    1000
+};
+
+/** Number of failed checks. **/
+static int failures = 0;
+
+/**
+ * Log records at a fixed rate on two new devices.
+ * @param name Run name.
+ * @param timings Device timings.
+ * @param interval Interval between two records (us).
+ * @param stalls Whether erase stalls are expected.
+ **/
+static void run(const char *name, const HostSimTimings *timings, uint32_t interval, bool stalls)
+{
+    /* Each run gets its own pair of devices. */
+    static uint8_t cs = 2;
+    DataFlash first, second;
+    for(uint8_t i=0; i<2; i++, cs++)
+    {
+        HostSimDevice *device = hostsimAddDevice(cs);
+        if(timings)
+        {
+            device->timings = *timings;
+        }
+        (i ? second : first).setup(cs);
+        (i ? second : first).begin();
+    }
+    const HostSimTimings &used = hostsimDevice(cs - 1)->timings;
+
+    DataFlashDualLogger logger(first, second);
+    logger.begin(1, 3);
+
+    uint8_t record[RECORD_SIZE];
+    uint32_t count = (uint32_t)SECTORS * first.sectorPageCount(1) * first.pageSize() / RECORD_SIZE;
+    uint64_t due = hostsimNow();
+    bool written = true;
+    for(uint32_t i=0; i<count; i++)
+    {
+        for(uint8_t j=0; j<RECORD_SIZE; j++)
+        {
+            record[j] = (uint8_t)(i + j);
+        }
+        written = logger.write(record, sizeof(record)) && written;
+
+        due += interval;
+        uint64_t now = hostsimNow();
+        if(now < due)
+        {
+            hostsimAdvance((uint32_t)(due - now));
+        }
+    }
+
+    /* Time a sector takes to fill at this rate. */
+    uint32_t fill = (uint32_t)(((uint64_t)first.sectorPageCount(1) * first.pageSize() / RECORD_SIZE) * interval / 1000);
+    bool ok = written && (stalls ? (logger.eraseStalls() > 0) :
+                                   ((logger.eraseStalls() == 0) && (logger.maxStall() <= used.program)));
+    printf("%-8s tSE %4lu ms, sector filled in %4lu ms: longest write %7lu us, erase stalls %2lu  %s\n",
+           name, (unsigned long)(used.sectorErase / 1000), (unsigned long)fill,
+           (unsigned long)logger.maxStall(), (unsigned long)logger.eraseStalls(),
+           ok ? "ok" : "FAILED");
+    if(!ok)
+    {
+        ++failures;
+    }
+}
+
+int main()
+{
+    run("typical", 0, 500, false);
+    run("typical", 0, 1500, false);
+    run("maximum", &maximum, 1500, false);
+    run("maximum", &maximum, 500, true);
+
+    /* A single device logger has to wait for the erase of its next sector. */
+    hostsimAddDevice(1);
+    DataFlash single;
+    single.setup(1);
+    single.begin();
+    uint64_t start = hostsimNow();
+    single.sectorErase(2);
+    single.waitUntilReady();
+    printf("single device sector erase stall: %lu us\n", (unsigned long)(hostsimNow() - start));
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,631 @@
+/**************************************************************************//**
+ * @file extras/hostsim/hostsim.cpp
+ * @brief Simulated AT45DBxxxD devices for host checks of the Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Please refer to @ref extras/hostsim/hostsim.cpp for more informations.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <atomic>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "hostsim.h"
+
+SPIClass SPI;
+HardwareSerial Serial;
+
+/** Simulated time (in us). Shared by all the threads of a program. **/
+static std::atomic<uint64_t> now(0);
+/** Interrupts are enabled. **/
+static bool interruptsEnabled = true;
+/** Time seen by micros() while interrupts are disabled. **/
+static uint64_t frozen = 0;
+
+/** Simulated devices. **/
+static std::vector<HostSimDevice*> devices;
+
+/** Typical timings of the AT45DB161D datasheet. **/
+static const HostSimTimings typical =
+{
+    200,        /* tXFR */
+    2000,       /* tP */
+    14000,      /* tEP */
+    13000,      /* tPE */
+    30000,      /* tBE */
+    1600000,    /* tSE */
+    1000
+};
+
+/*
+ * Arduino core.
+ */
+
+void pinMode(uint8_t, uint8_t)
+{}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    HostSimDevice *device = hostsimDevice(pin);
+    if(device == 0)
+    {
+        return;
+    }
+
+    if((value == LOW) && !device->selected)
+    {
+        for(size_t i=0; i<devices.size(); i++)
+        {
+            if(devices[i]->selected)
+            {
+                fprintf(stderr, "hostsim: pins %u and %u selected at once\n", devices[i]->cs, pin);
+                abort();
+            }
+        }
+        device->selected = true;
+        device->command.clear();
+    }
+    else if((value == HIGH) && device->selected)
+    {
+        device->selected = false;
+        device->release();
+    }
+}
+
+/*
+ * The timer interrupt doesn't run while interrupts are disabled: micros()
+ * and millis() don't move, though the devices go on with their operations.
+ */
+
+unsigned long micros()
+{
+    if(!interruptsEnabled)
+    {
+        return (unsigned long)frozen;
+    }
+    return (unsigned long)(++now);
+}
+
+unsigned long millis()
+{
+    return (unsigned long)((interruptsEnabled ? now.load() : frozen) / 1000);
+}
+
+void delay(unsigned long ms)
+{
+    now += ms * 1000ULL;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    now += us;
+}
+
+void yield()
+{
+    ++now;
+}
+
+void noInterrupts()
+{
+    if(interruptsEnabled)
+    {
+        frozen = now;
+        interruptsEnabled = false;
+    }
+}
+
+void interrupts()
+{
+    interruptsEnabled = true;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while(size--)
+    {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(const char *s)
+{
+    return write((const uint8_t*)s, strlen(s));
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char digits[33];
+    char *p = &digits[sizeof(digits) - 1];
+    *p = '\0';
+    do
+    {
+        unsigned long digit = n % base;
+        *--p = (char)((digit < 10) ? ('0' + digit) : ('A' + digit - 10));
+        n /= base;
+    } while(n);
+    return print(p);
+}
+
+size_t Print::print(long n, int base)
+{
+    if((n < 0) && (base == DEC))
+    {
+        return print('-') + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+    size_t count = 0;
+    unsigned long start = millis();
+    while((count < length) && ((millis() - start) < m_timeout))
+    {
+        int c = read();
+        if(c < 0)
+        {
+            yield();
+            continue;
+        }
+        buffer[count++] = (uint8_t)c;
+    }
+    return count;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return (fputc(c, stdout) == EOF) ? 0 : 1;
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+    ++now;
+    for(size_t i=0; i<devices.size(); i++)
+    {
+        if(devices[i]->selected)
+        {
+            return devices[i]->transfer(data);
+        }
+    }
+    return 0xff;
+}
+
+void SPIClass::transfer(void *buffer, size_t count)
+{
+    uint8_t *p = static_cast<uint8_t*>(buffer);
+    while(count--)
+    {
+        *p = transfer(*p);
+        ++p;
+    }
+}
+
+/*
+ * Simulation control.
+ */
+
+HostSimDevice *hostsimAddDevice(uint8_t cs)
+{
+    HostSimDevice *device = new HostSimDevice(cs);
+    devices.push_back(device);
+    return device;
+}
+
+HostSimDevice *hostsimDevice(uint8_t cs)
+{
+    for(size_t i=0; i<devices.size(); i++)
+    {
+        if(devices[i]->cs == cs)
+        {
+            return devices[i];
+        }
+    }
+    return 0;
+}
+
+uint64_t hostsimNow()
+{
+    return now;
+}
+
+void hostsimAdvance(uint32_t us)
+{
+    now += us;
+}
+
+bool hostsimInterruptsEnabled()
+{
+    return interruptsEnabled;
+}
+
+/*
+ * Simulated device.
+ */
+
+HostSimDevice::HostSimDevice(uint8_t pin)
+    : cs(pin)
+    , timings(typical)
+    , memory((size_t)PAGES * PAGE_SIZE, 0xff)
+    , protectionEnabled(false)
+    , powerDown(false)
+    , compareMismatch(false)
+    , failPage(-1)
+    , failCount(0)
+    , statusPolls(0)
+    , bytes(0)
+    , programs(0)
+    , erases(0)
+    , selected(false)
+    , address(0)
+    , busyUntil(0)
+    , busyBuffer(-1)
+{
+    buffer[0].assign(PAGE_SIZE, 0);
+    buffer[1].assign(PAGE_SIZE, 0);
+    memset(protection, 0, sizeof(protection));
+}
+
+bool HostSimDevice::busy() const
+{
+    return now < busyUntil;
+}
+
+uint8_t HostSimDevice::status() const
+{
+    /* Density code of the AT45DB161D, standard page size. */
+    return (busy() ? 0x00 : 0x80) | (compareMismatch ? 0x40 : 0x00) | 0x2c |
+           (protectionEnabled ? 0x02 : 0x00);
+}
+
+bool HostSimDevice::isProtected(uint16_t page) const
+{
+    if(!protectionEnabled)
+    {
+        return false;
+    }
+    if(page < 8)
+    {
+        return (protection[0] & 0xc0) != 0;
+    }
+    if(page < 256)
+    {
+        return (protection[0] & 0x30) != 0;
+    }
+    return protection[page >> 8] != 0;
+}
+
+uint16_t HostSimDevice::page() const
+{
+    return (uint16_t)(((command[1] << 6) | (command[2] >> 2)) & (PAGES - 1));
+}
+
+uint16_t HostSimDevice::offset() const
+{
+    return (uint16_t)(((command[2] & 0x03) << 8) | command[3]);
+}
+
+void HostSimDevice::fail(const char *message, uint8_t opcode)
+{
+    fprintf(stderr, "hostsim: %s (opcode 0x%02X)\n", message, opcode);
+    abort();
+}
+
+uint8_t HostSimDevice::transfer(uint8_t in)
+{
+    ++bytes;
+    command.push_back(in);
+
+    size_t  n      = command.size();
+    uint8_t opcode = command[0];
+    if(powerDown)
+    {
+        return 0xff;
+    }
+
+    switch(opcode)
+    {
+        case 0xd7:  /* Status register read. */
+            if(n >= 2)
+            {
+                ++statusPolls;
+                return status();
+            }
+            break;
+
+        case 0x9f:  /* Manufacturer and device ID. */
+            {
+                static const uint8_t id[] = { 0x1f, 0x26, 0x00, 0x00 };
+                if((n >= 2) && (n < 6))
+                {
+                    return id[n-2];
+                }
+            }
+            break;
+
+        case 0xd2:  /* Main memory page read. */
+            if(n > 8)
+            {
+                if(n == 9)
+                {
+                    address = offset();
+                }
+                uint8_t value = memory[(size_t)page()*PAGE_SIZE + address];
+                address = (address + 1) % PAGE_SIZE;
+                return value;
+            }
+            break;
+
+        case 0x03:  /* Continuous array read. */
+        case 0x0b:
+            {
+                size_t header = (opcode == 0x03) ? 4 : 5;
+                if(n > header)
+                {
+                    if(n == (header+1))
+                    {
+                        address = (uint32_t)page()*PAGE_SIZE + offset();
+                    }
+                    uint8_t value = memory[address];
+                    address = (address + 1) % memory.size();
+                    return value;
+                }
+            }
+            break;
+
+        case 0xd1:  /* Buffer read. */
+        case 0xd3:
+        case 0xd4:
+        case 0xd6:
+            {
+                size_t header = ((opcode == 0xd1) || (opcode == 0xd3)) ? 4 : 5;
+                int bufferNum = ((opcode == 0xd3) || (opcode == 0xd6)) ? 1 : 0;
+                if(n > header)
+                {
+                    if(busy() && (busyBuffer == bufferNum))
+                    {
+                        fail("buffer read during a transfer", opcode);
+                    }
+                    if(n == (header+1))
+                    {
+                        address = offset();
+                    }
+                    uint8_t value = buffer[bufferNum][address];
+                    address = (address + 1) % PAGE_SIZE;
+                    return value;
+                }
+            }
+            break;
+
+        case 0x84:  /* Buffer write. */
+        case 0x87:
+        case 0x82:  /* Main memory page program through buffer. */
+        case 0x85:
+            {
+                int bufferNum = ((opcode == 0x87) || (opcode == 0x85)) ? 1 : 0;
+                if(n > 4)
+                {
+                    if(busy() && (busyBuffer == bufferNum))
+                    {
+                        fail("buffer write during a transfer", opcode);
+                    }
+                    if(n == 5)
+                    {
+                        address = offset();
+                    }
+                    buffer[bufferNum][address] = in;
+                    address = (address + 1) % PAGE_SIZE;
+                }
+            }
+            break;
+
+        case 0x32:  /* Sector protection register read. */
+            if((n > 4) && ((n - 5) < sizeof(protection)))
+            {
+                return protection[n-5];
+            }
+            break;
+    }
+    return 0;
+}
+
+void HostSimDevice::startBusy(uint32_t duration, int bufferNum)
+{
+    busyUntil  = now + duration;
+    busyBuffer = bufferNum;
+}
+
+void HostSimDevice::program(uint16_t page, int bufferNum, bool erase)
+{
+    ++programs;
+    startBusy(erase ? timings.eraseProgram : timings.program, bufferNum);
+    if(isProtected(page))
+    {
+        return;
+    }
+
+    uint8_t *dst = &memory[(size_t)page * PAGE_SIZE];
+    const uint8_t *src = &buffer[bufferNum][0];
+    bool corrupt = ((int)page == failPage) && (failCount > 0);
+    if(corrupt)
+    {
+        --failCount;
+    }
+    for(uint16_t i=0; i<PAGE_SIZE; i++)
+    {
+        uint8_t value = erase ? src[i] : (dst[i] & src[i]);
+        dst[i] = corrupt ? (value ^ 0x01) : value;
+    }
+}
+
+void HostSimDevice::erase(uint16_t first, uint16_t count)
+{
+    ++erases;
+    for(uint16_t page=first; page<(first + count); page++)
+    {
+        if(!isProtected(page))
+        {
+            memset(&memory[(size_t)page * PAGE_SIZE], 0xff, PAGE_SIZE);
+        }
+    }
+}
+
+void HostSimDevice::release()
+{
+    if(command.empty())
+    {
+        return;
+    }
+
+    uint8_t opcode = command[0];
+    size_t  n      = command.size();
+    if(powerDown)
+    {
+        /* Only the resume command is recognized in deep power-down. */
+        if(opcode == 0xab)
+        {
+            powerDown = false;
+        }
+        return;
+    }
+
+    bool allowedWhileBusy = (opcode == 0xd7) ||
+                            (opcode == 0x84) || (opcode == 0x87) ||
+                            (opcode == 0xd1) || (opcode == 0xd3) ||
+                            (opcode == 0xd4) || (opcode == 0xd6);
+    if(busy() && !allowedWhileBusy && (n > 1))
+    {
+        fail("command sent while busy", opcode);
+    }
+    if(n < 4)
+    {
+        if(opcode == 0xb9)
+        {
+            powerDown = true;
+        }
+        return;
+    }
+
+    switch(opcode)
+    {
+        case 0x83:  /* Buffer to page with erase. */
+        case 0x86:
+            program(page(), (opcode == 0x86) ? 1 : 0, true);
+            break;
+
+        case 0x88:  /* Buffer to page without erase. */
+        case 0x89:
+            program(page(), (opcode == 0x89) ? 1 : 0, false);
+            break;
+
+        case 0x82:  /* Page program through buffer. */
+        case 0x85:
+            program(page(), (opcode == 0x85) ? 1 : 0, true);
+            break;
+
+        case 0x53:  /* Page to buffer transfer. */
+        case 0x55:
+            {
+                int bufferNum = (opcode == 0x55) ? 1 : 0;
+                memcpy(&buffer[bufferNum][0], &memory[(size_t)page() * PAGE_SIZE], PAGE_SIZE);
+                startBusy(timings.transfer, bufferNum);
+            }
+            break;
+
+        case 0x60:  /* Page to buffer compare. */
+        case 0x61:
+            {
+                int bufferNum = (opcode == 0x61) ? 1 : 0;
+                compareMismatch = (memcmp(&buffer[bufferNum][0], &memory[(size_t)page() * PAGE_SIZE], PAGE_SIZE) != 0);
+                startBusy(timings.transfer, bufferNum);
+            }
+            break;
+
+        case 0x81:  /* Page erase. */
+            erase(page(), 1);
+            startBusy(timings.pageErase, -1);
+            break;
+
+        case 0x50:  /* Block erase. */
+            erase(page() & ~7, 8);
+            startBusy(timings.blockErase, -1);
+            break;
+
+        case 0x7c:  /* Sector erase (sectors 0a, 0b, then 256 pages). */
+            {
+                uint16_t first = page();
+                if(first < 8)
+                {
+                    erase(0, 8);
+                }
+                else if(first < 256)
+                {
+                    erase(8, 248);
+                }
+                else
+                {
+                    erase(first & ~255, 256);
+                }
+                startBusy(timings.sectorErase, -1);
+            }
+            break;
+
+        case 0x3d:  /* Sector protection commands. */
+            if(command[3] == 0xa9)
+            {
+                protectionEnabled = true;
+            }
+            else if(command[3] == 0x9a)
+            {
+                protectionEnabled = false;
+            }
+            else if(command[3] == 0xcf)
+            {
+                memset(protection, 0xff, sizeof(protection));
+                startBusy(timings.protection, -1);
+            }
+            else if(command[3] == 0xfc)
+            {
+                for(size_t i=4; (i < n) && ((i - 4) < sizeof(protection)); i++)
+                {
+                    protection[i-4] = command[i];
+                }
+                startBusy(timings.protection, -1);
+            }
+            break;
+    }
+}
@@ -0,0 +1,154 @@
+/**************************************************************************//**
+ * @file extras/hostsim/hostsim.h
+ * @brief Simulated AT45DBxxxD devices for host checks of the Atmel Dataflash
+ * library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Host simulation of AT45DB161D devices on a shared SPI bus, used to check
+ * timing properties of the library without hardware (bus latency, stalls,
+ * polling cost, locking).
+ *
+ * Time is simulated: each byte transferred on the SPI bus takes 1 us, each
+ * call to micros() 1 us, and the simulated devices stay busy for the
+ * typical program, erase and transfer times of the datasheet. The
+ * simulation aborts with a message on misuse: a command sent to a busy
+ * device, an access to the SRAM buffer being transferred, or two devices
+ * selected at once.
+ *
+ * Each program of this directory is built from the directory with the
+ * library sources, for example:
+ * g++ -std=gnu++11 -O2 -DARDUINO=100 -I. -I../.. -o scheduler_latency
+ * scheduler_latency.cpp hostsim.cpp ../../DataFlash*.cpp
+ * and exits with a non zero status if the property checked doesn't hold.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef HOSTSIM_H_
+#define HOSTSIM_H_
+
+#include <inttypes.h>
+#include <vector>
+
+#include "Arduino.h"
+
+/**
+ * Simulated device timings (in us), typical values of the AT45DB161D
+ * datasheet.
+ **/
+struct HostSimTimings
+{
+    uint32_t transfer;          /**< Page to buffer transfer or compare (tXFR). **/
+    uint32_t program;           /**< Page program without erase (tP). **/
+    uint32_t eraseProgram;      /**< Page erase and program (tEP). **/
+    uint32_t pageErase;         /**< Page erase (tPE). **/
+    uint32_t blockErase;        /**< Block erase (tBE). **/
+    uint32_t sectorErase;       /**< Sector erase (tSE). **/
+    uint32_t protection;        /**< Sector protection register program. **/
+};
+
+/**
+ * Simulated AT45DB161D (4096 pages of 528 bytes, sectors of 256 pages).
+ **/
+struct HostSimDevice
+{
+    static const uint16_t PAGE_SIZE = 528;
+    static const uint16_t PAGES     = 4096;
+
+    uint8_t cs;                     /**< Chip select pin. **/
+    HostSimTimings timings;         /**< Busy times. **/
+
+    std::vector<uint8_t> memory;    /**< Main memory. **/
+    std::vector<uint8_t> buffer[2]; /**< SRAM buffers. **/
+    uint8_t protection[16];         /**< Sector protection register. **/
+    bool    protectionEnabled;      /**< Sector protection enabled. **/
+    bool    powerDown;              /**< Deep power-down mode. **/
+    bool    compareMismatch;        /**< Result of the last compare. **/
+
+    int      failPage;              /**< Page whose programs are corrupted (-1 for none). **/
+    unsigned failCount;             /**< Number of corrupted programs left. **/
+
+    unsigned long statusPolls;      /**< Status register reads. **/
+    unsigned long bytes;            /**< Bytes transferred. **/
+    unsigned long programs;         /**< Page programs. **/
+    unsigned long erases;           /**< Page, block and sector erases. **/
+
+    bool     selected;              /**< Chip select is low. **/
+    std::vector<uint8_t> command;   /**< Bytes received since selection. **/
+    uint32_t address;               /**< Current read or write address. **/
+    uint64_t busyUntil;             /**< End of the running operation. **/
+    int      busyBuffer;            /**< SRAM buffer used by the running operation (-1 for none). **/
+
+    explicit HostSimDevice(uint8_t pin);
+
+    /** The device is running an internal operation. **/
+    bool busy() const;
+    /** Status register. **/
+    uint8_t status() const;
+    /** Sector protection state of a page. **/
+    bool isProtected(uint16_t page) const;
+
+    /** Byte transfer while selected. **/
+    uint8_t transfer(uint8_t in);
+    /** Chip select going high: start the command received. **/
+    void release();
+
+    private:
+        uint16_t page() const;
+        uint16_t offset() const;
+        void startBusy(uint32_t duration, int bufferNum);
+        void program(uint16_t page, int bufferNum, bool erase);
+        void erase(uint16_t first, uint16_t count);
+        static void fail(const char *message, uint8_t opcode);
+};
+
+/**
+ * Add a simulated device.
+ * @param cs Chip select pin.
+ * @return Simulated device.
+ **/
+HostSimDevice *hostsimAddDevice(uint8_t cs);
+
+/**
+ * Simulated device.
+ * @param cs Chip select pin.
+ * @return Simulated device, 0 if none uses this pin.
+ **/
+HostSimDevice *hostsimDevice(uint8_t cs);
+
+/** Simulated time (in us). **/
+uint64_t hostsimNow();
+
+/**
+ * Advance the simulated time.
+ * @param us Duration (in us).
+ **/
+void hostsimAdvance(uint32_t us);
+
+/** Interrupts are enabled (see noInterrupts() and interrupts()). **/
+bool hostsimInterruptsEnabled();
+
+#endif /* HOSTSIM_H_ */
@@ -0,0 +1,176 @@
+/**************************************************************************//**
+ * @file extras/hostsim/scheduler_latency.cpp
+ * @brief Bus wait bound of the AT45DBxxxD Atmel Dataflash scheduler.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Checks the bound on the bus wait of the highest priority client of
+ * DataFlashScheduler: a sensor client needing the bus at irregular times
+ * shares it with a display client and a DataFlash running buffer writes,
+ * programs and erases. The sensor wait, from the time it needs the bus to
+ * the start of its transaction, must never exceed the longest transaction
+ * of any client (reported by worstTransaction()) plus the overhead of a
+ * scheduling step.
+ *
+ * Build with: g++ -std=gnu++11 -O2 -DARDUINO=100 -I. -I../.. -o
+ * scheduler_latency scheduler_latency.cpp hostsim.cpp ../../DataFlash*.cpp
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+
+#include "hostsim.h"
+#include "SPI.h"
+#include "DataFlashScheduler.h"
+
+/** Overhead of a scheduling step (micros() calls), in us. **/
+#define STEP_OVERHEAD   8
+
+/** Latency critical client: a sensor read at irregular intervals. **/
+struct Sensor
+{
+    uint32_t due;       /**< Time at which the sensor needs the bus. **/
+    uint32_t seed;      /**< Interval generator state. **/
+    uint32_t reads;     /**< Number of reads. **/
+    uint32_t worst;     /**< Longest wait for the bus. **/
+};
+
+/** Background client: a display refreshed by 16 bytes transactions. **/
+struct Display
+{
+    uint32_t transactions;  /**< Number of transactions. **/
+};
+
+static bool sensorRead(void *context)
+{
+    Sensor *sensor = static_cast<Sensor*>(context);
+    uint32_t now = micros();
+    if((int32_t)(now - sensor->due) < 0)
+    {
+        return false;
+    }
+
+    uint32_t wait = now - sensor->due;
+    if(wait > sensor->worst)
+    {
+        sensor->worst = wait;
+    }
+
+    digitalWrite(9, LOW);
+    SPI.transfer(0x01);
+    SPI.transfer(0x80);
+    SPI.transfer(0x00);
+    digitalWrite(9, HIGH);
+    ++sensor->reads;
+
+    /* Next read between 40 and 167 us from now. */
+    sensor->seed = sensor->seed * 1103515245 + 12345;
+    sensor->due  = micros() + 40 + ((sensor->seed >> 16) & 0x7f);
+    return true;
+}
+
+static bool displayRefresh(void *context)
+{
+    Display *display = static_cast<Display*>(context);
+    digitalWrite(8, LOW);
+    for(uint8_t i=0; i<16; i++)
+    {
+        SPI.transfer(i);
+    }
+    digitalWrite(8, HIGH);
+    ++display->transactions;
+    return true;
+}
+
+static void done(void *context, uint8_t)
+{
+    ++*static_cast<uint16_t*>(context);
+}
+
+int main()
+{
+    hostsimAddDevice(10);
+
+    DataFlash dataflash;
+    dataflash.setup(10);
+    dataflash.begin();
+
+    Sensor  sensor  = { 0, 1, 0, 0 };
+    Display display = { 0 };
+    DataFlashScheduler scheduler(dataflash, 1);
+    scheduler.addClient(sensorRead, &sensor, 2);
+    scheduler.addClient(displayRefresh, &display, 0);
+
+    static uint8_t data[HostSimDevice::PAGE_SIZE];
+    for(uint16_t i=0; i<sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 7);
+    }
+
+    uint16_t completed = 0;
+    uint16_t submitted = 0;
+    for(uint16_t page=16; page<48; page++)
+    {
+        DataFlashScheduler::Command write = { DataFlashScheduler::OP_BUFFER_WRITE, (uint8_t)(page & 1), 0, 0, sizeof(data), data, done, &completed };
+        DataFlashScheduler::Command program = { DataFlashScheduler::OP_BUFFER_TO_PAGE, (uint8_t)(page & 1), page, 0, 0, 0, done, &completed };
+        DataFlashScheduler::Command erase = { DataFlashScheduler::OP_PAGE_ERASE, 0, (uint16_t)(page + 256), 0, 0, 0, done, &completed };
+        while(!scheduler.submit(write))   { scheduler.run(); }
+        while(!scheduler.submit(program)) { scheduler.run(); }
+        while(!scheduler.submit(erase))   { scheduler.run(); }
+        submitted += 3;
+    }
+    while(!scheduler.idle())
+    {
+        scheduler.run();
+    }
+
+    bool ok = (completed == submitted);
+    HostSimDevice *device = hostsimDevice(10);
+    for(uint16_t page=16; page<48; page++)
+    {
+        if(memcmp(&device->memory[(size_t)page * HostSimDevice::PAGE_SIZE], data, sizeof(data)) != 0)
+        {
+            ok = false;
+        }
+    }
+
+    uint32_t bound = scheduler.worstTransaction() + STEP_OVERHEAD;
+    printf("commands: %u/%u, pages %s\n", completed, submitted, ok ? "ok" : "corrupted");
+    printf("sensor reads: %lu, display transactions: %lu, simulated time: %lu ms\n",
+           (unsigned long)sensor.reads, (unsigned long)display.transactions,
+           (unsigned long)(hostsimNow() / 1000));
+    printf("worst transaction: %lu us, worst sensor wait: %lu us (bound %lu us)\n",
+           (unsigned long)scheduler.worstTransaction(), (unsigned long)sensor.worst,
+           (unsigned long)bound);
+
+    if(!ok || (sensor.worst > bound))
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("passed\n");
+    return 0;
+}
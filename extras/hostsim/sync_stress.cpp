@@ -0,0 +1,254 @@
+/**************************************************************************//**
+ * @file extras/hostsim/sync_stress.cpp
+ * @brief Stress test of the AT45DBxxxD Atmel Dataflash lock policies.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Several std::thread tasks share a simulated AT45DB161D through
+ * DataFlashSync with a mutex policy: each one writes, programs and reads
+ * back its own pages, one of them also copies and erases. The program
+ * reports the lock contention (acquisitions that found the mutex taken)
+ * and the throughput. All the data must match, and the lock must never be
+ * held while waiting for the chip: a hold reads the status at most twice
+ * (once to find the chip ready, once when starting an operation).
+ * DataFlashSync with DataFlashIsrLock is then run through programs,
+ * erases and copies in a single task: as micros() doesn't run with
+ * interrupts disabled, any busy wait under the lock would never end.
+ *
+ * Build with: g++ -std=gnu++11 -O2 -pthread -DARDUINO=100 -I. -I../.. -o
+ * sync_stress sync_stress.cpp hostsim.cpp ../../DataFlash*.cpp
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "hostsim.h"
+#include "DataFlashSync.h"
+
+/** Number of tasks. **/
+#define TASKS           4
+/** Pages written by each task. **/
+#define TASK_PAGES      128
+/** Bytes written to each page. **/
+#define DATA_SIZE       64
+
+/** Mutex counting contended acquisitions and the status polls of each hold. **/
+struct CountingMutex
+{
+    CountingMutex() : taken(0), contended(0), polls(0), most(0) {}
+
+    void lock()
+    {
+        if(!mutex.try_lock())
+        {
+            ++contended;
+            mutex.lock();
+        }
+        ++taken;
+        polls = hostsimDevice(10)->statusPolls;
+    }
+
+    void unlock()
+    {
+        unsigned long count = hostsimDevice(10)->statusPolls - polls;
+        if(count > most)
+        {
+            most = count;
+        }
+        mutex.unlock();
+    }
+
+    std::mutex mutex;
+    std::atomic<unsigned long> taken;       /**< Acquisitions. **/
+    std::atomic<unsigned long> contended;   /**< Acquisitions that had to wait. **/
+    unsigned long polls;                    /**< Status polls before the current hold. **/
+    unsigned long most;                     /**< Most status polls in one hold. **/
+};
+
+typedef DataFlashSync< DataFlashMutexLock<CountingMutex> > MutexSync;
+typedef DataFlashSync<DataFlashIsrLock> IsrSync;
+
+/** Number of failed checks. **/
+static int failures = 0;
+
+/** Data of a page. **/
+static void fill(uint8_t *data, uint16_t page)
+{
+    for(uint16_t i=0; i<DATA_SIZE; i++)
+    {
+        data[i] = (uint8_t)(page * 31 + i);
+    }
+}
+
+/** Task writing, programming and reading back its own pages. **/
+static void task(MutexSync *sync, int id, std::atomic<unsigned long> *errors, std::atomic<bool> *go)
+{
+    uint8_t data[DATA_SIZE], back[DATA_SIZE];
+    while(!*go)
+    {}
+    for(uint16_t i=0; i<TASK_PAGES; i++)
+    {
+        uint16_t page = 256 * (id + 1) + i;
+        fill(data, page);
+        {
+            /* A buffer is only used within a session. */
+            MutexSync::Session session(*sync);
+            session->bufferWrite(id & 1, 0);
+            for(uint16_t j=0; j<DATA_SIZE; j++)
+            {
+                session->transfer(data[j]);
+            }
+            session->disable();
+            /* Be preempted with the lock held. */
+            std::this_thread::yield();
+            session->bufferToPage(id & 1, page);
+        }
+        std::this_thread::yield();
+        sync->read(page, 0, back, sizeof(back));
+        if(memcmp(data, back, sizeof(data)) != 0)
+        {
+            ++*errors;
+        }
+
+        if((id == 0) && ((i & 15) == 15))
+        {
+            /* Copy the last 16 pages, then erase the copies. */
+            uint16_t copy = 256 * (TASKS + 1) + i - 15;
+            sync->copyPages(page - 15, copy, 16);
+            sync->read(copy + 15, 0, back, sizeof(back));
+            if(memcmp(data, back, sizeof(data)) != 0)
+            {
+                ++*errors;
+            }
+            sync->blockErase(copy >> 3);
+            sync->blockErase((copy >> 3) + 1);
+        }
+    }
+}
+
+/** Tasks sharing the device through a mutex. **/
+static void mutexStress(DataFlash &dataflash)
+{
+    MutexSync sync(dataflash);
+    std::atomic<unsigned long> errors(0);
+    std::atomic<bool> go(false);
+
+    std::thread tasks[TASKS];
+    for(int i=0; i<TASKS; i++)
+    {
+        tasks[i] = std::thread(task, &sync, i, &errors, &go);
+    }
+    uint64_t start = hostsimNow();
+    std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+    go = true;
+    for(int i=0; i<TASKS; i++)
+    {
+        tasks[i].join();
+    }
+    double elapsed = (double)(hostsimNow() - start) / 1e6;
+    double wallMs  = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall).count();
+
+    /* The pages hold the data of the last write. */
+    HostSimDevice *device = hostsimDevice(10);
+    uint8_t data[DATA_SIZE];
+    for(int id=0; id<TASKS; id++)
+    {
+        for(uint16_t i=0; i<TASK_PAGES; i++)
+        {
+            uint16_t page = 256 * (id + 1) + i;
+            fill(data, page);
+            if(memcmp(&device->memory[(size_t)page * HostSimDevice::PAGE_SIZE], data, sizeof(data)) != 0)
+            {
+                ++errors;
+            }
+        }
+    }
+
+    CountingMutex &mutex = sync.lock().mutex;
+    unsigned long pages = TASKS * TASK_PAGES;
+    bool ok = (errors == 0) && (mutex.most <= 2);
+    printf("mutex: %d tasks, %lu pages, %lu errors\n", TASKS, pages, errors.load());
+    printf("mutex: %lu locks, %lu contended (%.1f %%), at most %lu status polls per lock\n",
+           mutex.taken.load(), mutex.contended.load(),
+           100.0 * mutex.contended.load() / mutex.taken.load(), mutex.most);
+    printf("mutex: %.1f pages/s simulated, %.1f ms wall time  %s\n",
+           pages / elapsed, wallMs, ok ? "ok" : "FAILED");
+    if(!ok)
+    {
+        ++failures;
+    }
+}
+
+/** Single task with the interrupt lock. **/
+static void isrLock(DataFlash &dataflash)
+{
+    IsrSync sync(dataflash);
+    uint8_t data[DATA_SIZE], back[DATA_SIZE];
+    bool ok = true;
+
+    uint64_t start = hostsimNow();
+    for(uint16_t page=1800; page<1808; page++)
+    {
+        fill(data, page);
+        sync.bufferWrite(page & 1, 0, data, sizeof(data));
+        ok = sync.bufferToPage(page & 1, page) && ok;
+        ok = ok && hostsimInterruptsEnabled();
+    }
+    ok = sync.copyPages(1800, 1808, 8) && ok;
+    sync.read(1815, 0, back, sizeof(back));
+    fill(data, 1807);
+    ok = ok && (memcmp(data, back, sizeof(data)) == 0);
+    ok = sync.blockErase(1808 >> 3) && ok;
+    sync.waitUntilReady();
+    ok = ok && hostsimInterruptsEnabled() && (sync.lock().depth == 0) && (sync.status() & AT45_READY);
+
+    printf("interrupt lock: 8 programs, a copy of 8 pages and an erase in %lu us  %s\n",
+           (unsigned long)(hostsimNow() - start), ok ? "ok" : "FAILED");
+    if(!ok)
+    {
+        ++failures;
+    }
+}
+
+int main()
+{
+    hostsimAddDevice(10);
+
+    DataFlash dataflash;
+    dataflash.setup(10);
+    dataflash.begin();
+
+    mutexStress(dataflash);
+    isrLock(dataflash);
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+/**************************************************************************//**
+ * @file extras/hostsim/wear_journal.cpp
+ * @brief Erase counters of the AT45DBxxxD Atmel Dataflash wear journal.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Checks DataFlashWearJournal on a simulated AT45DB161D: random page,
+ * block and sector erases and page programs are counted per block, and
+ * the journal is remounted after each run. The counters read back must
+ * match the erases done exactly, and the journal must write less than 2
+ * pages per 100 recorded erases.
+ *
+ * Build with: g++ -std=gnu++11 -O2 -DARDUINO=100 -I. -I../.. -o
+ * wear_journal wear_journal.cpp hostsim.cpp ../../DataFlash*.cpp
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+
+#include "hostsim.h"
+#include "DataFlashWearJournal.h"
+
+/** Sector reserved for the journal. **/
+#define JOURNAL_SECTOR  15
+
+/** Erase operations per run. **/
+#define OPERATIONS      10000
+
+/** Number of runs, the journal is remounted after each one. **/
+#define RUNS            2
+
+/** Erases done on each block. **/
+static uint32_t expected[HostSimDevice::PAGES / 8];
+
+/** Number of failed checks. **/
+static int failures = 0;
+
+/** Pseudo random numbers, the same on every host. **/
+static uint32_t next()
+{
+    static uint32_t state = 0x2545f491;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * Erase a random location outside the journal sector.
+ * Most operations are page programs and page erases, with a few block
+ * erases and rare sector erases.
+ **/
+static void erase(DataFlash &dataflash)
+{
+    uint16_t pages = dataflash.sectorFirstPage(JOURNAL_SECTOR);
+    uint32_t draw = next();
+    uint8_t  kind = draw % 100;
+    uint16_t page = (draw >> 8) % pages;
+
+    if(kind == 0)
+    {
+        /* Sectors 1 to JOURNAL_SECTOR-1, sector 0 is split in two. */
+        int8_t sector = 1 + ((draw >> 8) % (JOURNAL_SECTOR - 1));
+        uint16_t first = dataflash.sectorFirstPage(sector);
+        uint16_t count = dataflash.sectorPageCount(sector);
+        dataflash.sectorErase(sector);
+        for(uint16_t block=first >> 3; block<((first + count) >> 3); block++)
+        {
+            ++expected[block];
+        }
+    }
+    else
+    {
+        if(kind < 10)
+        {
+            dataflash.blockErase(page >> 3);
+        }
+        else if(kind < 40)
+        {
+            dataflash.pageErase(page);
+        }
+        else
+        {
+            dataflash.bufferToPage(0, page);
+        }
+        ++expected[page >> 3];
+    }
+    dataflash.waitUntilReady();
+}
+
+/**
+ * Compare the counters of a newly mounted journal with the erases done.
+ **/
+static void check(DataFlash &dataflash, const char *name)
+{
+    DataFlashWearJournal journal(dataflash);
+    bool found = journal.begin(JOURNAL_SECTOR);
+
+    uint16_t last = dataflash.sectorFirstPage(JOURNAL_SECTOR) >> 3;
+    uint16_t wrong = 0;
+    for(uint16_t block=0; block<last; block++)
+    {
+        if(journal.eraseCount(block) != expected[block])
+        {
+            ++wrong;
+        }
+    }
+    journal.end();
+
+    bool ok = found && (journal.blocks() == (HostSimDevice::PAGES / 8)) && (wrong == 0);
+    printf("%-20s blocks %4u, wrong counters %4u  %s\n", name, journal.blocks(), wrong, ok ? "ok" : "FAILED");
+    if(!ok)
+    {
+        ++failures;
+    }
+}
+
+int main()
+{
+    const uint8_t cs = 10;
+    hostsimAddDevice(cs);
+
+    DataFlash dataflash;
+    dataflash.setup(cs);
+    dataflash.begin();
+
+    uint32_t events = 0;
+    uint32_t writes = 0;
+    for(uint8_t run=0; run<RUNS; run++)
+    {
+        DataFlashWearJournal journal(dataflash);
+        journal.begin(JOURNAL_SECTOR);
+        for(uint16_t i=0; i<OPERATIONS; i++)
+        {
+            erase(dataflash);
+            journal.update();
+        }
+        bool flushed = journal.flush();
+        journal.end();
+
+        bool ok = flushed && (journal.events() == OPERATIONS) && (journal.overhead() < 20);
+        printf("run %u: %lu erases, %lu journal pages, overhead %u per thousand  %s\n",
+               run, (unsigned long)journal.events(), (unsigned long)journal.journalWrites(),
+               journal.overhead(), ok ? "ok" : "FAILED");
+        if(!ok)
+        {
+            ++failures;
+        }
+        events += journal.events();
+        writes += journal.journalWrites();
+
+        check(dataflash, "remount");
+    }
+
+    printf("journal overhead: %.2f%% over %lu erases\n", 100.0 * writes / events, (unsigned long)events);
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
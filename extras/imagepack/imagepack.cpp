@@ -0,0 +1,358 @@
+/**************************************************************************//**
+ * @file extras/imagepack/imagepack.cpp
+ * @brief Image packer and sender for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * Host side companion of DataFlashImageReceiver. It packs a binary file
+ * into a page aligned image for a given %Dataflash, and sends an image
+ * over a serial port following the receiver flow control.
+ *
+ * Build with: g++ -O2 -o imagepack imagepack.cpp
+ *
+ * Usage:
+ * - imagepack pack <chip> <first page> <input> <output> [binary]
+ *   where chip is one of 011, 021, 041, 081, 161, 321, 642, and binary
+ *   selects the power of 2 page size.
+ * - imagepack send <image> <serial port> [baud rate]
+ *   The port is set to raw mode at the given baud rate (115200 by
+ *   default). A silent receiver ends the transfer after 5 seconds.
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../../DataFlashSizes.h"
+#include "../../DataFlashCrc.h"
+
+/** Image header magic number (see DataFlashImageReceiver.cpp). **/
+#define IMAGE_MAGIC     0x4d49
+/** Receiver flow control (see DataFlashImageReceiver.h). **/
+#define IMAGE_ACK       '>'
+#define IMAGE_NAK       '!'
+#define IMAGE_DONE      '#'
+/** Receiver silence ending a transfer (in tenths of seconds). **/
+#define IMAGE_TIMEOUT   50
+
+/** Device geometry. **/
+struct Geometry
+{
+    const char *name;       /**< Device name. **/
+    unsigned pageSize;      /**< Page size (standard). **/
+    unsigned pages;         /**< Page count. **/
+};
+
+static const Geometry geometries[] =
+{
+    { "011", DF_45DB011_PAGESIZE, DF_45DB011_PAGES },
+    { "021", DF_45DB021_PAGESIZE, DF_45DB021_PAGES },
+    { "041", DF_45DB041_PAGESIZE, DF_45DB041_PAGES },
+    { "081", DF_45DB081_PAGESIZE, DF_45DB081_PAGES },
+    { "161", DF_45DB161_PAGESIZE, DF_45DB161_PAGES },
+    { "321", DF_45DB321_PAGESIZE, DF_45DB321_PAGES },
+    { "642", DF_45DB642_PAGESIZE, DF_45DB642_PAGES }
+};
+
+/** Supported baud rates. **/
+static const struct
+{
+    unsigned long rate;     /**< Baud rate. **/
+    speed_t       speed;    /**< termios speed. **/
+} bauds[] =
+{
+    { 9600,   B9600 },
+    { 19200,  B19200 },
+    { 38400,  B38400 },
+    { 57600,  B57600 },
+    { 115200, B115200 },
+#ifdef B230400
+    { 230400, B230400 },
+#endif
+};
+
+/** Receiver error messages, indexed by DataFlashImageReceiver::result. **/
+static const char *errors[] =
+{
+    "ok", "timeout", "bad header", "bad geometry", "bad CRC", "protected", "verify failed"
+};
+
+/** Append a 16 bits little endian value. **/
+static void put16(uint8_t *out, uint16_t value)
+{
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+/** Read a 16 bits little endian value. **/
+static uint16_t get16(const uint8_t *in)
+{
+    return in[0] | ((uint16_t)in[1] << 8);
+}
+
+/** Pack a binary file. **/
+static int pack(const char *chip, unsigned first, const char *input, const char *output, bool binary)
+{
+    const Geometry *geometry = 0;
+    for(size_t i=0; i<sizeof(geometries)/sizeof(geometries[0]); i++)
+    {
+        if(strcmp(chip, geometries[i].name) == 0)
+        {
+            geometry = &geometries[i];
+        }
+    }
+    if(geometry == 0)
+    {
+        fprintf(stderr, "unknown chip %s\n", chip);
+        return 1;
+    }
+    unsigned pageSize = binary ? (geometry->pageSize * 256 / 264) : geometry->pageSize;
+
+    FILE *in = fopen(input, "rb");
+    if(in == 0)
+    {
+        perror(input);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    unsigned count = (length + pageSize - 1) / pageSize;
+    if(first + count > geometry->pages)
+    {
+        fprintf(stderr, "%ld bytes don't fit from page %u\n", length, first);
+        fclose(in);
+        return 1;
+    }
+
+    FILE *out = fopen(output, "wb");
+    if(out == 0)
+    {
+        perror(output);
+        fclose(in);
+        return 1;
+    }
+
+    uint8_t header[10];
+    put16(header+0, IMAGE_MAGIC);
+    put16(header+2, pageSize);
+    put16(header+4, first);
+    put16(header+6, count);
+    put16(header+8, dataflashCrc16(AT45_CRC16_INIT, header, 8));
+    fwrite(header, 1, sizeof(header), out);
+
+    uint8_t *page = static_cast<uint8_t*>(malloc(pageSize + 2));
+    for(unsigned i=0; i<count; i++)
+    {
+        /* The last page is padded with erased bytes. */
+        memset(page, 0xff, pageSize);
+        if(fread(page, 1, pageSize, in) == 0)
+        {
+            break;
+        }
+        put16(page + pageSize, dataflashCrc16(AT45_CRC16_INIT, page, pageSize));
+        fwrite(page, 1, pageSize + 2, out);
+    }
+    free(page);
+
+    fclose(in);
+    fclose(out);
+    printf("%u pages of %u bytes from page %u\n", count, pageSize, first);
+    return 0;
+}
+
+/** Read exactly count bytes. **/
+static bool readAll(int fd, uint8_t *data, size_t count)
+{
+    while(count)
+    {
+        ssize_t n = read(fd, data, count);
+        if(n <= 0)
+        {
+            return false;
+        }
+        data  += n;
+        count -= n;
+    }
+    return true;
+}
+
+/** Write exactly count bytes. **/
+static bool writeAll(int fd, const uint8_t *data, size_t count)
+{
+    while(count)
+    {
+        ssize_t n = write(fd, data, count);
+        if(n <= 0)
+        {
+            return false;
+        }
+        data  += n;
+        count -= n;
+    }
+    return true;
+}
+
+/** Set a serial port to raw mode, with a read timeout. **/
+static bool setupPort(int fd, unsigned long baud)
+{
+    speed_t speed = 0;
+    bool found = false;
+    for(size_t i=0; i<sizeof(bauds)/sizeof(bauds[0]); i++)
+    {
+        if(bauds[i].rate == baud)
+        {
+            speed = bauds[i].speed;
+            found = true;
+        }
+    }
+    if(!found)
+    {
+        fprintf(stderr, "unsupported baud rate %lu\n", baud);
+        return false;
+    }
+
+    struct termios tty;
+    if(tcgetattr(fd, &tty) != 0)
+    {
+        perror("tcgetattr");
+        return false;
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN]  = 0;
+    tty.c_cc[VTIME] = IMAGE_TIMEOUT;
+    if(tcsetattr(fd, TCSANOW, &tty) != 0)
+    {
+        perror("tcsetattr");
+        return false;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return true;
+}
+
+/** Send an image, one page per acknowledge. **/
+static int send(const char *image, const char *port, unsigned long baud)
+{
+    FILE *in = fopen(image, "rb");
+    if(in == 0)
+    {
+        perror(image);
+        return 1;
+    }
+
+    uint8_t header[10];
+    if(fread(header, 1, sizeof(header), in) != sizeof(header) || (get16(header) != IMAGE_MAGIC))
+    {
+        fprintf(stderr, "%s is not an image\n", image);
+        fclose(in);
+        return 1;
+    }
+    unsigned pageSize = get16(header+2);
+    unsigned count    = get16(header+6);
+
+    int fd = open(port, O_RDWR | O_NOCTTY);
+    if(fd < 0)
+    {
+        perror(port);
+        fclose(in);
+        return 1;
+    }
+    if(!setupPort(fd, baud))
+    {
+        close(fd);
+        fclose(in);
+        return 1;
+    }
+
+    uint8_t *page = static_cast<uint8_t*>(malloc(pageSize + 2));
+    unsigned sent = 0;
+    int status = 1;
+    bool ok = writeAll(fd, header, sizeof(header));
+    while(ok)
+    {
+        uint8_t reply;
+        ok = readAll(fd, &reply, 1);
+        if(!ok)
+        {
+            break;
+        }
+        if(reply == IMAGE_ACK)
+        {
+            ok = (sent < count) &&
+                 (fread(page, 1, pageSize + 2, in) == pageSize + 2) &&
+                 writeAll(fd, page, pageSize + 2);
+            ++sent;
+        }
+        else if(reply == IMAGE_DONE)
+        {
+            printf("%u pages programmed and verified\n", sent);
+            status = 0;
+            break;
+        }
+        else if(reply == IMAGE_NAK)
+        {
+            uint8_t code = 0;
+            readAll(fd, &code, 1);
+            fprintf(stderr, "failed after %u pages: %s\n", sent,
+                    (code < sizeof(errors)/sizeof(errors[0])) ? errors[code] : "unknown");
+            break;
+        }
+    }
+    if(!ok)
+    {
+        fprintf(stderr, "transfer failed after %u pages\n", sent);
+    }
+
+    free(page);
+    close(fd);
+    fclose(in);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if((argc >= 6) && (strcmp(argv[1], "pack") == 0))
+    {
+        bool binary = (argc > 6) && (strcmp(argv[6], "binary") == 0);
+        return pack(argv[2], strtoul(argv[3], 0, 0), argv[4], argv[5], binary);
+    }
+    if(((argc == 4) || (argc == 5)) && (strcmp(argv[1], "send") == 0))
+    {
+        return send(argv[2], argv[3], (argc == 5) ? strtoul(argv[4], 0, 0) : 115200);
+    }
+
+    fprintf(stderr, "usage: %s pack <chip> <first page> <input> <output> [binary]\n"
+                    "       %s send <image> <serial port> [baud rate]\n", argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,227 @@
+/**************************************************************************//**
+ * @file extras/traceanalyzer/traceanalyzer.cpp
+ * @brief SPI trace analyzer for the AT45DBxxxD Atmel Dataflash library.
+ *
+ * @par Copyright:
+ * - Copyright (C) 2010-2011 by Vincent Cruz.
+ * - Copyright (C) 2011 by Volker Kuhlmann. @n
+ * All rights reserved.
+ *
+ * @authors
+ * - Vincent Cruz @n
+ *   cruz.vincent@gmail.com
+ * - Volker Kuhlmann @n
+ *   http://volker.top.geek.nz/contact.html
+ *
+ * @par Description:
+ * * Decodes the output of DataFlash::dumpTrace() (library built with
+ *  * AT45_USE_TRACE) and reports, for each command type, the number of
+ *  * commands, the bytes sent, the payload bytes and the payload
+ *  * efficiency. Opcode, address and dummy bytes, as well as status polls,
+ *  * are overhead. Command types with a low efficiency and a small average
+ *  * payload are the ones worth batching.
+ *  *
+ *  * Build with: g++ -O2 -o traceanalyzer traceanalyzer.cpp
+ *  *
+ *  * Usage: traceanalyzer [trace file] (standard input by default)
+ *
+ * @par Licence: GPLv3
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. @n
+ * @n
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. @n
+ * @n
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../DataFlashCommands.h"
+
+/** Command type. **/
+struct Command
+{
+    unsigned char opcode;   /**< Opcode. **/
+    const char   *name;     /**< Command name. **/
+    unsigned      header;   /**< Opcode, address and dummy bytes. **/
+    bool          payload;  /**< The bytes after the header are data. **/
+};
+
+/**
+ * Commands as sent by DataFlash.cpp. Read opcodes for the high
+ * frequency have one more dummy byte.
+ **/
+static const Command commands[] =
+{
+    { DATAFLASH_PAGE_READ,                      "page read",            8, true  },
+    { DATAFLASH_CONTINUOUS_READ_LOW_FREQ,       "array read",           4, true  },
+    { DATAFLASH_CONTINUOUS_READ_HIGH_FREQ,      "array read (high)",    5, true  },
+    { DATAFLASH_BUFFER_1_READ_LOW_FREQ,         "buffer read",          4, true  },
+    { DATAFLASH_BUFFER_2_READ_LOW_FREQ,         "buffer read",          4, true  },
+    { DATAFLASH_BUFFER_1_READ,                  "buffer read (high)",   5, true  },
+    { DATAFLASH_BUFFER_2_READ,                  "buffer read (high)",   5, true  },
+    { DATAFLASH_BUFFER_1_WRITE,                 "buffer write",         4, true  },
+    { DATAFLASH_BUFFER_2_WRITE,                 "buffer write",         4, true  },
+    { DATAFLASH_BUFFER_1_TO_PAGE_WITH_ERASE,    "buffer to page",       4, false },
+    { DATAFLASH_BUFFER_2_TO_PAGE_WITH_ERASE,    "buffer to page",       4, false },
+    { DATAFLASH_BUFFER_1_TO_PAGE_WITHOUT_ERASE, "buffer to page",       4, false },
+    { DATAFLASH_BUFFER_2_TO_PAGE_WITHOUT_ERASE, "buffer to page",       4, false },
+    { DATAFLASH_PAGE_THROUGH_BUFFER_1,          "page through buffer",  4, true  },
+    { DATAFLASH_PAGE_THROUGH_BUFFER_2,          "page through buffer",  4, true  },
+    { DATAFLASH_TRANSFER_PAGE_TO_BUFFER_1,      "page to buffer",       4, false },
+    { DATAFLASH_TRANSFER_PAGE_TO_BUFFER_2,      "page to buffer",       4, false },
+    { DATAFLASH_COMPARE_PAGE_TO_BUFFER_1,       "compare",              4, false },
+    { DATAFLASH_COMPARE_PAGE_TO_BUFFER_2,       "compare",              4, false },
+    { DATAFLASH_AUTO_PAGE_REWRITE_THROUGH_BUFFER_1, "auto page rewrite", 4, false },
+    { DATAFLASH_AUTO_PAGE_REWRITE_THROUGH_BUFFER_2, "auto page rewrite", 4, false },
+    { DATAFLASH_PAGE_ERASE,                     "page erase",           4, false },
+    { DATAFLASH_BLOCK_ERASE,                    "block erase",          4, false },
+    { DATAFLASH_SECTOR_ERASE,                   "sector erase",         4, false },
+    { DATAFLASH_STATUS_REGISTER_READ,           "status poll",          1, false },
+    { DATAFLASH_READ_MANUFACTURER_AND_DEVICE_ID, "read id",             1, true  },
+    { DATAFLASH_ENABLE_SECTOR_PROTECTION_0,     "protection command",   4, true  },
+    { DATAFLASH_READ_SECTOR_PROTECTION_REGISTER, "read protection",     4, true  },
+    { DATAFLASH_DEEP_POWER_DOWN,                "deep power down",      1, false },
+    { DATAFLASH_RESUME_FROM_DEEP_POWER_DOWN,    "resume",               1, false }
+};
+
+/** Number of command types. **/
+#define COMMAND_COUNT   (sizeof(commands) / sizeof(commands[0]))
+
+/** Statistics of a command name. **/
+struct Usage
+{
+    const char   *name;     /**< Command name. **/
+    unsigned long count;    /**< Number of commands. **/
+    unsigned long bytes;    /**< Bytes sent. **/
+    unsigned long payload;  /**< Payload bytes. **/
+};
+
+static Usage usages[COMMAND_COUNT + 1];
+static unsigned usageCount = 0;
+
+/** Find the statistics of a command name. **/
+static Usage &usage(const char *name)
+{
+    for(unsigned i=0; i<usageCount; i++)
+    {
+        if(strcmp(usages[i].name, name) == 0)
+        {
+            return usages[i];
+        }
+    }
+    usages[usageCount].name = name;
+    return usages[usageCount++];
+}
+
+/** Account a complete command. **/
+static void account(const unsigned char *bytes, unsigned count)
+{
+    if(count == 0)
+    {
+        return;
+    }
+
+    const Command *command = 0;
+    for(unsigned i=0; i<COMMAND_COUNT; i++)
+    {
+        if(commands[i].opcode == bytes[0])
+        {
+            command = &commands[i];
+            break;
+        }
+    }
+
+    Usage &entry = usage(command ? command->name : "unknown");
+    ++entry.count;
+    entry.bytes += count;
+    if(command && command->payload && (count > command->header))
+    {
+        entry.payload += count - command->header;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = (argc > 1) ? fopen(argv[1], "r") : stdin;
+    if(in == 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    /* Only the opcode and the byte count matter, the bytes after the
+     * header are not kept. */
+    unsigned char bytes[16];
+    unsigned count   = 0;
+    bool     started = false;
+    bool     selected = false;
+    unsigned long selects = 0;
+
+    char token[64];
+    while(fscanf(in, "%63s", token) == 1)
+    {
+        if(!started)
+        {
+            /* Skip everything up to the "AT45 trace" line. */
+            started = (strcmp(token, "trace") == 0);
+            continue;
+        }
+        if(strcmp(token, "AT45") == 0)
+        {
+            break;
+        }
+
+        if(strcmp(token, "S") == 0)
+        {
+            account(bytes, count);
+            count    = 0;
+            selected = true;
+            ++selects;
+        }
+        else if(strcmp(token, "D") == 0)
+        {
+            account(bytes, count);
+            count    = 0;
+            selected = false;
+        }
+        else if(selected)
+        {
+            /* Bytes before the first select belong to a truncated
+             * command and are ignored. */
+            if(count < sizeof(bytes))
+            {
+                bytes[count] = strtoul(token, 0, 16);
+            }
+            ++count;
+        }
+    }
+    account(bytes, count);
+
+    if(in != stdin)
+    {
+        fclose(in);
+    }
+
+    unsigned long totalBytes = 0, totalPayload = 0;
+    printf("%-22s %8s %10s %10s %6s %8s\n", "command", "count", "bytes", "payload", "eff%", "avg");
+    for(unsigned i=0; i<usageCount; i++)
+    {
+        const Usage &entry = usages[i];
+        printf("%-22s %8lu %10lu %10lu %6.1f %8.1f\n", entry.name, entry.count, entry.bytes, entry.payload,
+               100.0 * entry.payload / entry.bytes, (double)entry.payload / entry.count);
+        totalBytes   += entry.bytes;
+        totalPayload += entry.payload;
+    }
+    printf("%-22s %8lu %10lu %10lu %6.1f\n", "total", selects, totalBytes, totalPayload,
+           totalBytes ? (100.0 * totalPayload / totalBytes) : 0.0);
+    return 0;
+}
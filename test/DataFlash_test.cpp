@@ -79,6 +79,60 @@ SUITE(SingleDeviceTest)
     {
         // [todo]
     }
+
+    TEST_FIXTURE(DeepPowerDownTest, DataFlashFixture)
+    {
+        m_dataflash.deepPowerDown();
+        CHECK(true, m_dataflash.isPoweredDown());
+
+        /* The next command transparently resumes the device. */
+        m_status = m_dataflash.status();
+        CHECK(false, m_dataflash.isPoweredDown());
+        CHECK(AT45_READY, m_status & AT45_READY);
+
+        DataFlash::PowerStats stats;
+        m_dataflash.powerStats(stats);
+        CHECK(1, stats.powerDowns);
+        CHECK(1, stats.resumes);
+    }
+
+    TEST_FIXTURE(VerifyRangeTest, DataFlashFixture)
+    {
+        /* A single page of the device under test (AT45DB161D), the
+         * pages are written and verified one at a time. */
+        static uint8_t data[DF_45DB161_PAGESIZE];
+        uint16_t size = m_dataflash.pageSize();
+        uint16_t i, j;
+
+        CHECK(true, size <= sizeof(data));
+        if(size > sizeof(data))
+        {
+            return;
+        }
+
+        for(i=0; i<2; i++)
+        {
+            m_dataflash.bufferWrite(0, 0);
+            for(j=0; j<size; j++)
+            {
+                m_dataflash.transfer((uint8_t)((i*size + j) * 7));
+            }
+            m_dataflash.disable();
+            m_dataflash.bufferToPage(0, 10 + i);
+        }
+
+        for(i=0; i<2; i++)
+        {
+            for(j=0; j<size; j++)
+            {
+                data[j] = (i*size + j) * 7;
+            }
+            CHECK(-1, m_dataflash.verifyRange(10 + i, data, 1));
+        }
+
+        data[3] ^= 0x01;
+        CHECK(11, m_dataflash.verifyRange(11, data, 1));
+    }
 }
 
 /* Arduino setup hook */